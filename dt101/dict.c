@@ -1,7 +1,7 @@
 /*
 
 Dictionaries
-Copyright 2014-2017, Ciaran Anscomb
+Copyright 2014-2018, Ciaran Anscomb
 
 This is free software; you can redistribute it and/or modify it under
 the terms of the GNU Lesser General Public License as published by the
@@ -12,40 +12,84 @@ option) any later version.
 
 #include "config.h"
 
-#include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "c-strcase.h"
-#include "hash.h"
 #include "xalloc.h"
 
 #include "dict.h"
 #include "slist.h"
 
+/* Entries are held inline in one array, probed linearly.  The full hash of
+ * each key is stored alongside it, so probing rarely needs to call the key
+ * comparison function, and growing the table never needs to rehash keys.
+ * Two hash values are reserved to mark empty and deleted slots. */
+
+#define HASH_EMPTY (0)
+#define HASH_DELETED (1)
+#define HASH_MIN_VALID (2)
+
+#define DICT_INITIAL_SIZE (16)
+
+struct dict_ent {
+	size_t hash;
+	void *key;
+	void *value;
+};
+
 struct dict {
 	Hash_hasher hash_func;
 	Hash_comparator key_equal_func;
 	Hash_data_freer key_destroy_func;
 	Hash_data_freer value_destroy_func;
-	Hash_table *ht;
+	size_t size;  // always a power of two
+	size_t nentries;
+	size_t nused;  // entries plus deleted markers
+	struct dict_ent *ents;
 };
 
-struct dict_ent {
-	struct dict *dict;
-	void *key;
-	void *value;
-};
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-struct dict_foreach_data {
-	dict_iter_func func;
-	void *data;
-};
+/* Hash functions are of the Gnulib type, returning a value less than the
+ * table size.  Asking for the largest table size gets the full hash, which is
+ * then mixed so that the low bits used to index the table are well
+ * distributed even for pointer keys. */
+
+static size_t dict_hash(struct dict *d, const void *k) {
+	uint64_t h = d->hash_func(k, SIZE_MAX);
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	size_t hash = (size_t)h;
+	return (hash < HASH_MIN_VALID) ? hash + HASH_MIN_VALID : hash;
+}
 
-static size_t dict_ent_hash(const void *, size_t);
-static bool dict_ent_equal(const void *, const void *);
-static void dict_ent_free(void *);
+static void dict_ent_free(struct dict *d, struct dict_ent *ent) {
+	if (d->key_destroy_func && ent->key)
+		d->key_destroy_func(ent->key);
+	if (d->value_destroy_func && ent->value)
+		d->value_destroy_func(ent->value);
+}
+
+static void dict_resize(struct dict *d, size_t new_size) {
+	struct dict_ent *old_ents = d->ents;
+	size_t old_size = d->size;
+	d->ents = xcalloc(new_size, sizeof(*d->ents));
+	d->size = new_size;
+	d->nused = d->nentries;
+	for (size_t i = 0; i < old_size; i++) {
+		if (old_ents[i].hash < HASH_MIN_VALID)
+			continue;
+		size_t j = old_ents[i].hash & (new_size - 1);
+		while (d->ents[j].hash != HASH_EMPTY)
+			j = (j + 1) & (new_size - 1);
+		d->ents[j] = old_ents[i];
+	}
+	free(old_ents);
+}
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
@@ -65,61 +109,80 @@ struct dict *dict_new_full(Hash_hasher hash_func,
 	new->key_equal_func = key_equal_func;
 	new->key_destroy_func = key_destroy_func;
 	new->value_destroy_func = value_destroy_func;
-	new->ht = hash_initialize(0, NULL, dict_ent_hash, dict_ent_equal, dict_ent_free);
+	new->size = DICT_INITIAL_SIZE;
+	new->nentries = 0;
+	new->nused = 0;
+	new->ents = xcalloc(new->size, sizeof(*new->ents));
 	return new;
 }
 
 /* Clear all entries in dictionary and free its allocation. */
 
 void dict_destroy(struct dict *d) {
-	hash_free(d->ht);
+	for (size_t i = 0; i < d->size; i++) {
+		if (d->ents[i].hash >= HASH_MIN_VALID)
+			dict_ent_free(d, &d->ents[i]);
+	}
+	free(d->ents);
 	free(d);
 }
 
 /* Find an entry by key. */
 
-static struct dict_ent *dict_find_ent(struct dict *d, const void *k) {
-	const struct dict_ent q = {
-		.key = (void *)k,
-		.dict = d
-	};
-	struct dict_ent *ent = hash_lookup(d->ht, &q);
-	if (!ent)
-		return NULL;
-	return ent;
+static struct dict_ent *dict_find_ent(struct dict *d, const void *k, size_t hash) {
+	size_t mask = d->size - 1;
+	for (size_t i = hash & mask; d->ents[i].hash != HASH_EMPTY; i = (i + 1) & mask) {
+		struct dict_ent *ent = &d->ents[i];
+		if (ent->hash == hash && d->key_equal_func(ent->key, k))
+			return ent;
+	}
+	return NULL;
 }
 
 /* Return the value for a given key, if it exists in the dictionary. */
 
 void *dict_lookup(struct dict *d, const void *k) {
-	struct dict_ent *ent = dict_find_ent(d, k);
+	struct dict_ent *ent = dict_find_ent(d, k, dict_hash(d, k));
 	if (!ent)
 		return NULL;
-	return (void *)ent->value;
+	return ent->value;
 }
 
 static void dict_add_ent(struct dict *d, void *k, void *v, bool replace_key) {
-	struct dict_ent *ent = dict_find_ent(d, k);
+	size_t hash = dict_hash(d, k);
+	struct dict_ent *ent = dict_find_ent(d, k, hash);
 	if (ent) {
 		if (replace_key) {
-			if (d->key_destroy_func && ent->key)
+			if (d->key_destroy_func && ent->key && ent->key != k)
 				d->key_destroy_func(ent->key);
 			ent->key = k;
 		} else {
-			if (d->key_destroy_func && k)
+			if (d->key_destroy_func && k && k != ent->key)
 				d->key_destroy_func(k);
 		}
-		if (d->value_destroy_func && ent->value)
+		if (d->value_destroy_func && ent->value && ent->value != v)
 			d->value_destroy_func(ent->value);
 		ent->value = v;
 		return;
 	}
-	struct dict_ent *new = xmalloc(sizeof(*new));
-	new->key = k;
-	new->value = v;
-	new->dict = d;
-	if (!hash_insert(d->ht, new))
-		xalloc_die();
+	/* Keep the table at most three quarters used.  If that's mostly down
+	 * to deleted markers, rebuilding at the same size clears them. */
+	if ((d->nused + 1) * 4 > d->size * 3) {
+		size_t new_size = d->size;
+		if ((d->nentries + 1) * 2 > d->size)
+			new_size *= 2;
+		dict_resize(d, new_size);
+	}
+	size_t mask = d->size - 1;
+	size_t i = hash & mask;
+	while (d->ents[i].hash >= HASH_MIN_VALID)
+		i = (i + 1) & mask;
+	if (d->ents[i].hash == HASH_EMPTY)
+		d->nused++;
+	d->ents[i].hash = hash;
+	d->ents[i].key = k;
+	d->ents[i].value = v;
+	d->nentries++;
 }
 
 /* Insert an entry into the dictionary.  If an entry already exists with the
@@ -142,53 +205,42 @@ void dict_add(struct dict *d, void *k) {
 	dict_add_ent(d, k, k, true);
 }
 
-/* Remove an entry from the dictionary, freeing its key and value if
- * destructors are defined.  Returns true if an entry was found and removed. */
+/* Remove an entry, leaving a deleted marker so that probing continues past
+ * it. */
 
-bool dict_remove(struct dict *d, const void *k) {
-	const struct dict_ent q = {
-		.key = (void *)k,
-		.dict = d
-	};
-	struct dict_ent *ent = hash_delete(d->ht, &q);
+static bool dict_remove_ent(struct dict *d, const void *k, bool free_ent) {
+	struct dict_ent *ent = dict_find_ent(d, k, dict_hash(d, k));
 	if (!ent)
 		return false;
-	dict_ent_free(ent);
+	if (free_ent)
+		dict_ent_free(d, ent);
+	ent->hash = HASH_DELETED;
+	ent->key = ent->value = NULL;
+	d->nentries--;
 	return true;
 }
 
-/* Remove an entry from the dictionary, but do not free key or value.  Returns
- * true if an entry was found and removed. */
+/* Remove an entry from the dictionary, freeing its key and value if
+ * destructors are defined.  Returns true if an entry was found and removed. */
 
-bool dict_steal(struct dict *d, const void *k) {
-	const struct dict_ent q = {
-		.key = (void *)k,
-		.dict = d
-	};
-	struct dict_ent *ent = hash_delete(d->ht, &q);
-	if (!ent)
-		return false;
-	free(ent);
-	return true;
+bool dict_remove(struct dict *d, const void *k) {
+	return dict_remove_ent(d, k, true);
 }
 
-/* Shim callback to interface to hash_do_for_each(). */
+/* Remove an entry from the dictionary, but do not free key or value.  Returns
+ * true if an entry was found and removed. */
 
-static bool dict_foreach_processor(void *e, void *d) {
-	struct dict_ent *ent = e;
-	struct dict_foreach_data *fd = d;
-	fd->func((void *)ent->key, (void *)ent->value, fd->data);
-	return 1;
+bool dict_steal(struct dict *d, const void *k) {
+	return dict_remove_ent(d, k, false);
 }
 
 /* Iterate over all elements in the dictionary. */
 
 void dict_foreach(struct dict *d, dict_iter_func func, void *data) {
-	struct dict_foreach_data fd = {
-		.func = func,
-		.data = data
-	};
-	hash_do_for_each(d->ht, dict_foreach_processor, &fd);
+	for (size_t i = 0; i < d->size; i++) {
+		if (d->ents[i].hash >= HASH_MIN_VALID)
+			func(d->ents[i].key, d->ents[i].value, data);
+	}
 }
 
 static void add_key(void *k, void *v, struct slist **lp) {
@@ -215,29 +267,6 @@ struct slist *dict_get_values(struct dict *d) {
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-static size_t dict_ent_hash(const void *v, size_t tablesize) {
-	const struct dict_ent *e = v;
-	return e->dict->hash_func(e->key, tablesize);
-}
-
-static bool dict_ent_equal(const void *v1, const void *v2) {
-	const struct dict_ent *e1 = v1;
-	const struct dict_ent *e2 = v2;
-	assert(e1->dict == e2->dict);
-	return e1->dict->key_equal_func(e1->key, e2->key);
-}
-
-static void dict_ent_free(void *v) {
-	struct dict_ent *e = v;
-	if (e->dict->key_destroy_func && e->key)
-		e->dict->key_destroy_func((void *)e->key);
-	if (e->dict->value_destroy_func && e->value)
-		e->dict->value_destroy_func((void *)e->value);
-	free(e);
-}
-
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
 size_t dict_direct_hash(const void *k, size_t tablesize) {
 	return (size_t)k % tablesize;
 }
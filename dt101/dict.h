@@ -1,15 +1,17 @@
 /*
 
 Dictionaries
-Copyright 2014-2017, Ciaran Anscomb
+Copyright 2014-2018, Ciaran Anscomb
 
 This is free software; you can redistribute it and/or modify it under
 the terms of the GNU Lesser General Public License as published by the
 Free Software Foundation; either version 2.1 of the License, or (at your
 option) any later version.
 
-A dictionary implementation using an externally supplied hash table.
-The hash table interface is expected to be as per Gnulib.
+A dictionary implementation using an open addressing hash table.  Keys
+and values are stored inline, so inserting an entry allocates nothing
+unless the table needs to grow.  Hash and comparison functions are of
+the types defined by Gnulib's hash module.
 
 */
 
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -25,52 +25,88 @@ option) any later version.
 
 #include "asm6809.h"
 #include "assemble.h"
+#include "atom.h"
+#include "depend.h"
+#include "dpadvice.h"
+#include "dpvar.h"
 #include "error.h"
 #include "listing.h"
 #include "node.h"
 #include "opcode.h"
+#include "optimize.h"
 #include "output.h"
+#include "profile.h"
 #include "program.h"
 #include "section.h"
 #include "slist.h"
 #include "symbol.h"
+#include "timing.h"
 
 struct asm6809_options asm6809_options;
 
-#define OUTPUT_BINARY (0)
-#define OUTPUT_DRAGONDOS (1)
-#define OUTPUT_COCO (2)
-#define OUTPUT_MOTOROLA_SREC (3)
-#define OUTPUT_INTEL_HEX (4)
+/* Long options without a short equivalent */
+#define OPT_CACHE_DIR (256)
+#define OPT_RECORD_LENGTH (257)
+#define OPT_EMIT (258)
+#define OPT_DP_REPORT (259)
+#define OPT_DP_ADVICE (260)
+#define OPT_PROFILE_RUN (261)
+#define OPT_PROFILE_START (262)
+#define OPT_PROFILE_SCRIPT (263)
 
 static int max_passes = 12;
-static int output_format = OUTPUT_BINARY;
+static int one_pass = 0;
+static unsigned jobs = 1;
+static char *cache_dir = NULL;
+static int output_format = output_format_binary;
+static unsigned record_length = 0;
 static char *exec_option = NULL;
 static char *output_filename = NULL;
 static char *exports_filename = NULL;
 static char *symbol_filename = NULL;
+static char *dp_report_filename = NULL;
+static char *dp_advice_filename = NULL;
+static char *profile_filename = NULL;
+static char *profile_start = NULL;
+static char *profile_script = NULL;
 static char *listing_filename = NULL;
+static int listing_cycles = 0;
+static int relax_branches = 0;
+static int optimize = 0;
 static int isa = asm6809_isa_6809;
 static int max_program_depth = 8;
 static int setdp = -1;
 static int verbosity = 0;
 
 static struct option long_options[] = {
-	{ "bin", no_argument, &output_format, OUTPUT_BINARY },
-	{ "dragondos", no_argument, &output_format, OUTPUT_DRAGONDOS },
-	{ "coco", no_argument, &output_format, OUTPUT_COCO },
-	{ "srec", no_argument, &output_format, OUTPUT_MOTOROLA_SREC },
-	{ "hex", no_argument, &output_format, OUTPUT_INTEL_HEX },
+	{ "bin", no_argument, &output_format, output_format_binary },
+	{ "dragondos", no_argument, &output_format, output_format_dragondos },
+	{ "coco", no_argument, &output_format, output_format_coco },
+	{ "srec", no_argument, &output_format, output_format_motorola_srec },
+	{ "hex", no_argument, &output_format, output_format_intel_hex },
 	{ "exec", required_argument, NULL, 'e' },
+	{ "record-length", required_argument, NULL, OPT_RECORD_LENGTH },
 	{ "6809", no_argument, &isa, asm6809_isa_6809 },
 	{ "6309", no_argument, &isa, asm6809_isa_6309 },
 	{ "define", required_argument, NULL, 'd' },
 	{ "setdp", required_argument, &setdp, 0 },
 	{ "max-passes", required_argument, NULL, 'P' },
+	{ "one-pass", no_argument, &one_pass, 1 },
+	{ "relax-branches", no_argument, &relax_branches, 1 },
+	{ "optimize", no_argument, &optimize, 1 },
+	{ "jobs", required_argument, NULL, 'j' },
+	{ "cache-dir", required_argument, NULL, OPT_CACHE_DIR },
 	{ "output", required_argument, NULL, 'o' },
+	{ "emit", required_argument, NULL, OPT_EMIT },
 	{ "listing", required_argument, NULL, 'l' },
+	{ "cycles", no_argument, &listing_cycles, 1 },
 	{ "exports", required_argument, NULL, 'E' },
 	{ "symbols", required_argument, NULL, 's' },
+	{ "dp-report", required_argument, NULL, OPT_DP_REPORT },
+	{ "dp-advice", required_argument, NULL, OPT_DP_ADVICE },
+	{ "profile-run", required_argument, NULL, OPT_PROFILE_RUN },
+	{ "profile-start", required_argument, NULL, OPT_PROFILE_START },
+	{ "profile-script", required_argument, NULL, OPT_PROFILE_SCRIPT },
 	{ "quiet", no_argument, NULL, 'q' },
 	{ "verbose", no_argument, NULL, 'v' },
 	{ "help", no_argument, NULL, 'h' },
@@ -79,9 +115,12 @@ static struct option long_options[] = {
 };
 
 static struct slist *files = NULL;
+static struct slist *outputs = NULL;
 
 static struct node *simple_parse_int(const char *);
+static void add_output(const char *);
 static void define_symbol(const char *);
+static void run_profile(void);
 static void helptext(void);
 static void versiontext(void);
 static _Noreturn void tidy_up_and_exit(int status);
@@ -91,29 +130,41 @@ static _Noreturn void tidy_up_and_exit(int status);
 int main(int argc, char **argv) {
 
 	int c;
-	while ((c = getopt_long(argc, argv, "BDCSHe:893d:P:o:l:E:s:qv",
+	while ((c = getopt_long(argc, argv, "BDCSHe:893d:P:j:o:l:E:s:qv",
 				long_options, NULL)) != -1) {
 		switch (c) {
 		case 0:
 			break;
 		case 'B':
-			output_format = OUTPUT_BINARY;
+			output_format = output_format_binary;
 			break;
 		case 'D':
-			output_format = OUTPUT_DRAGONDOS;
+			output_format = output_format_dragondos;
 			break;
 		case 'C':
-			output_format = OUTPUT_COCO;
+			output_format = output_format_coco;
 			break;
 		case 'S':
-			output_format = OUTPUT_MOTOROLA_SREC;
+			output_format = output_format_motorola_srec;
 			break;
 		case 'H':
-			output_format = OUTPUT_INTEL_HEX;
+			output_format = output_format_intel_hex;
 			break;
 		case 'e':
 			exec_option = optarg;
 			break;
+		case OPT_RECORD_LENGTH:
+			{
+				errno = 0;
+				long v = strtol(optarg, NULL, 0);
+				if (errno != 0 || v < 1 || v > 255) {
+					error(error_type_fatal, "invalid value for record-length");
+					error_print_list();
+					tidy_up_and_exit(EXIT_FAILURE);
+				}
+				record_length = v;
+			}
+			break;
 		case '8': case '9':
 			isa = asm6809_isa_6809;
 			break;
@@ -126,7 +177,7 @@ int main(int argc, char **argv) {
 		case 'P':
 			{
 				long v = strtol(optarg, NULL, 0);
-				if (errno != 0 || v < 2 || v > 255) {
+				if (errno != 0 || v < 1 || v > 255) {
 					error(error_type_fatal, "invalid value for max-passes");
 					error_print_list();
 					tidy_up_and_exit(EXIT_FAILURE);
@@ -134,9 +185,44 @@ int main(int argc, char **argv) {
 				max_passes = v;
 			}
 			break;
+		case 'j':
+			{
+				errno = 0;
+				long v = strtol(optarg, NULL, 0);
+				if (errno != 0 || v < 1 || v > 256) {
+					error(error_type_fatal, "invalid value for jobs");
+					error_print_list();
+					tidy_up_and_exit(EXIT_FAILURE);
+				}
+				jobs = v;
+			}
+			break;
+		case OPT_CACHE_DIR:
+			cache_dir = optarg;
+			break;
 		case 'o':
 			output_filename = optarg;
 			break;
+		case OPT_EMIT:
+			add_output(optarg);
+			break;
+		case OPT_DP_REPORT:
+			dp_report_filename = optarg;
+			break;
+		case OPT_DP_ADVICE:
+			dp_advice_filename = optarg;
+			asm6809_options.dp_advice = 1;
+			break;
+		case OPT_PROFILE_RUN:
+			profile_filename = optarg;
+			asm6809_options.profile = 1;
+			break;
+		case OPT_PROFILE_START:
+			profile_start = optarg;
+			break;
+		case OPT_PROFILE_SCRIPT:
+			profile_script = optarg;
+			break;
 		case 'l':
 			listing_filename = optarg;
 			break;
@@ -173,16 +259,24 @@ int main(int argc, char **argv) {
 	asm6809_options.max_program_depth = max_program_depth;
 	asm6809_options.setdp = setdp;
 	asm6809_options.verbosity = verbosity;
-	asm6809_options.listing_required = listing_filename ? 1 : 0;
+	asm6809_options.listing_required = (listing_filename || profile_filename) ? 1 : 0;
+	asm6809_options.listing_cycles = listing_cycles;
+	asm6809_options.cache_dir = cache_dir;
+	asm6809_options.record_length = record_length;
+	asm6809_options.relax_branches = relax_branches;
+	asm6809_options.optimize = optimize;
 
 	opcode_init();
 	assemble_init();
 
-	/* Read in each file */
-	for (int i = optind; i < argc; i++) {
-		struct prog *f = prog_new_file(argv[i]);
-		files = slist_append(files, f);
+	/* Read in each file, several at once if requested */
+	int nfiles = argc - optind;
+	struct prog **progs = xmalloc(nfiles * sizeof(*progs));
+	prog_new_files(nfiles, argv + optind, progs, jobs);
+	for (int i = 0; i < nfiles; i++) {
+		files = slist_append(files, progs[i]);
 	}
+	free(progs);
 
 	/* Fatal errors? */
 	if (error_level >= error_type_syntax) {
@@ -190,21 +284,42 @@ int main(int argc, char **argv) {
 		tidy_up_and_exit(EXIT_FAILURE);
 	}
 
-	/* Attempt to assemble files until consistent */
+	/* Attempt to assemble files until consistent.  In single-pass mode,
+	 * forward references in the first pass are patched once all symbols
+	 * are known, and further passes only happen if that wasn't enough. */
 	for (unsigned pass = 0; pass < max_passes; pass++) {
 		error_clear_all();
 		listing_free_all();
-		section_set("CODE", pass);
+		timing_free_all();
+		dpadvice_free_all();
+		profile_free_all();
+		optimize_reset();
+		section_set(atom_new("CODE"), pass);
+		depend_fixups = (one_pass && pass == 0);
 		for (struct slist *l = files; l; l = l->next) {
 			struct prog *f = l->data;
 			assemble_prog(f, pass);
 		}
+		/* Direct page variables are allocated once, after counting
+		 * references in the first pass (not including fixups), and
+		 * need another pass */
+		_Bool dp_allocated = (pass == 0 && dpvar_allocate());
+		if (depend_fixups) {
+			depend_resolve_fixups();
+			depend_fixups = 0;
+		}
 		section_finish_pass();
+		if (dp_allocated)
+			error(error_type_inconsistent, NULL);
 		/* Only inconsistencies trigger another pass */
 		if (error_level != error_type_inconsistent)
 			break;
 	}
 
+	/* Check any cycle budgets against the final code */
+	if (error_level < error_type_inconsistent)
+		timing_check_all();
+
 	/* Fatal errors? */
 	if (error_level >= error_type_inconsistent) {
 		error_print_list();
@@ -230,7 +345,7 @@ int main(int argc, char **argv) {
 		struct node *n = simple_parse_int(exec_option);
 		if (!n) {
 			unsigned v = 0;
-			struct node *tmp = symbol_get(exec_option);
+			struct node *tmp = symbol_get(atom_new(exec_option));
 			if (tmp) {
 				v = tmp->data.as_int & 0xffff;
 				node_free(tmp);
@@ -239,36 +354,18 @@ int main(int argc, char **argv) {
 			}
 			n = node_new_int(v);
 		}
-		symbol_force_set(".exec", n, 0, max_passes);
+		symbol_force_set(atom_new(".exec"), n, 0, max_passes);
 	}
 
-	// XXX At the moment listing generation must precede output, as
-	// coelescing spans might screw with the span data to which the listing
-	// refers.  Not a big deal, but needs fixing.
-
-	/* Generate output file */
+	/* Generate output files.  The file named by --output comes first, in
+	 * whichever format was selected. */
 	if (output_filename) {
-		switch (output_format) {
-		case OUTPUT_BINARY:
-			output_binary(output_filename);
-			break;
-		case OUTPUT_DRAGONDOS:
-			output_dragondos(output_filename);
-			break;
-		case OUTPUT_COCO:
-			output_coco(output_filename);
-			break;
-		case OUTPUT_MOTOROLA_SREC:
-			output_motorola_srec(output_filename);
-			break;
-		case OUTPUT_INTEL_HEX:
-			output_intel_hex(output_filename);
-			break;
-		default:
-			error(error_type_fatal, "internal: unexpected output format");
-			break;
-		}
+		struct output_file *output = xmalloc(sizeof(*output));
+		output->format = output_format;
+		output->filename = output_filename;
+		outputs = slist_prepend(outputs, output);
 	}
+	output_write_all(outputs, jobs);
 
 	/* Generate exports file */
 	if (exports_filename) {
@@ -292,6 +389,32 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	/* Generate direct page allocation report */
+	if (dp_report_filename) {
+		FILE *dpf = fopen(dp_report_filename, "wb");
+		if (dpf) {
+			dpvar_print_report(dpf);
+			fclose(dpf);
+		} else {
+			error(error_type_fatal, "%s: %s", dp_report_filename, strerror(errno));
+		}
+	}
+
+	/* Generate SETDP advice */
+	if (dp_advice_filename) {
+		FILE *dpf = fopen(dp_advice_filename, "wb");
+		if (dpf) {
+			dpadvice_print_report(dpf);
+			fclose(dpf);
+		} else {
+			error(error_type_fatal, "%s: %s", dp_advice_filename, strerror(errno));
+		}
+	}
+
+	/* Profile the program on the simulator */
+	if (profile_filename)
+		run_profile();
+
 	/* Any errors in all that? */
 	if (error_level >= error_type_syntax) {
 		error_print_list();
@@ -337,11 +460,80 @@ static void define_symbol(const char *str) {
 		value = node_new_int(1);
 	}
 	// TODO: check that key is a valid symbol name
-	symbol_set(key, value, 0, 0);
+	symbol_set(atom_new(key), value, 0, 0);
 	free(key);
 	node_free(value);
 }
 
+/* Run from the address or label given by --profile-start, or the EXEC
+ * address.  Overlaps in the coalesced data were already reported if any output
+ * was written. */
+
+static void run_profile(void) {
+	if (profile_script && !profile_read_script(profile_script))
+		return;
+	struct node *n = NULL;
+	if (profile_start) {
+		n = simple_parse_int(profile_start);
+		if (!n) {
+			n = symbol_try_get(atom_new(profile_start));
+			if (!n) {
+				error(error_type_fatal, "profile symbol '%s' not defined", profile_start);
+				return;
+			}
+		}
+	} else {
+		n = symbol_try_get(atom_new(".exec"));
+		if (!n || n->data.as_int < 0) {
+			node_free(n);
+			error(error_type_fatal, "no start address for profile (use --profile-start)");
+			return;
+		}
+	}
+	unsigned addr = n->data.as_int & 0xffff;
+	node_free(n);
+
+	struct error_mark mark;
+	error_mark(&mark);
+	struct section *image = section_coalesce_all(0);
+	if (outputs)
+		error_discard(&mark, error_type_data);
+	profile_run(image, addr);
+	section_free(image);
+
+	FILE *pf = fopen(profile_filename, "wb");
+	if (pf) {
+		profile_print_report(pf);
+		fclose(pf);
+	} else {
+		error(error_type_fatal, "%s: %s", profile_filename, strerror(errno));
+	}
+}
+
+/* Parse an --emit argument of the form FORMAT=FILE. */
+static void add_output(const char *arg) {
+	const char *eq = strchr(arg, '=');
+	if (!eq || eq == arg || eq[1] == 0) {
+		error(error_type_fatal, "invalid output specification: %s", arg);
+		error_print_list();
+		tidy_up_and_exit(EXIT_FAILURE);
+	}
+	char *name = xstrdup(arg);
+	name[eq - arg] = 0;
+	int format = output_format_by_name(name);
+	if (format < 0) {
+		error(error_type_fatal, "unknown output format '%s'", name);
+		free(name);
+		error_print_list();
+		tidy_up_and_exit(EXIT_FAILURE);
+	}
+	free(name);
+	struct output_file *output = xmalloc(sizeof(*output));
+	output->format = format;
+	output->filename = eq + 1;
+	outputs = slist_append(outputs, output);
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 static void helptext(void) {
@@ -355,17 +547,31 @@ static void helptext(void) {
 "  -S, --srec        output to Motorola SREC file\n"
 "  -H, --hex         output to Intel hex record file\n"
 "  -e, --exec=ADDR   EXEC address (for output formats that support one)\n"
+"      --record-length=N   data bytes per SREC or hex record [32]\n"
 "\n"
 "  -8,\n"
 "  -9, --6809                  use 6809 ISA (default)\n"
 "  -3, --6309                  use 6309 ISA (6809 with extensions)\n"
 "  -d, --define=SYM[=NUMBER]   define a symbol\n"
 "      --setdp=VALUE           initial value assumed for DP [undefined]\n"
+"      --one-pass              patch forward references instead of re-passing\n"
+"      --relax-branches        use shortest form of all relative branches\n"
+"      --optimize              rewrite instructions into faster or smaller forms\n"
+"  -j, --jobs=N                parse up to N source files at once [1]\n"
+"      --cache-dir=DIR         cache parsed source files in DIR\n"
 "\n"
 "  -o, --output=FILE    set output filename\n"
+"      --emit=FMT=FILE  also write FILE in format FMT (bin, dragondos, coco,\n"
+"                       srec or hex); may be repeated\n"
 "  -l, --listing=FILE   create listing file\n"
+"      --cycles         show cycle counts in listing\n"
 "  -E, --exports=FILE   create exports table\n"
 "  -s, --symbols=FILE   create symbol table\n"
+"      --dp-report=FILE   report direct page variable allocation\n"
+"      --dp-advice=FILE   report the SETDP that most favours direct addressing\n"
+"      --profile-run=FILE      run the program on a simulator, writing a profile\n"
+"      --profile-start=ADDR    address or label to profile from [EXEC address]\n"
+"      --profile-script=FILE   initialise memory and inputs for --profile-run\n"
 "\n"
 "  -q, --quiet     don't warn about illegal (but working) code\n"
 "  -v, --verbose   warn about explicitly inefficient code\n"
@@ -396,11 +602,19 @@ static _Noreturn void tidy_up_and_exit(int status) {
 		slist_free(files);
 		files = NULL;
 	}
+	slist_free_full(outputs, (slist_free_func)free);
+	outputs = NULL;
 	listing_free_all();
+	timing_free_all();
+	dpvar_free_all();
+	dpadvice_free_all();
+	profile_free_all();
 	prog_free_all();
 	symbol_free_all();
 	section_free_all();
 	opcode_free_all();
 	assemble_free_all();
+	node_free_all();
+	atom_free_all();
 	exit(status);
 }
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -33,6 +33,27 @@ struct asm6809_options {
 
 	/* If no listing file is required, don't keep a copy in memory. */
 	_Bool listing_required;
+
+	/* Show instruction cycle counts in the listing. */
+	_Bool listing_cycles;
+
+	/* Directory in which to cache parsed files, or NULL. */
+	char const *cache_dir;
+
+	/* Data bytes per record in hex output formats, or 0 for default. */
+	unsigned record_length;
+
+	/* Assemble all branches in their shortest form, as JBxx. */
+	_Bool relax_branches;
+
+	/* Default for peephole optimisation in each section. */
+	_Bool optimize;
+
+	/* Note memory operands for the SETDP advisor (see dpadvice.h). */
+	_Bool dp_advice;
+
+	/* Note labels for the profiler (see profile.h). */
+	_Bool profile;
 };
 
 extern struct asm6809_options asm6809_options;
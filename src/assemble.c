@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -22,20 +22,30 @@ option) any later version.
 #include "c-strcase.h"
 #include "dict.h"
 #include "slist.h"
+#include "xalloc.h"
 
 #include "asm6809.h"
 #include "assemble.h"
+#include "atom.h"
+#include "depend.h"
+#include "dpadvice.h"
+#include "dpvar.h"
 #include "error.h"
 #include "eval.h"
+#include "filemap.h"
 #include "instr.h"
 #include "interp.h"
 #include "listing.h"
 #include "node.h"
 #include "opcode.h"
+#include "optimize.h"
+#include "profile.h"
 #include "program.h"
 #include "register.h"
 #include "section.h"
+#include "sim.h"
 #include "symbol.h"
+#include "timing.h"
 
 static struct prog_ctx *defining_macro_ctx = NULL;
 static int defining_macro_level = 0;
@@ -43,6 +53,10 @@ static int defining_macro_level = 0;
 static unsigned asm_pass;
 static unsigned prog_depth = 0;
 
+/* Pass in which RUN last loaded the simulator, and its default cycle limit */
+static int run_pass = -1;
+#define RUN_MAX_CYCLES (100000000L)
+
 enum cond_state {
 	cond_state_if,
 	cond_state_if_done,
@@ -56,7 +70,10 @@ enum translate {
 	translate_inverse_vdg
 };
 
+static void assemble_instr(struct opcode const *op, struct node *raw_args, struct node *args);
+static void skip_excluded(struct prog_ctx *ctx, struct prog_line const *l);
 static void set_label(struct node *label, struct node *value, _Bool changeable);
+static void list_emitted(int old_pc, _Bool is_data, struct prog_line const *line);
 static void args_float_to_int(struct node *args);
 static int verify_num_args(struct node *args, int min, int max, const char *op);
 static int64_t have_int_optional(struct node *args, int aindex, const char *op, int64_t in);
@@ -73,6 +90,8 @@ static void pseudo_set(struct prog_line *);
 static void pseudo_org(struct prog_line *);
 static void pseudo_section(struct prog_line *);
 static void pseudo_section_name(struct prog_line *line);
+static void pseudo_dpvar(struct prog_line *);
+static void pseudo_peek(struct prog_line *);
 
 static void pseudo_fcb(struct prog_line *);
 static void pseudo_fcc(struct prog_line *);
@@ -89,110 +108,152 @@ static void pseudo_align(struct prog_line *line);
 
 static void pseudo_put(struct prog_line *);
 static void pseudo_setdp(struct prog_line *);
+static void pseudo_dparea(struct prog_line *);
+static void pseudo_cycles_max(struct prog_line *);
+static void pseudo_optimize(struct prog_line *);
 static void pseudo_include(struct prog_line *);
 static void pseudo_includebin(struct prog_line *);
+static void pseudo_includemem(struct prog_line *);
+static void pseudo_run(struct prog_line *);
 static void pseudo_end(struct prog_line *);
 static void pseudo_nop(struct prog_line *);
 
-struct pseudo_op {
-	const char *name;
-	void (*handler)(struct prog_line *);
+static struct asm_op pseudo_ops[] = {
+	{ .name = "macro", .type = asm_op_macro },
+	{ .name = "endm", .type = asm_op_endm },
+
+	/* Directives treated as NOPs */
+	{ .name = "opt", .type = asm_op_skip },
+	{ .name = "sttl", .type = asm_op_skip },
+	{ .name = "ttl", .type = asm_op_skip },
+
+	/* Conditional assembly */
+	{ .name = "if", .type = asm_op_if },
+	{ .name = "elsif", .type = asm_op_elsif },
+	{ .name = "else", .type = asm_op_else },
+	{ .name = "endif", .type = asm_op_endif },
+
+	{ .name = "export", .type = asm_op_names, .handler = &pseudo_export },
+	{ .name = "optimize", .type = asm_op_names, .handler = &pseudo_optimize },
+
+	/* Pseudo-ops that override any label meaning */
+	{ .name = "equ", .type = asm_op_label, .handler = &pseudo_equ },
+	{ .name = "set", .type = asm_op_label, .handler = &pseudo_set },
+	{ .name = "org", .type = asm_op_label, .handler = &pseudo_org },
+	{ .name = "section", .type = asm_op_label, .handler = &pseudo_section },
+	{ .name = "code", .type = asm_op_label, .handler = &pseudo_section_name },
+	{ .name = "data", .type = asm_op_label, .handler = &pseudo_section_name },
+	{ .name = "bss", .type = asm_op_label, .handler = &pseudo_section_name },
+	{ .name = "ram", .type = asm_op_label, .handler = &pseudo_section_name },
+	{ .name = "auto", .type = asm_op_label, .handler = &pseudo_section_name },
+	{ .name = "dpvar", .type = asm_op_label, .handler = &pseudo_dpvar },
+	{ .name = "peek", .type = asm_op_label, .handler = &pseudo_peek },
+	{ .name = "peekw", .type = asm_op_label, .handler = &pseudo_peek },
+
+	/* Pseudo-ops that emit data */
+	{ .name = "fcb", .type = asm_op_data, .handler = &pseudo_fcb },
+	{ .name = "fcc", .type = asm_op_data, .handler = &pseudo_fcc },
+	{ .name = "fcn", .type = asm_op_data, .handler = &pseudo_fcn },
+	{ .name = "fcv", .type = asm_op_data, .handler = &pseudo_fcv },
+	{ .name = "fci", .type = asm_op_data, .handler = &pseudo_fci },
+	{ .name = "fcs", .type = asm_op_data, .handler = &pseudo_fcs },
+	{ .name = "fdb", .type = asm_op_data, .handler = &pseudo_fdb },
+	{ .name = "fqb", .type = asm_op_data, .handler = &pseudo_fqb },
+	{ .name = "rzb", .type = asm_op_data, .handler = &pseudo_rzb },
+	{ .name = "fzb", .type = asm_op_data, .handler = &pseudo_rzb },
+	{ .name = "zmb", .type = asm_op_data, .handler = &pseudo_rzb },  // alias
+	{ .name = "bsz", .type = asm_op_data, .handler = &pseudo_rzb },  // alias
+	{ .name = "fill", .type = asm_op_data, .handler = &pseudo_fill },
+	{ .name = "rmb", .type = asm_op_data, .handler = &pseudo_rmb },
+	{ .name = "align", .type = asm_op_data, .handler = &pseudo_align },
+	{ .name = "includebin", .type = asm_op_data, .handler = &pseudo_includebin },
+	{ .name = "includemem", .type = asm_op_data, .handler = &pseudo_includemem },
+
+	/* Other pseudo-ops */
+	{ .name = "put", .type = asm_op_other, .handler = &pseudo_put },
+	{ .name = "setdp", .type = asm_op_other, .handler = &pseudo_setdp },
+	{ .name = "dparea", .type = asm_op_other, .handler = &pseudo_dparea },
+	{ .name = "cycles_max", .type = asm_op_other, .handler = &pseudo_cycles_max },
+	{ .name = "run", .type = asm_op_other, .handler = &pseudo_run },
+	{ .name = "include", .type = asm_op_other, .handler = &pseudo_include },
+	{ .name = "LIB", .type = asm_op_other, .handler = &pseudo_include },
+	{ .name = "end", .type = asm_op_other, .handler = &pseudo_end },
+	{ .name = "page", .type = asm_op_other, .handler = &pseudo_nop },
+	{ .name = "spc", .type = asm_op_other, .handler = &pseudo_nop },
+	{ .name = "nam", .type = asm_op_other, .handler = &pseudo_nop },
+	{ .name = "name", .type = asm_op_other, .handler = &pseudo_nop },
 };
 
-/* Pseudo-ops that override any label meaning */
-
-static struct pseudo_op pseudo_label_ops[] = {
-	{ .name = "equ", .handler = &pseudo_equ },
-	{ .name = "set", .handler = &pseudo_set },
-	{ .name = "org", .handler = &pseudo_org },
-	{ .name = "section", .handler = &pseudo_section },
-	{ .name = "code", .handler = &pseudo_section_name },
-	{ .name = "data", .handler = &pseudo_section_name },
-	{ .name = "bss", .handler = &pseudo_section_name },
-	{ .name = "ram", .handler = &pseudo_section_name },
-	{ .name = "auto", .handler = &pseudo_section_name },
-};
-
-/* Pseudo-ops that emit data */
-
-static struct pseudo_op pseudo_data_ops[] = {
-	{ .name = "fcb", .handler = &pseudo_fcb },
-	{ .name = "fcc", .handler = &pseudo_fcc },
-	{ .name = "fcn", .handler = &pseudo_fcn },
-	{ .name = "fcv", .handler = &pseudo_fcv },
-	{ .name = "fci", .handler = &pseudo_fci },
-	{ .name = "fcs", .handler = &pseudo_fcs },
-	{ .name = "fdb", .handler = &pseudo_fdb },
-	{ .name = "fqb", .handler = &pseudo_fqb },
-	{ .name = "rzb", .handler = &pseudo_rzb },
-	{ .name = "fzb", .handler = &pseudo_rzb },
-	{ .name = "zmb", .handler = &pseudo_rzb },  // alias
-	{ .name = "bsz", .handler = &pseudo_rzb },  // alias
-	{ .name = "fill", .handler = &pseudo_fill },
-	{ .name = "rmb", .handler = &pseudo_rmb },
-	{ .name = "align", .handler = &pseudo_align },
-	{ .name = "includebin", .handler = &pseudo_includebin },
-};
+/* Speed lookups using dictionaries.  Both are filled in advance, so lookups
+ * never modify them, and files can be parsed concurrently. */
 
-/* Other pseudo-ops */
-
-static struct pseudo_op pseudo_ops[] = {
-	{ .name = "put", .handler = &pseudo_put },
-	{ .name = "setdp", .handler = &pseudo_setdp },
-	{ .name = "include", .handler = &pseudo_include },
-	{ .name = "LIB", .handler = &pseudo_include },
-	{ .name = "end", .handler = &pseudo_end },
-	{ .name = "page", .handler = &pseudo_nop },
-	{ .name = "opt", .handler = &pseudo_nop },
-	{ .name = "spc", .handler = &pseudo_nop },
-	{ .name = "ttl", .handler = &pseudo_nop },
-	{ .name = "sttl", .handler = &pseudo_nop },
-	{ .name = "nam", .handler = &pseudo_nop },
-	{ .name = "name", .handler = &pseudo_nop },
-};
+static struct dict *pseudo_dict = NULL;
+static struct dict *instruction_dict = NULL;
 
-/* Speed psuedo-op lookups using dictionaries */
+/* Files included by INCLUDEBIN are mapped when first used, and the mapping
+ * kept for later passes.  Keyed by filename atom. */
 
-static struct dict *pseudo_label_dict = NULL;
-static struct dict *pseudo_data_dict = NULL;
-static struct dict *pseudo_dict = NULL;
+static struct dict *binary_files = NULL;
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+static void add_instruction(struct opcode const *opcode, void *data) {
+	struct asm_op *op = xmalloc(sizeof(*op));
+	op->name = opcode->op;
+	op->type = asm_op_instruction;
+	op->handler = NULL;
+	op->opcode = opcode;
+	dict_insert((struct dict *)data, (void *)op->name, op);
+}
+
 void assemble_init(void) {
-	if (!pseudo_label_dict) {
-		pseudo_label_dict = dict_new(dict_str_hash_case, dict_str_equal_case);
-		for (unsigned i = 0; i < ARRAY_N_ELEMENTS(pseudo_label_ops); i++) {
-			dict_insert(pseudo_label_dict, (void *)pseudo_label_ops[i].name, (void *)pseudo_label_ops[i].handler);
-		}
-	}
-	if (!pseudo_data_dict) {
-		pseudo_data_dict = dict_new(dict_str_hash_case, dict_str_equal_case);
-		for (unsigned i = 0; i < ARRAY_N_ELEMENTS(pseudo_data_ops); i++) {
-			dict_insert(pseudo_data_dict, (void *)pseudo_data_ops[i].name, (void *)pseudo_data_ops[i].handler);
-		}
-	}
 	if (!pseudo_dict) {
 		pseudo_dict = dict_new(dict_str_hash_case, dict_str_equal_case);
 		for (unsigned i = 0; i < ARRAY_N_ELEMENTS(pseudo_ops); i++) {
-			dict_insert(pseudo_dict, (void *)pseudo_ops[i].name, (void *)pseudo_ops[i].handler);
+			dict_insert(pseudo_dict, (void *)pseudo_ops[i].name, (void *)&pseudo_ops[i]);
 		}
 	}
+	if (!instruction_dict) {
+		instruction_dict = dict_new_full(dict_str_hash_case, dict_str_equal_case, NULL, free);
+		opcode_foreach(add_instruction, instruction_dict);
+	}
 }
 
 void assemble_free_all(void) {
-	if (pseudo_label_dict) {
-		dict_destroy(pseudo_label_dict);
-		pseudo_label_dict = NULL;
-	}
-	if (pseudo_data_dict) {
-		dict_destroy(pseudo_data_dict);
-		pseudo_data_dict = NULL;
-	}
 	if (pseudo_dict) {
 		dict_destroy(pseudo_dict);
 		pseudo_dict = NULL;
 	}
+	if (instruction_dict) {
+		dict_destroy(instruction_dict);
+		instruction_dict = NULL;
+	}
+	if (binary_files) {
+		dict_destroy(binary_files);
+		binary_files = NULL;
+	}
+}
+
+struct asm_op const *assemble_op_by_name(const char *name) {
+	struct asm_op *op = dict_lookup(pseudo_dict, name);
+	if (op)
+		return op;
+	return dict_lookup(instruction_dict, name);
+}
+
+/* Fetch a line's opcode name and what it resolved to, resolving it now if it
+ * had to be pasted together from positional variables. */
+
+static struct node *line_opcode(struct prog_line const *l, struct asm_op const **op) {
+	*op = NULL;
+	if (node_type_of(l->opcode) == node_type_opcode) {
+		*op = l->opcode->data.as_opcode.op;
+		return node_ref(l->opcode->data.as_opcode.name);
+	}
+	struct node *n = eval_string(l->opcode);
+	if (n)
+		*op = assemble_op_by_name(n->data.as_string);
+	return n;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -315,29 +376,33 @@ void assemble_prog(struct prog *prog, unsigned pass) {
 		cur_section->line_number++;
 
 		if (!l->label && !l->opcode && !l->args) {
-			listing_add_line(-1, 0, NULL, l->text);
+			listing_add_line(-1, 0, NULL, l);
 			continue;
 		}
 
 		n_line.label = NULL;
-		n_line.opcode = eval_string(l->opcode);
 		n_line.args = NULL;
 		n_line.text = l->text;
+		n_line.text_len = l->text_len;
+
+		struct asm_op const *op;
+		n_line.opcode = line_opcode(l, &op);
+		enum asm_op_type op_type = op ? op->type : asm_op_none;
 
 		/* Macro handling */
 
-		if (!cond_excluded && n_line.opcode && 0 == c_strcasecmp("macro", n_line.opcode->data.as_string)) {
+		if (!cond_excluded && op_type == asm_op_macro) {
 			defining_macro_level++;
 			if (defining_macro_level == 1) {
 				n_line.label = eval_string(l->label);
 				n_line.args = node_ref(l->args);
 				pseudo_macro(&n_line);
-				listing_add_line(-1, 0, NULL, l->text);
+				listing_add_line(-1, 0, NULL, l);
 				goto next_line;
 			}
 		}
 
-		if (!cond_excluded && n_line.opcode && 0 == c_strcasecmp("endm", n_line.opcode->data.as_string)) {
+		if (!cond_excluded && op_type == asm_op_endm) {
 			if (defining_macro_level == 0) {
 				error(error_type_syntax, "ENDM without beginning MACRO");
 				goto next_line;
@@ -346,7 +411,7 @@ void assemble_prog(struct prog *prog, unsigned pass) {
 			if (defining_macro_level == 0) {
 				n_line.args = eval_node(l->args);
 				pseudo_endm(&n_line);
-				listing_add_line(-1, 0, NULL, l->text);
+				listing_add_line(-1, 0, NULL, l);
 				goto next_line;
 			}
 		}
@@ -354,21 +419,21 @@ void assemble_prog(struct prog *prog, unsigned pass) {
 		if (defining_macro_level > 0) {
 			if (defining_macro_ctx)
 				prog_ctx_add_line(defining_macro_ctx, prog_line_ref(l));
-			listing_add_line(-1, 0, NULL, l->text);
+			listing_add_line(-1, 0, NULL, l);
 			goto next_line;
 		}
 
+		switch (op_type) {
+
 		/* Skip any directives that we treat as NOPs. */
-		if (n_line.opcode && 0 == c_strcasecmp("opt", n_line.opcode->data.as_string)
-			|| n_line.opcode && 0 == c_strcasecmp("sttl", n_line.opcode->data.as_string)
-			|| n_line.opcode && 0 == c_strcasecmp("ttl", n_line.opcode->data.as_string)) {
-			listing_add_line(-1, 0, NULL, l->text);
+		case asm_op_skip:
+			listing_add_line(-1, 0, NULL, l);
 			goto next_line;
-		}
+
 		/* Conditional assembly */
 
-		if (n_line.opcode && 0 == c_strcasecmp("if", n_line.opcode->data.as_string)) {
-			listing_add_line(-1, 0, NULL, l->text);
+		case asm_op_if:
+			listing_add_line(-1, 0, NULL, l);
 			if (!cond_excluded) {
 				symbol_ignore_undefined = 1;
 				n_line.args = eval_node(l->args);
@@ -382,11 +447,12 @@ void assemble_prog(struct prog *prog, unsigned pass) {
 			} else {
 				cond_list = slist_prepend(cond_list, (void *)cond_state_if_done);
 			}
+			if (cond_excluded)
+				skip_excluded(ctx, l);
 			goto next_line;
-		}
 
-		if (n_line.opcode && 0 == c_strcasecmp("elsif", n_line.opcode->data.as_string)) {
-			listing_add_line(-1, 0, NULL, l->text);
+		case asm_op_elsif:
+			listing_add_line(-1, 0, NULL, l);
 			if (!cond_list) {
 				error(error_type_syntax, "ELSIF without IF");
 			} else if ((intptr_t)cond_list->data == cond_state_else) {
@@ -406,12 +472,13 @@ void assemble_prog(struct prog *prog, unsigned pass) {
 						cond_list->data = (void *)cond_state_if_done;
 					}
 				}
+				if (cond_excluded)
+					skip_excluded(ctx, l);
 			}
 			goto next_line;
-		}
 
-		if (n_line.opcode && 0 == c_strcasecmp("else", n_line.opcode->data.as_string)) {
-			listing_add_line(-1, 0, NULL, l->text);
+		case asm_op_else:
+			listing_add_line(-1, 0, NULL, l);
 			if (!cond_list) {
 				error(error_type_syntax, "ELSE without IF");
 			} else if ((intptr_t)cond_list->data == cond_state_else) {
@@ -425,11 +492,12 @@ void assemble_prog(struct prog *prog, unsigned pass) {
 				cond_list->data = (void *)cond_state_else;
 				cond_excluded = cond_list;
 			}
+			if (cond_list && cond_excluded)
+				skip_excluded(ctx, l);
 			goto next_line;
-		}
 
-		if (n_line.opcode && 0 == c_strcasecmp("endif", n_line.opcode->data.as_string)) {
-			listing_add_line(-1, 0, NULL, l->text);
+		case asm_op_endif:
+			listing_add_line(-1, 0, NULL, l);
 			if (!cond_list) {
 				error(error_type_syntax, "ENDIF without IF");
 				goto next_line;
@@ -438,127 +506,137 @@ void assemble_prog(struct prog *prog, unsigned pass) {
 			}
 			cond_list = slist_remove(cond_list, cond_list->data);
 			goto next_line;
+
+		default:
+			break;
 		}
 
 		if (cond_excluded) {
-			listing_add_line(-1, 0, NULL, l->text);
+			listing_add_line(-1, 0, NULL, l);
 			goto next_line;
 		}
 
 		/* Normal processing */
 
+		/* Control may arrive at a labelled line from elsewhere */
+		if (l->label)
+			optimize_reset();
+
 		n_line.label = eval_int(l->label);
 		if (!n_line.label)
 			n_line.label = eval_string(l->label);
 
-		/* EXPORT only needs symbol names, not their values */
-		if (n_line.opcode && 0 == c_strcasecmp("export", n_line.opcode->data.as_string)) {
+		/* EXPORT and OPTIMIZE only need names, not their values */
+		if (op_type == asm_op_names) {
 			n_line.args = node_ref(l->args);
-			pseudo_export(&n_line);
-			listing_add_line(-1, 0, NULL, l->text);
+			op->handler(&n_line);
+			listing_add_line(-1, 0, NULL, l);
 			goto next_line;
 		}
 
-		/* Anything else needs a fully evaluated list of arguments */
-		n_line.args = eval_node(l->args);
+		/* Unless a pseudo-op determines its value, any label on the line
+		 * gets PC as its value.  This is set before the arguments are
+		 * evaluated, so that a local label referring back to its own line
+		 * finds the same value in every pass. */
+		if (op_type != asm_op_label && n_line.label) {
+			set_label(n_line.label, node_new_int(cur_section->pc), 0);
+			listing_label();
+			if (node_type_of(n_line.label) == node_type_string) {
+				if (asm6809_options.dp_advice)
+					dpadvice_label(n_line.label->data.as_string);
+				if (asm6809_options.profile)
+					profile_label(n_line.label->data.as_string);
+			}
+		}
 
-		/* Pseudo-ops which determine a label's value */
-		void (*op_handler)(struct prog_line *);
-		if (n_line.opcode) {
-			op_handler = dict_lookup(pseudo_label_dict, n_line.opcode->data.as_string);
-			if (op_handler) {
-				op_handler(&n_line);
+		/* Instructions and data whose dependencies are unchanged since
+		 * the previous pass are replayed rather than re-evaluated.  An
+		 * optimised instruction also depends on its neighbours, and the
+		 * SETDP advisor needs to see every operand, so in those cases
+		 * instructions are always assembled afresh. */
+		if (op_type != asm_op_label && n_line.opcode &&
+		    !(op_type == asm_op_instruction &&
+		      (cur_section->optimize || asm6809_options.dp_advice))) {
+			struct depend_record *rec = depend_lookup(l);
+			if (rec) {
+				int old_pc = cur_section->pc;
+				_Bool is_data = depend_replay(rec);
+				list_emitted(old_pc, is_data, l);
 				goto next_line;
 			}
+			depend_begin();
 		}
 
-		/* Otherwise, any label on the line gets PC as its value */
-		if (n_line.label) {
-			set_label(n_line.label, node_new_int(cur_section->pc), 0);
+		/* Anything else needs a fully evaluated list of arguments.  In
+		 * the first pass, references that could be direct are counted
+		 * for DPVAR allocation. */
+		dpvar_counting = (op_type == asm_op_instruction &&
+				  cur_section->dp <= 0xff &&
+				  dpvar_countable(op->opcode, l->args));
+		n_line.args = eval_node(l->args);
+		dpvar_counting = 0;
+
+		/* Pseudo-ops which determine a label's value */
+		if (op_type == asm_op_label) {
+			op->handler(&n_line);
+			goto next_line;
 		}
 
 		/* No opcode?  Next line. */
 		if (!n_line.opcode) {
 			if (n_line.label)
-				listing_add_line(cur_section->pc & 0xffff, 0, NULL, l->text);
+				listing_add_line(cur_section->pc & 0xffff, 0, NULL, l);
 			goto next_line;
 		}
 
+		switch (op_type) {
+
 		/* Pseudo-ops that emit or reserve data */
-		op_handler = dict_lookup(pseudo_data_dict, n_line.opcode->data.as_string);
-		if (op_handler) {
-			int old_pc = cur_section->pc;
-			op_handler(&n_line);
-			int nbytes = cur_section->pc - old_pc;
-			if (cur_section->span && cur_section->pc == (int)(cur_section->span->put + cur_section->span->size))
-				listing_add_line(old_pc & 0xffff, nbytes, cur_section->span, l->text);
-			else
-				listing_add_line(old_pc & 0xffff, nbytes, NULL, l->text);
-			goto next_line;
-		}
+		case asm_op_data:
+			{
+				int old_pc = cur_section->pc;
+				op->handler(&n_line);
+				depend_end(l, 1);
+				list_emitted(old_pc, 1, l);
+			}
+			break;
 
 		/* Other pseudo-ops */
-		op_handler = dict_lookup(pseudo_dict, n_line.opcode->data.as_string);
-		if (op_handler) {
-			listing_add_line(cur_section->pc, 0, NULL, l->text);
-			op_handler(&n_line);
-			goto next_line;
-		}
+		case asm_op_other:
+			depend_cancel();
+			listing_add_line(cur_section->pc, 0, NULL, l);
+			op->handler(&n_line);
+			break;
 
 		/* Real instructions */
-		struct opcode const *op = opcode_by_name(n_line.opcode->data.as_string);
-		if (op) {
-			int old_pc = cur_section->pc;
-			int op_ext_type = op->type & OPCODE_EXT_TYPE;
-			/* No instruction accepts floats, convert them all to
-			 * integer here as a convenience: */
-			args_float_to_int(n_line.args);
-			if (op->type == OPCODE_INHERENT) {
-				instr_inherent(op, n_line.args);
-			} else if ((op_ext_type == OPCODE_IMM8 ||
-				    op_ext_type == OPCODE_IMM16 ||
-				    op_ext_type == OPCODE_IMM32) &&
-				   (arg_attr(l->args, 0) == node_attr_immediate)) {
-				instr_immediate(op, n_line.args);
-			} else if (op_ext_type == OPCODE_IMM8_MEM) {
-				/* Important to check this here, as the
-				 * OPCODE_MEM bits will also be set. */
-				instr_imm8_mem(op, n_line.args);
-			} else if (op->type & OPCODE_MEM) {
-				instr_address(op, n_line.args, -1);
-			} else if (op_ext_type == OPCODE_REL8 ||
-				   op_ext_type == OPCODE_REL16) {
-				instr_rel(op, n_line.args);
-			} else if (op_ext_type == OPCODE_STACKU) {
-				instr_stack(op, n_line.args, REG_U);
-			} else if (op_ext_type == OPCODE_STACKS) {
-				instr_stack(op, n_line.args, REG_S);
-			} else if (op_ext_type == OPCODE_PAIR) {
-				instr_pair(op, n_line.args);
-			} else if (op_ext_type == OPCODE_TFM) {
-				instr_tfm(op, n_line.args);
-			} else if (op_ext_type == OPCODE_REG_MEM) {
-				instr_reg_mem(op, n_line.args);
-			} else {
-				error(error_type_syntax, "invalid addressing mode");
+		case asm_op_instruction:
+			{
+				int old_pc = cur_section->pc;
+				assemble_instr(op->opcode, l->args, n_line.args);
+				if (cur_section->optimize)
+					listing_note(optimize_instr(old_pc, n_line.args, ctx));
+				depend_end(l, 0);
+				list_emitted(old_pc, 0, l);
 			}
-			int nbytes = cur_section->pc - old_pc;
-			listing_add_line(old_pc & 0xffff, nbytes, cur_section->span, l->text);
-			goto next_line;
-		}
+			break;
 
 		/* Macro expansion */
-		struct prog *macro = prog_macro_by_name(n_line.opcode->data.as_string);
-		if (macro) {
-			listing_add_line(cur_section->pc & 0xffff, 0, NULL, l->text);
-			interp_push(n_line.args);
-			assemble_prog(macro, pass);
-			interp_pop();
-			goto next_line;
+		default:
+			depend_cancel();
+			{
+				struct prog *macro = prog_macro_by_name(n_line.opcode->data.as_string);
+				if (macro) {
+					listing_add_line(cur_section->pc & 0xffff, 0, NULL, l);
+					interp_push(n_line.args);
+					assemble_prog(macro, pass);
+					interp_pop();
+					break;
+				}
+			}
+			error(error_type_syntax, "unknown instruction '%s'", n_line.opcode->data.as_string);
+			break;
 		}
 
-		error(error_type_syntax, "unknown instruction '%s'", n_line.opcode->data.as_string);
-
 next_line:
 		node_free(n_line.label);
 		node_free(n_line.opcode);
@@ -575,8 +653,94 @@ next_line:
 	prog_ctx_free(ctx);
 }
 
+/* Assemble a single instruction or data pseudo-op out of sequence, with no
+ * listing.  Used to patch forward references in single-pass mode, once the
+ * rest of the program has been seen (see depend.h). */
+
+void assemble_line(struct prog_line *l) {
+	struct prog_line n_line;
+	struct asm_op const *op;
+	n_line.label = NULL;
+	n_line.opcode = line_opcode(l, &op);
+	n_line.args = eval_node(l->args);
+	n_line.text = l->text;
+	n_line.text_len = l->text_len;
+
+	switch (op ? op->type : asm_op_none) {
+	case asm_op_data:
+		op->handler(&n_line);
+		break;
+	case asm_op_instruction:
+		assemble_instr(op->opcode, l->args, n_line.args);
+		break;
+	default:
+		break;
+	}
+
+	node_free(n_line.opcode);
+	node_free(n_line.args);
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+/* Dispatch an instruction on addressing mode.  The unevaluated arguments are
+ * needed to check for immediate mode. */
+
+static void assemble_instr(struct opcode const *op, struct node *raw_args, struct node *args) {
+	int op_ext_type = op->type & OPCODE_EXT_TYPE;
+	/* No instruction accepts floats, convert them all to integer here as a
+	 * convenience: */
+	args_float_to_int(args);
+	if (op->type == OPCODE_INHERENT) {
+		instr_inherent(op, args);
+	} else if ((op_ext_type == OPCODE_IMM8 ||
+		    op_ext_type == OPCODE_IMM16 ||
+		    op_ext_type == OPCODE_IMM32) &&
+		   (arg_attr(raw_args, 0) == node_attr_immediate)) {
+		instr_immediate(op, args);
+	} else if (op_ext_type == OPCODE_IMM8_MEM) {
+		/* Important to check this here, as the OPCODE_MEM bits will
+		 * also be set. */
+		instr_imm8_mem(op, args);
+	} else if (op->type & OPCODE_MEM) {
+		instr_address(op, args, -1);
+	} else if (op_ext_type == OPCODE_REL8 ||
+		   op_ext_type == OPCODE_REL16 ||
+		   op_ext_type == OPCODE_RELAX) {
+		instr_rel(op, args);
+	} else if (op_ext_type == OPCODE_STACKU) {
+		instr_stack(op, args, REG_U);
+	} else if (op_ext_type == OPCODE_STACKS) {
+		instr_stack(op, args, REG_S);
+	} else if (op_ext_type == OPCODE_PAIR) {
+		instr_pair(op, args);
+	} else if (op_ext_type == OPCODE_TFM) {
+		instr_tfm(op, args);
+	} else if (op_ext_type == OPCODE_REG_MEM) {
+		instr_reg_mem(op, args);
+	} else {
+		error(error_type_syntax, "invalid addressing mode");
+	}
+}
+
+/* Skip lines up to the next branch of an excluded conditional, where known.
+ * Skipped lines are listed as they would be otherwise, and still count
+ * towards the section's line number. */
+
+static void skip_excluded(struct prog_ctx *ctx, struct prog_line const *l) {
+	if (l->cond_skip < 2)
+		return;
+	unsigned nlines = l->cond_skip - 1;
+	if (asm6809_options.listing_required) {
+		for (unsigned i = 0; i < nlines; i++) {
+			struct prog_line *skipped = ctx->prog->lines[ctx->line_number + i];
+			listing_add_line(-1, 0, NULL, skipped);
+		}
+	}
+	prog_ctx_skip(ctx, nlines);
+	cur_section->line_number += nlines;
+}
+
 /* A disposable node must be passed in as value.  symbol_set() performs an eval
  * and stores the result, not the original node. */
 
@@ -597,6 +761,22 @@ static void set_label(struct node *label, struct node *value, _Bool changeable)
 	node_free(value);
 }
 
+/* List a line that emitted data or an instruction.  Data pseudo-ops only show
+ * their bytes if the put address matches PC. */
+
+static void list_emitted(int old_pc, _Bool is_data, struct prog_line const *line) {
+	int nbytes = cur_section->pc - old_pc;
+	struct section_span const *span = cur_section->span;
+	if (is_data && !(span && cur_section->pc == (int)(span->put + span->size)))
+		span = NULL;
+	if (is_data)
+		listing_add_line(old_pc & 0xffff, nbytes, span, line);
+	else
+		listing_add_instr(old_pc & 0xffff, nbytes, span, line);
+	if (timing_recording && !is_data && span)
+		timing_add_instr(old_pc & 0xffff, nbytes, span, cur_section->dp <= 0xff ? (int)cur_section->dp : -1);
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 /* EQU.  A symbol with the name of this line's label is assigned a value. */
@@ -610,10 +790,10 @@ static void pseudo_equ(struct prog_line *line) {
 	set_label(line->label, node_ref(arga[0]), 0);
 	struct node *n = eval_int(arga[0]);
 	if (n) {
-		listing_add_line(n->data.as_int & 0xffff, 0, NULL, line->text);
+		listing_add_line(n->data.as_int & 0xffff, 0, NULL, line);
 		node_free(n);
 	} else {
-		listing_add_line(-1, 0, NULL, line->text);
+		listing_add_line(-1, 0, NULL, line);
 	}
 }
 
@@ -626,10 +806,10 @@ static void pseudo_set(struct prog_line *line) {
 	set_label(line->label, node_ref(arga[0]), 1);
 	struct node *n = eval_int(arga[0]);
 	if (n) {
-		listing_add_line(n->data.as_int & 0xffff, 0, NULL, line->text);
+		listing_add_line(n->data.as_int & 0xffff, 0, NULL, line);
 		node_free(n);
 	} else {
-		listing_add_line(-1, 0, NULL, line->text);
+		listing_add_line(-1, 0, NULL, line);
 	}
 }
 
@@ -643,7 +823,7 @@ static void pseudo_org(struct prog_line *line) {
 	if (new_pc >= 0)
 		cur_section->put = new_pc;
 	set_label(line->label, node_new_int(new_pc), 0);
-	listing_add_line(new_pc & 0xffff, 0, NULL, line->text);
+	listing_add_line(new_pc & 0xffff, 0, NULL, line);
 }
 
 /* SECTION.  Switch sections. */
@@ -662,7 +842,7 @@ static void pseudo_section(struct prog_line *line) {
 	section_set(n->data.as_string, asm_pass);
 	node_free(n);
 	set_label(line->label, node_new_int(cur_section->pc), 0);
-	listing_add_line(cur_section->pc, 0, NULL, line->text);
+	listing_add_line(cur_section->pc, 0, NULL, line);
 }
 
 /*
@@ -672,7 +852,35 @@ static void pseudo_section(struct prog_line *line) {
 static void pseudo_section_name(struct prog_line *line) {
 	section_set(line->opcode->data.as_string, asm_pass);
 	set_label(line->label, node_new_int(cur_section->pc), 0);
-	listing_add_line(cur_section->pc, 0, NULL, line->text);
+	listing_add_line(cur_section->pc, 0, NULL, line);
+}
+
+/* DPVAR.  Declare a candidate for allocation to the direct page.  Until
+ * allocated, or if not allocated, this behaves like RMB. */
+
+static void pseudo_dpvar(struct prog_line *line) {
+	if (verify_num_args(line->args, 1, 1, "DPVAR") < 0)
+		return;
+	if (node_type_of(line->label) != node_type_string) {
+		error(error_type_syntax, "DPVAR requires a symbol as label");
+		return;
+	}
+	long size = have_int_required(line->args, 0, "DPVAR", 0);
+	if (size < 0) {
+		error(error_type_out_of_range, "negative argument to DPVAR");
+		return;
+	}
+	char const *name = line->label->data.as_string;
+	dpvar_declare(name, size);
+	int addr = dpvar_address(name);
+	if (addr >= 0) {
+		set_label(line->label, node_new_int(addr), 0);
+		listing_add_line(addr, 0, NULL, line);
+		return;
+	}
+	set_label(line->label, node_new_int(cur_section->pc), 0);
+	listing_add_line(cur_section->pc & 0xffff, 0, NULL, line);
+	section_skip(size);
 }
 
 /* PUT.  Following instructions will be located at this address.  Allows
@@ -704,6 +912,57 @@ static void pseudo_setdp(struct prog_line *line) {
 		cur_section->dp = -1;
 }
 
+/* DPAREA.  Declare the range of addresses available to DPVAR allocation. */
+
+static void pseudo_dparea(struct prog_line *line) {
+	if (verify_num_args(line->args, 2, 2, "DPAREA") < 0)
+		return;
+	long addr = have_int_required(line->args, 0, "DPAREA", -1);
+	long size = have_int_required(line->args, 1, "DPAREA", 0);
+	dpvar_set_area(addr, size);
+}
+
+/* CYCLES_MAX.  Check that every path from a start address takes at most the
+ * budgeted number of cycles.  Paths end at a return instruction or at an
+ * optional end address.  Checked once assembly is complete. */
+
+static void pseudo_cycles_max(struct prog_line *line) {
+	int nargs = verify_num_args(line->args, 2, 3, "CYCLES_MAX");
+	if (nargs < 0)
+		return;
+	long start = have_int_required(line->args, 0, "CYCLES_MAX", -1);
+	long budget = have_int_required(line->args, 1, "CYCLES_MAX", -1);
+	long end = (nargs > 2) ? have_int_required(line->args, 2, "CYCLES_MAX", -1) : -1;
+	if (start < 0 || budget < 0)
+		return;
+	timing_add_check(start & 0xffff, (end < 0) ? -1 : (end & 0xffff), budget);
+}
+
+/* OPTIMIZE.  Enable (ON) or disable (OFF) peephole optimisation of
+ * instructions in the current section.  LOADS enables it including the
+ * removal of redundant loads, which is unsafe for hardware registers. */
+
+static void pseudo_optimize(struct prog_line *line) {
+	if (verify_num_args(line->args, 1, 1, "OPTIMIZE") < 0)
+		return;
+	struct node **arga = node_array_of(line->args);
+	struct node *n = eval_string(arga[0]);
+	if (n && c_strcasecmp(n->data.as_string, "on") == 0) {
+		cur_section->optimize = 1;
+		cur_section->optimize_loads = 0;
+	} else if (n && c_strcasecmp(n->data.as_string, "loads") == 0) {
+		cur_section->optimize = 1;
+		cur_section->optimize_loads = 1;
+	} else if (n && c_strcasecmp(n->data.as_string, "off") == 0) {
+		cur_section->optimize = 0;
+		cur_section->optimize_loads = 0;
+	} else {
+		error(error_type_syntax, "invalid argument to OPTIMIZE");
+	}
+	node_free(n);
+	optimize_reset();
+}
+
 /* EXPORT.  Flag a symbol or macro for exporting in the symbols file. */
 
 static void pseudo_export(struct prog_line *line) {
@@ -759,13 +1018,26 @@ static void emit_formatted(char const *ins, int argn, struct node *n,
 		section_emit_uint8((int32_t)n->data.as_float | or_last);
 		break;
 	case node_type_string:
-		for (char const *c = n->data.as_string; *c; c++) {
-			uint8_t cc = *c;
-			if (!*(c+1))
-				cc |= or_last;
-			if (to_vdg)
-				cc = ascii_to_vdg(cc, invert);
-			section_emit_uint8(cc);
+		if (!or_last && !to_vdg) {
+			section_emit_buf((uint8_t const *)n->data.as_string, atom_length(n->data.as_string));
+			break;
+		}
+		{
+			uint8_t buf[64];
+			int nbuf = 0;
+			for (char const *c = n->data.as_string; *c; c++) {
+				uint8_t cc = *c;
+				if (!*(c+1))
+					cc |= or_last;
+				if (to_vdg)
+					cc = ascii_to_vdg(cc, invert);
+				buf[nbuf++] = cc;
+				if (nbuf == (int)sizeof(buf)) {
+					section_emit_buf(buf, nbuf);
+					nbuf = 0;
+				}
+			}
+			section_emit_buf(buf, nbuf);
 		}
 		break;
 	}
@@ -878,8 +1150,7 @@ static void pseudo_rzb(struct prog_line *line) {
 	if (count < 0) {
 		error(error_type_out_of_range, "negative count for RZB");
 	}
-	for (long i = 0; i < count; i++)
-		section_emit_uint8(fill);
+	section_emit_fill(fill, count);
 }
 
 /* FILL.  Effectively an arg-swapped version of the two-arg form of RZB. */
@@ -892,8 +1163,7 @@ static void pseudo_fill(struct prog_line *line) {
 	if (count < 0) {
 		error(error_type_out_of_range, "negative count for FILL");
 	}
-	for (long i = 0; i < count; i++)
-		section_emit_uint8(fill);
+	section_emit_fill(fill, count);
 }
 
 /* RMB.  Reserve memory. */
@@ -925,8 +1195,7 @@ static void pseudo_align(struct prog_line *line) {
 	if (nargs < 2) {
 		section_skip(count);
 	} else {
-		for (long i = 0; i < count; i++)
-			section_emit_uint8(fill);
+		section_emit_fill(fill, count);
 	}
 }
 
@@ -953,26 +1222,146 @@ static void pseudo_include(struct prog_line *line) {
 
 /* INCLUDEBIN.  Include a binary object in-place.  Unlike INCLUDE, the filename
  * may be a forward reference, as binary objects cannot introduce new local
- * labels. */
+ * labels.  Optional arguments select an offset into the file and a length to
+ * include (default: the rest of the file). */
+
+static struct filemap *binary_file(const char *filename) {
+	if (!binary_files)
+		binary_files = dict_new_full(atom_dict_hash, dict_direct_equal, NULL, (Hash_data_freer)filemap_close);
+	struct filemap *map = dict_lookup(binary_files, filename);
+	if (!map) {
+		map = filemap_open(filename);
+		if (map)
+			dict_insert(binary_files, (void *)filename, map);
+	}
+	return map;
+}
 
 static void pseudo_includebin(struct prog_line *line) {
-	if (verify_num_args(line->args, 1, 1, "INCLUDE") < 0)
+	if (verify_num_args(line->args, 1, 3, "INCLUDEBIN") < 0)
 		return;
 	struct node **arga = node_array_of(line->args);
 	if (node_type_of(arga[0]) != node_type_string) {
 		error(error_type_syntax, "invalid argument to INCLUDEBIN");
 		return;
 	}
-	FILE *f = fopen(arga[0]->data.as_string, "rb");
-	if (!f) {
+	struct filemap *map = binary_file(arga[0]->data.as_string);
+	if (!map) {
 		error(error_type_fatal, "file not found: %s", arga[0]->data.as_string);
 		return;
 	}
-	int c;
-	while ((c = fgetc(f)) != EOF) {
-		section_emit_uint8(c);
+	int64_t offset = have_int_optional(line->args, 1, "INCLUDEBIN", 0);
+	if (offset < 0 || (uint64_t)offset > map->size) {
+		error(error_type_out_of_range, "offset out of range for INCLUDEBIN");
+		return;
+	}
+	int64_t length = have_int_optional(line->args, 2, "INCLUDEBIN", map->size - offset);
+	if (length < 0 || (uint64_t)length > map->size - offset) {
+		error(error_type_out_of_range, "length out of range for INCLUDEBIN");
+		return;
 	}
-	fclose(f);
+	if (length > 0)
+		section_emit_buf((uint8_t const *)map->data + offset, length);
+}
+
+/* RUN.  Execute code assembled so far in this pass on the simulator, calling
+ * a routine with an optional initial stack pointer and cycle limit.  The
+ * memory image it leaves is available to PEEK, PEEKW and INCLUDEMEM. */
+
+static void load_span(struct section_span const *span, void *data) {
+	(void)data;
+	sim_load(span->put, span->data, span->size);
+}
+
+static void pseudo_run(struct prog_line *line) {
+	int nargs = verify_num_args(line->args, 1, 3, "RUN");
+	if (nargs < 0)
+		return;
+	long addr = have_int_required(line->args, 0, "RUN", -1);
+	long stack = have_int_optional(line->args, 1, "RUN", 0);
+	long max_cycles = have_int_optional(line->args, 2, "RUN", RUN_MAX_CYCLES);
+	if (addr < 0)
+		return;
+	if (max_cycles < 0) {
+		error(error_type_out_of_range, "negative cycle limit for RUN");
+		return;
+	}
+	sim_reset();
+	section_foreach_span(asm_pass, load_span, NULL);
+	run_pass = asm_pass;
+	/* If the code assembled so far is yet to settle, neither is the result
+	 * of running it.  Fixups are only patched at the end of a pass, so in
+	 * single-pass mode RUN needs a second one. */
+	enum error_type etype = error_type_out_of_range;
+	if (depend_fixups)
+		error(error_type_inconsistent, NULL);
+	if (error_level == error_type_inconsistent)
+		etype = error_type_inconsistent;
+	switch (sim_call(addr & 0xffff, stack & 0xffff, max_cycles)) {
+	case sim_stop_limit:
+		error(etype, "RUN exceeded %ld cycles", max_cycles);
+		break;
+	case sim_stop_illegal:
+		error(etype, "illegal instruction at $%04X in RUN", sim_stop_pc());
+		break;
+	case sim_stop_wait:
+		error(etype, "wait for interrupt at $%04X in RUN", sim_stop_pc());
+		break;
+	case sim_stop_divzero:
+		error(etype, "division by zero at $%04X in RUN", sim_stop_pc());
+		break;
+	default:
+		break;
+	}
+}
+
+static _Bool have_run(char const *op) {
+	if (run_pass != (int)asm_pass) {
+		error(error_type_syntax, "%s without preceding RUN", op);
+		return 0;
+	}
+	return 1;
+}
+
+/* PEEK, PEEKW.  A symbol with the name of this line's label is assigned the
+ * byte or word left in memory at an address by the last RUN. */
+
+static void pseudo_peek(struct prog_line *line) {
+	_Bool word = (c_strcasecmp(line->opcode->data.as_string, "peekw") == 0);
+	char const *op = word ? "PEEKW" : "PEEK";
+	if (verify_num_args(line->args, 1, 1, op) < 0)
+		return;
+	long addr = have_int_required(line->args, 0, op, -1);
+	if (addr < 0 || !have_run(op)) {
+		listing_add_line(-1, 0, NULL, line);
+		return;
+	}
+	unsigned v = sim_read(addr);
+	if (word)
+		v = (v << 8) | sim_read(addr + 1);
+	set_label(line->label, node_new_int(v), 0);
+	listing_add_line(v, 0, NULL, line);
+}
+
+/* INCLUDEMEM.  Include a range of memory as left by the last RUN.  Never
+ * replayed, as the memory isn't a recorded dependency. */
+
+static void pseudo_includemem(struct prog_line *line) {
+	depend_cancel();
+	if (verify_num_args(line->args, 2, 2, "INCLUDEMEM") < 0)
+		return;
+	long addr = have_int_required(line->args, 0, "INCLUDEMEM", -1);
+	long length = have_int_required(line->args, 1, "INCLUDEMEM", 0);
+	if (addr < 0)
+		return;
+	if (length < 0 || length > 0x10000) {
+		error(error_type_out_of_range, "length out of range for INCLUDEMEM");
+		return;
+	}
+	if (!have_run("INCLUDEMEM"))
+		return;
+	for (long i = 0; i < length; i++)
+		section_emit_uint8(sim_read(addr + i));
 }
 
 /* MACRO.  Start defining a named macro.  The line's label field is used as the
@@ -1028,7 +1417,7 @@ static void pseudo_end(struct prog_line *line) {
 	if (nargs < 1)
 		return;
 	struct node **arga = node_array_of(line->args);
-	symbol_set(".exec", arga[0], asm_pass, 0);
+	symbol_set(atom_new(".exec"), arga[0], asm_pass, 0);
 }
 
 /* Ignore certain historical pseudo-ops */
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -13,7 +13,37 @@ option) any later version.
 #ifndef ASM6809_ASSEMBLE_H_
 #define ASM6809_ASSEMBLE_H_
 
+struct opcode;
 struct prog;
+struct prog_line;
+
+/*
+ * Everything recognised in the opcode field other than macros.  Only the
+ * opcode field's type is needed to dispatch a line.
+ */
+
+enum asm_op_type {
+	asm_op_none,  // no opcode, or a macro
+	asm_op_macro,
+	asm_op_endm,
+	asm_op_skip,  // ignored outright
+	asm_op_if,
+	asm_op_elsif,
+	asm_op_else,
+	asm_op_endif,
+	asm_op_names,  // pseudo-ops that take names, not values
+	asm_op_label,  // pseudo-ops that override any label meaning
+	asm_op_data,  // pseudo-ops that emit data
+	asm_op_other,  // other pseudo-ops
+	asm_op_instruction,
+};
+
+struct asm_op {
+	const char *name;
+	enum asm_op_type type;
+	void (*handler)(struct prog_line *);
+	struct opcode const *opcode;
+};
 
 /*
  * Required initialisation.
@@ -27,10 +57,23 @@ void assemble_init(void);
 
 void assemble_free_all(void);
 
+/*
+ * Look up a pseudo-op or instruction by name.  Returns NULL if the name
+ * matches neither (in which case it may be a macro).
+ */
+
+struct asm_op const *assemble_op_by_name(const char *name);
+
 /*
  * Assemble a file or macro.
  */
 
 void assemble_prog(struct prog *file, unsigned pass);
 
+/*
+ * Re-assemble one instruction or data line in the current section.
+ */
+
+void assemble_line(struct prog_line *line);
+
 #endif
@@ -0,0 +1,128 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif
+
+#include "xalloc.h"
+
+#include "atom.h"
+
+/* The string itself follows its header, so an atom pointer is enough to find
+ * the precomputed hash and length. */
+
+struct atom {
+	struct atom *next;
+	size_t hash;
+	size_t length;
+	char name[];
+};
+
+#define ATOM_OF(s) ((struct atom const *)((s) - offsetof(struct atom, name)))
+
+/* Chained hash table, doubled in size whenever it becomes fully loaded. */
+
+#define ATOM_TABLE_INITIAL_SIZE (1024)
+
+static struct atom **atom_table = NULL;
+static size_t atom_table_size = 0;
+static size_t natoms = 0;
+
+#ifdef HAVE_THREADS
+static pthread_mutex_t atom_table_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static size_t hash_string(char const *s, size_t length) {
+	size_t h = 5381;
+	for (size_t i = 0; i < length; i++)
+		h = ((h << 5) + h) + (unsigned char)s[i];
+	return h;
+}
+
+static void grow_table(void) {
+	size_t new_size = atom_table_size ? atom_table_size * 2 : ATOM_TABLE_INITIAL_SIZE;
+	struct atom **new_table = xcalloc(new_size, sizeof(*new_table));
+	for (size_t i = 0; i < atom_table_size; i++) {
+		struct atom *next;
+		for (struct atom *a = atom_table[i]; a; a = next) {
+			next = a->next;
+			size_t b = a->hash & (new_size - 1);
+			a->next = new_table[b];
+			new_table[b] = a;
+		}
+	}
+	free(atom_table);
+	atom_table = new_table;
+	atom_table_size = new_size;
+}
+
+char const *atom_new_n(char const *s, size_t length) {
+	size_t hash = hash_string(s, length);
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&atom_table_lock);
+#endif
+	if (natoms >= atom_table_size)
+		grow_table();
+	size_t b = hash & (atom_table_size - 1);
+	struct atom *a;
+	for (a = atom_table[b]; a; a = a->next) {
+		if (a->hash == hash && a->length == length && 0 == memcmp(a->name, s, length))
+			break;
+	}
+	if (!a) {
+		a = xmalloc(sizeof(*a) + length + 1);
+		a->hash = hash;
+		a->length = length;
+		memcpy(a->name, s, length);
+		a->name[length] = 0;
+		a->next = atom_table[b];
+		atom_table[b] = a;
+		natoms++;
+	}
+#ifdef HAVE_THREADS
+	pthread_mutex_unlock(&atom_table_lock);
+#endif
+	return a->name;
+}
+
+char const *atom_new(char const *s) {
+	return atom_new_n(s, strlen(s));
+}
+
+size_t atom_length(char const *atom) {
+	return ATOM_OF(atom)->length;
+}
+
+size_t atom_dict_hash(void const *atom, size_t tablesize) {
+	return ATOM_OF((char const *)atom)->hash % tablesize;
+}
+
+void atom_free_all(void) {
+	for (size_t i = 0; i < atom_table_size; i++) {
+		struct atom *next;
+		for (struct atom *a = atom_table[i]; a; a = next) {
+			next = a->next;
+			free(a);
+		}
+	}
+	free(atom_table);
+	atom_table = NULL;
+	atom_table_size = 0;
+	natoms = 0;
+}
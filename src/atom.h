@@ -0,0 +1,40 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#ifndef ASM6809_ATOM_H_
+#define ASM6809_ATOM_H_
+
+/*
+ * Atoms are interned strings.  Only one copy of each distinct string is ever
+ * held, so two atoms are equal exactly when their pointers are equal.  The
+ * hash and length of each are computed once, when it is first interned.
+ *
+ * All string data held in nodes is atomic, as are symbol, section and macro
+ * names.  Atoms are never freed individually: they persist until
+ * atom_free_all().
+ *
+ * Interning is thread safe, so source files may be parsed concurrently.
+ */
+
+#include <stddef.h>
+
+char const *atom_new(char const *s);
+char const *atom_new_n(char const *s, size_t length);
+
+size_t atom_length(char const *atom);
+
+/* Hash function for dicts keyed by atom.  Use with dict_direct_equal. */
+size_t atom_dict_hash(void const *atom, size_t tablesize);
+
+void atom_free_all(void);
+
+#endif
@@ -0,0 +1,446 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "xalloc.h"
+#include "xvasprintf.h"
+
+#include "asm6809.h"
+#include "assemble.h"
+#include "atom.h"
+#include "cache.h"
+#include "filemap.h"
+#include "node.h"
+#include "program.h"
+#include "register.h"
+#include "slist.h"
+
+#include "grammar.h"
+
+/* Bump this if the serialised form changes */
+#define CACHE_MAGIC "A6809PC1"
+#define CACHE_MAGIC_LEN (8)
+
+/* Tag written in place of a node type for undefined (NULL) nodes */
+#define TAG_NULL (0xff)
+
+/* Guard against runaway recursion reading a corrupt entry */
+#define MAX_DEPTH (256)
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+#define FNV_OFFSET_BASIS UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME UINT64_C(0x100000001b3)
+
+static uint64_t fnv1a(uint64_t h, void const *data, size_t size) {
+	unsigned char const *p = data;
+	for (size_t i = 0; i < size; i++) {
+		h ^= p[i];
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static char *cache_path(struct filemap const *map) {
+	uint64_t h = FNV_OFFSET_BASIS;
+	h = fnv1a(h, PACKAGE_VERSION, sizeof(PACKAGE_VERSION));
+	h = fnv1a(h, CACHE_MAGIC, CACHE_MAGIC_LEN);
+	unsigned char isa = asm6809_options.isa;
+	h = fnv1a(h, &isa, 1);
+	h = fnv1a(h, map->data, map->size);
+	return xasprintf("%s/%016" PRIx64 ".parse", asm6809_options.cache_dir, h);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Writing: everything is serialised into one buffer, then written to a
+ * temporary file which is renamed into place, so other processes sharing the
+ * cache never see a partial entry. */
+
+struct wbuf {
+	char *data;
+	size_t size;
+	size_t allocated;
+};
+
+static void put(struct wbuf *b, void const *data, size_t size) {
+	if (b->size + size > b->allocated) {
+		while (b->size + size > b->allocated)
+			b->allocated = b->allocated ? b->allocated * 2 : 4096;
+		b->data = xrealloc(b->data, b->allocated);
+	}
+	memcpy(b->data + b->size, data, size);
+	b->size += size;
+}
+
+static void put_u8(struct wbuf *b, unsigned v) {
+	unsigned char c = v;
+	put(b, &c, 1);
+}
+
+static void put_u32(struct wbuf *b, uint32_t v) {
+	put(b, &v, sizeof(v));
+}
+
+static void put_node(struct wbuf *b, struct node const *n) {
+	if (!n) {
+		put_u8(b, TAG_NULL);
+		return;
+	}
+	put_u8(b, n->type);
+	put_u8(b, (unsigned char)(signed char)n->attr);
+	switch (n->type) {
+	case node_type_int:
+	case node_type_backref:
+	case node_type_fwdref:
+		put(b, &n->data.as_int, sizeof(n->data.as_int));
+		break;
+	case node_type_float:
+		put(b, &n->data.as_float, sizeof(n->data.as_float));
+		break;
+	case node_type_reg:
+		put_u8(b, n->data.as_reg);
+		break;
+	case node_type_string:
+	case node_type_interp:
+		{
+			uint32_t len = atom_length(n->data.as_string);
+			put_u32(b, len);
+			put(b, n->data.as_string, len);
+		}
+		break;
+	case node_type_opcode:
+		put_node(b, n->data.as_opcode.name);
+		break;
+	case node_type_id:
+	case node_type_text:
+		{
+			uint32_t count = 0;
+			for (struct slist *l = n->data.as_list.parts; l; l = l->next)
+				count++;
+			put_u32(b, count);
+			for (struct slist *l = n->data.as_list.parts; l; l = l->next)
+				put_node(b, l->data);
+		}
+		break;
+	case node_type_oper:
+		put_u32(b, n->data.as_oper.oper);
+		put_u8(b, n->data.as_oper.nargs);
+		for (int i = 0; i < n->data.as_oper.nargs; i++)
+			put_node(b, n->data.as_oper.args[i]);
+		break;
+	case node_type_array:
+		put_u32(b, n->data.as_array.nargs);
+		for (int i = 0; i < n->data.as_array.nargs; i++)
+			put_node(b, n->data.as_array.args[i]);
+		break;
+	default:
+		break;
+	}
+}
+
+void cache_store(struct prog const *prog, struct filemap const *map) {
+	struct wbuf b = { .data = NULL, .size = 0, .allocated = 0 };
+	put(&b, CACHE_MAGIC, CACHE_MAGIC_LEN);
+	uint64_t size = map->size;
+	put(&b, &size, sizeof(size));
+	put_u32(&b, prog->nlines);
+	for (unsigned i = 0; i < prog->nlines; i++) {
+		struct prog_line const *l = prog->lines[i];
+		put_node(&b, l->label);
+		put_node(&b, l->opcode);
+		put_node(&b, l->args);
+		put_u32(&b, l->cond_skip);
+	}
+
+	char *path = cache_path(map);
+#ifdef HAVE_UNISTD_H
+	char *tmp = xasprintf("%s.%ld-%p", path, (long)getpid(), (void *)prog);
+#else
+	char *tmp = xasprintf("%s.%p", path, (void *)prog);
+#endif
+	FILE *f = fopen(tmp, "wb");
+	if (f) {
+		_Bool ok = (fwrite(b.data, 1, b.size, f) == b.size);
+		if (fclose(f) != 0)
+			ok = 0;
+		if (!ok || rename(tmp, path) != 0)
+			remove(tmp);
+	}
+	free(tmp);
+	free(path);
+	free(b.data);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Reading: any short read or invalid value marks the whole entry bad. */
+
+struct rbuf {
+	char const *data;
+	size_t left;
+	_Bool bad;
+};
+
+static _Bool get(struct rbuf *r, void *data, size_t size) {
+	if (r->bad || size > r->left) {
+		r->bad = 1;
+		memset(data, 0, size);
+		return 0;
+	}
+	memcpy(data, r->data, size);
+	r->data += size;
+	r->left -= size;
+	return 1;
+}
+
+static unsigned get_u8(struct rbuf *r) {
+	unsigned char c;
+	get(r, &c, 1);
+	return c;
+}
+
+static uint32_t get_u32(struct rbuf *r) {
+	uint32_t v;
+	get(r, &v, sizeof(v));
+	return v;
+}
+
+static char const *get_string(struct rbuf *r) {
+	uint32_t len = get_u32(r);
+	if (r->bad || len > r->left) {
+		r->bad = 1;
+		return NULL;
+	}
+	char const *s = atom_new_n(r->data, len);
+	r->data += len;
+	r->left -= len;
+	return s;
+}
+
+/* Operators as created by the parser, by number of arguments */
+
+static _Bool valid_oper(int oper, int nargs) {
+	switch (oper) {
+	case '-': case '+':
+		return nargs == 1 || nargs == 2;
+	case '~': case '!':
+		return nargs == 1;
+	case '*': case '/': case '%':
+	case SHL: case SHR:
+	case '<': case LE: case '>': case GE: case EQ: case NE:
+	case '&': case '^': case '|':
+	case LAND: case LOR:
+		return nargs == 2;
+	case '?':
+		return nargs == 3;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static struct node *get_node(struct rbuf *r, int depth);
+
+static struct slist *get_list(struct rbuf *r, int depth) {
+	uint32_t count = get_u32(r);
+	struct slist *list = NULL;
+	for (uint32_t i = 0; i < count && !r->bad; i++)
+		list = slist_prepend(list, get_node(r, depth));
+	return slist_reverse(list);
+}
+
+static struct node *get_node(struct rbuf *r, int depth) {
+	unsigned tag = get_u8(r);
+	if (r->bad || tag == TAG_NULL)
+		return NULL;
+	if (depth >= MAX_DEPTH) {
+		r->bad = 1;
+		return NULL;
+	}
+	enum node_attr attr = (signed char)get_u8(r);
+	struct node *n = NULL;
+	switch (tag) {
+	case node_type_empty:
+		n = node_new_empty();
+		break;
+	case node_type_int:
+	case node_type_backref:
+	case node_type_fwdref:
+		{
+			int64_t v;
+			get(r, &v, sizeof(v));
+			n = node_new(tag);
+			n->data.as_int = v;
+		}
+		break;
+	case node_type_float:
+		{
+			double v;
+			get(r, &v, sizeof(v));
+			n = node_new_float(v);
+		}
+		break;
+	case node_type_reg:
+		{
+			int reg = get_u8(r);
+			if (reg <= REG_INVALID || reg >= REG_MAX) {
+				r->bad = 1;
+				return NULL;
+			}
+			n = node_new_reg(reg);
+		}
+		break;
+	case node_type_string:
+	case node_type_interp:
+		{
+			char const *s = get_string(r);
+			if (!s)
+				return NULL;
+			n = node_new(tag);
+			n->data.as_string = s;
+		}
+		break;
+	case node_type_pc:
+		n = node_new_pc();
+		break;
+	case node_type_opcode:
+		{
+			struct node *name = get_node(r, depth + 1);
+			if (node_type_of(name) != node_type_string) {
+				node_free(name);
+				r->bad = 1;
+				return NULL;
+			}
+			n = node_new_opcode(name, assemble_op_by_name(name->data.as_string));
+		}
+		break;
+	case node_type_id:
+		n = node_new_id(get_list(r, depth + 1));
+		break;
+	case node_type_text:
+		n = node_new_text(get_list(r, depth + 1));
+		break;
+	case node_type_oper:
+		{
+			int oper = get_u32(r);
+			int nargs = get_u8(r);
+			struct node *a[3] = { NULL, NULL, NULL };
+			if (r->bad || !valid_oper(oper, nargs)) {
+				r->bad = 1;
+				return NULL;
+			}
+			for (int i = 0; i < nargs; i++)
+				a[i] = get_node(r, depth + 1);
+			if (nargs == 1)
+				n = node_new_oper_1(oper, a[0]);
+			else if (nargs == 2)
+				n = node_new_oper_2(oper, a[0], a[1]);
+			else
+				n = node_new_oper_3(oper, a[0], a[1], a[2]);
+		}
+		break;
+	case node_type_array:
+		{
+			uint32_t nargs = get_u32(r);
+			/* Each element takes at least one byte */
+			if (nargs > r->left) {
+				r->bad = 1;
+				return NULL;
+			}
+			if (nargs == 0) {
+				n = node_new_array();
+				break;
+			}
+			n = node_new_array_n(nargs);
+			for (uint32_t i = 0; i < nargs; i++)
+				n->data.as_array.args[i] = get_node(r, depth + 1);
+		}
+		break;
+	default:
+		r->bad = 1;
+		return NULL;
+	}
+	n->attr = attr;
+	return n;
+}
+
+/* Line text is sliced from the source exactly as the scanner does it. */
+
+static void set_text(struct prog *prog, struct filemap const *map) {
+	size_t offset = 0;
+	for (unsigned i = 0; i < prog->nlines && offset <= map->size; i++) {
+		char const *p = map->data + offset;
+		size_t avail = map->size - offset;
+		char const *eol = memchr(p, '\n', avail);
+		size_t len = eol ? (size_t)(eol - p) : avail;
+		offset += len + 1;
+		if (eol && len > 0 && p[len-1] == '\r')
+			len--;
+		prog_line_set_text(prog->lines[i], p, len);
+	}
+}
+
+struct prog *cache_load(const char *filename, struct filemap const *map) {
+	char *path = cache_path(map);
+	struct filemap *entry = filemap_open(path);
+	free(path);
+	if (!entry)
+		return NULL;
+
+	struct rbuf r = { .data = entry->data, .left = entry->size, .bad = 0 };
+	char magic[CACHE_MAGIC_LEN];
+	uint64_t size;
+	get(&r, magic, CACHE_MAGIC_LEN);
+	get(&r, &size, sizeof(size));
+	uint32_t nlines = get_u32(&r);
+	/* Each line takes at least seven bytes */
+	if (r.bad || memcmp(magic, CACHE_MAGIC, CACHE_MAGIC_LEN) != 0
+	    || size != map->size || nlines > r.left / 7) {
+		filemap_close(entry);
+		return NULL;
+	}
+
+	struct prog *prog = prog_new(prog_type_file, filename);
+	if (nlines > 0) {
+		prog->lines = xmalloc(nlines * sizeof(*prog->lines));
+		prog->lines_allocated = nlines;
+	}
+	for (uint32_t i = 0; i < nlines && !r.bad; i++) {
+		struct node *label = get_node(&r, 0);
+		struct node *opcode = get_node(&r, 0);
+		struct node *args = get_node(&r, 0);
+		struct prog_line *l = prog_line_new(label, opcode, args);
+		l->cond_skip = get_u32(&r);
+		prog->lines[prog->nlines++] = l;
+	}
+	if (r.bad || r.left != 0) {
+		filemap_close(entry);
+		prog_free(prog);
+		return NULL;
+	}
+	filemap_close(entry);
+	if (asm6809_options.listing_required)
+		set_text(prog, map);
+	return prog;
+}
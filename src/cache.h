@@ -0,0 +1,37 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#ifndef ASM6809_CACHE_H_
+#define ASM6809_CACHE_H_
+
+/*
+ * Optional on-disk cache of parsed source files.
+ *
+ * Files in the cache directory are named for a hash (64-bit FNV-1a) of the
+ * source contents, the program version and the selected ISA.  Each holds a
+ * serialised form of the parsed lines: the label, opcode and argument syntax
+ * trees and the conditional skip distance for each line.  Line text is not
+ * stored - it is sliced from the source again when needed for the listing.
+ *
+ * The cache is best effort: any problem reading an entry is treated as a
+ * miss, and failure to write one is silently ignored.
+ */
+
+struct filemap;
+struct prog;
+
+/* Returns NULL if no valid entry exists for the file's contents. */
+struct prog *cache_load(const char *filename, struct filemap const *map);
+
+void cache_store(struct prog const *prog, struct filemap const *map);
+
+#endif
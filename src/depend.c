@@ -0,0 +1,544 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slist.h"
+#include "xalloc.h"
+
+#include "assemble.h"
+#include "depend.h"
+#include "error.h"
+#include "interp.h"
+#include "node.h"
+#include "program.h"
+#include "section.h"
+#include "symbol.h"
+
+enum depend_type {
+	depend_type_symbol,
+	depend_type_backref,
+	depend_type_fwdref,
+	depend_type_interp,
+};
+
+/* One value read while assembling a line.  The key is a symbol name (an
+ * atom), a local label number or a positional variable index, depending on
+ * type. */
+
+struct depend {
+	enum depend_type type;
+	char const *name;
+	intptr_t num;
+	struct node *value;
+};
+
+/* A warning raised by a line, to be raised again when it is replayed. */
+
+struct depend_warning {
+	enum error_type type;
+	char *message;
+};
+
+/* Everything needed to decide whether a line can be replayed, and the output
+ * to replay if so.  Emitted bytes are followed by 'skip' bytes of reserved
+ * space (e.g., RMB). */
+
+struct depend_record {
+	struct prog_line *line;
+	int pc;
+	unsigned put;
+	unsigned dp;
+	int ndeps;
+	struct depend *deps;
+	unsigned nbytes;
+	uint8_t *data;
+	int skip;
+	_Bool is_data;
+	int nwarnings;
+	struct depend_warning *warnings;
+};
+
+struct depend_cache {
+	unsigned nrecords;
+	struct depend_record **records;
+};
+
+/* A record kept while one of its dependencies is undefined, along with the
+ * context needed to assemble the line again later, and where in the section
+ * its (placeholder) output was written. */
+
+struct depend_fixup {
+	struct depend_record *rec;
+	struct section *section;
+	unsigned line_number;
+	struct section_span *span;
+	unsigned offset;
+	struct prog *prog;
+	unsigned prog_line_number;
+	_Bool have_interp;
+	struct node *interp;
+};
+
+_Bool depend_fixups = 0;
+static struct slist *fixups = NULL;
+static struct slist **fixups_next = &fixups;
+
+/* State while recording a line */
+
+static _Bool recording = 0;
+static struct section *rec_section;
+static int rec_pc;
+static unsigned rec_put;
+static unsigned rec_dp;
+static struct section_span *rec_span;
+static unsigned rec_span_size;
+static struct error_mark rec_mark;
+static _Bool rec_inconsistent;
+static _Bool rec_failed;
+
+static int ndeps = 0;
+static int deps_allocated = 0;
+static struct depend *deps = NULL;
+
+static int nwarnings = 0;
+static int warnings_allocated = 0;
+static struct depend_warning *warnings = NULL;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void depend_free_list(struct depend *list, int n) {
+	for (int i = 0; i < n; i++) {
+		node_free(list[i].value);
+	}
+}
+
+static void depend_free_warnings(struct depend_warning *list, int n) {
+	for (int i = 0; i < n; i++)
+		free(list[i].message);
+}
+
+/* Discard everything noted while recording. */
+
+static void depend_discard(void) {
+	depend_free_list(deps, ndeps);
+	ndeps = 0;
+	depend_free_warnings(warnings, nwarnings);
+	nwarnings = 0;
+}
+
+static void depend_record_free(struct depend_record *rec) {
+	if (!rec)
+		return;
+	depend_free_list(rec->deps, rec->ndeps);
+	free(rec->deps);
+	depend_free_warnings(rec->warnings, rec->nwarnings);
+	free(rec->warnings);
+	free(rec->data);
+	free(rec);
+}
+
+void depend_cache_free(struct depend_cache *cache) {
+	if (!cache)
+		return;
+	for (unsigned i = 0; i < cache->nrecords; i++)
+		depend_record_free(cache->records[i]);
+	free(cache->records);
+	free(cache);
+}
+
+/* Slot for the current line in the current section, allocating as needed. */
+
+static struct depend_record **record_slot(void) {
+	struct depend_cache *cache = cur_section->depend;
+	unsigned line_number = cur_section->line_number;
+	if (!cache) {
+		cache = xmalloc(sizeof(*cache));
+		cache->nrecords = 0;
+		cache->records = NULL;
+		cur_section->depend = cache;
+	}
+	if (line_number >= cache->nrecords) {
+		unsigned nrecords = cache->nrecords ? cache->nrecords : 256;
+		while (nrecords <= line_number)
+			nrecords *= 2;
+		cache->records = xrealloc(cache->records, nrecords * sizeof(*cache->records));
+		memset(cache->records + cache->nrecords, 0,
+		       (nrecords - cache->nrecords) * sizeof(*cache->records));
+		cache->nrecords = nrecords;
+	}
+	return &cache->records[line_number];
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void depend_begin(void) {
+	assert(cur_section != NULL);
+	assert(!recording);
+	recording = 1;
+	rec_section = cur_section;
+	rec_pc = cur_section->pc;
+	rec_put = cur_section->put;
+	rec_dp = cur_section->dp;
+	rec_span = cur_section->span;
+	rec_span_size = rec_span ? rec_span->size : 0;
+	error_mark(&rec_mark);
+	rec_inconsistent = 0;
+	rec_failed = 0;
+	ndeps = 0;
+	nwarnings = 0;
+}
+
+void depend_cancel(void) {
+	if (!recording)
+		return;
+	recording = 0;
+	depend_discard();
+}
+
+/* The opcode is evaluated before recording starts, so a line whose opcode is
+ * pasted together from positional variables (i.e., not resolved when parsed)
+ * is never recorded. */
+
+static _Bool static_opcode(struct node const *n) {
+	return node_type_of(n) == node_type_opcode;
+}
+
+/* Move noted dependencies and warnings into a record. */
+
+static void take_notes(struct depend_record *rec) {
+	depend_free_list(rec->deps, rec->ndeps);
+	free(rec->deps);
+	rec->ndeps = ndeps;
+	rec->deps = NULL;
+	if (ndeps > 0) {
+		rec->deps = xmalloc(ndeps * sizeof(*rec->deps));
+		memcpy(rec->deps, deps, ndeps * sizeof(*rec->deps));
+	}
+	depend_free_warnings(rec->warnings, rec->nwarnings);
+	free(rec->warnings);
+	rec->nwarnings = nwarnings;
+	rec->warnings = NULL;
+	if (nwarnings > 0) {
+		rec->warnings = xmalloc(nwarnings * sizeof(*rec->warnings));
+		memcpy(rec->warnings, warnings, nwarnings * sizeof(*rec->warnings));
+	}
+	ndeps = 0;
+	nwarnings = 0;
+}
+
+static _Bool noted_undefined(void) {
+	for (int i = 0; i < ndeps; i++) {
+		if (!deps[i].value)
+			return 1;
+	}
+	return 0;
+}
+
+void depend_end(struct prog_line *line, _Bool is_data) {
+	if (!recording)
+		return;
+	recording = 0;
+
+	struct section *sect = cur_section;
+	struct section_span *span = sect->span;
+	uint8_t const *data = NULL;
+	unsigned nbytes = 0;
+	unsigned offset = 0;
+	int advance = sect->pc - rec_pc;
+	_Bool ok = (sect == rec_section && !rec_failed &&
+		    static_opcode(line->opcode));
+
+	/* Inconsistencies are acceptable only in lines that will be patched
+	 * once undefined values are known. */
+	_Bool fixup = rec_inconsistent;
+	if (fixup && !(depend_fixups && noted_undefined()))
+		ok = 0;
+
+	/* Output is either appended to the span current at the start of the
+	 * line, or forms the entirety of a new one. */
+	if (ok && span && span == rec_span) {
+		nbytes = span->size - rec_span_size;
+		offset = rec_span_size;
+		data = span->data + rec_span_size;
+	} else if (ok && span) {
+		if (rec_span && rec_span->size != rec_span_size)
+			ok = 0;
+		nbytes = span->size;
+		data = span->data;
+	}
+	if ((int)(sect->put - rec_put) != advance || advance < (int)nbytes)
+		ok = 0;
+
+	if (sect != rec_section) {
+		depend_discard();
+		return;
+	}
+
+	struct depend_record **slot = record_slot();
+	depend_record_free(*slot);
+	*slot = NULL;
+	if (!ok) {
+		depend_discard();
+		return;
+	}
+
+	struct depend_record *rec = xmalloc(sizeof(*rec));
+	rec->line = line;
+	rec->pc = rec_pc;
+	rec->put = rec_put;
+	rec->dp = rec_dp;
+	rec->ndeps = 0;
+	rec->deps = NULL;
+	rec->nwarnings = 0;
+	rec->warnings = NULL;
+	rec->nbytes = nbytes;
+	rec->data = NULL;
+	if (nbytes > 0) {
+		rec->data = xmalloc(nbytes);
+		memcpy(rec->data, data, nbytes);
+	}
+	rec->skip = advance - nbytes;
+	rec->is_data = is_data;
+	*slot = rec;
+
+	if (!fixup) {
+		take_notes(rec);
+		return;
+	}
+
+	/* The errors raised are retracted: output will be patched, or the
+	 * problem raised again, when the fixup is resolved.  Any warnings
+	 * concerned the placeholder output, so are dropped too. */
+	error_discard(&rec_mark, error_type_inconsistent);
+	depend_free_warnings(warnings, nwarnings);
+	nwarnings = 0;
+	take_notes(rec);
+
+	struct depend_fixup *fix = xmalloc(sizeof(*fix));
+	struct prog_ctx *ctx = prog_ctx_stack->data;
+	fix->rec = rec;
+	fix->section = sect;
+	fix->line_number = sect->line_number;
+	fix->span = nbytes > 0 ? span : NULL;
+	fix->offset = offset;
+	fix->prog = ctx->prog;
+	fix->prog_line_number = ctx->line_number;
+	fix->interp = NULL;
+	fix->have_interp = interp_peek(&fix->interp);
+	*fixups_next = slist_append(*fixups_next, fix);
+	fixups_next = &((*fixups_next)->next);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void note(enum depend_type type, const char *name, intptr_t num, struct node const *value) {
+	if (ndeps >= deps_allocated) {
+		deps_allocated = deps_allocated ? deps_allocated * 2 : 16;
+		deps = xrealloc(deps, deps_allocated * sizeof(*deps));
+	}
+	struct depend *d = &deps[ndeps++];
+	d->type = type;
+	d->name = name;
+	d->num = num;
+	d->value = node_ref((struct node *)value);
+}
+
+void depend_note_symbol(const char *key, struct node const *value) {
+	if (recording)
+		note(depend_type_symbol, key, 0, value);
+}
+
+void depend_note_local(intptr_t key, _Bool fwd, struct node const *value) {
+	if (recording)
+		note(fwd ? depend_type_fwdref : depend_type_backref, NULL, key, value);
+}
+
+void depend_note_interp(int index, struct node const *value) {
+	if (recording)
+		note(depend_type_interp, NULL, index, value);
+}
+
+void depend_note_error(enum error_type type, const char *message) {
+	if (!recording)
+		return;
+	if (type == error_type_inconsistent && message) {
+		rec_inconsistent = 1;
+		return;
+	}
+	if (type > error_type_inconsistent || !message) {
+		rec_failed = 1;
+		return;
+	}
+	if (nwarnings >= warnings_allocated) {
+		warnings_allocated = warnings_allocated ? warnings_allocated * 2 : 4;
+		warnings = xrealloc(warnings, warnings_allocated * sizeof(*warnings));
+	}
+	warnings[nwarnings].type = type;
+	warnings[nwarnings].message = xstrdup(message);
+	nwarnings++;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Like node_equal(), but attributes must match too, and undefined or empty
+ * values are equal to each other. */
+
+static _Bool value_equal(struct node const *n1, struct node const *n2) {
+	if (node_type_of(n1) != node_type_of(n2))
+		return 0;
+	if (node_attr_of(n1) != node_attr_of(n2))
+		return 0;
+	switch (node_type_of(n1)) {
+	case node_type_undef:
+	case node_type_empty:
+		return 1;
+	default:
+		break;
+	}
+	return node_equal(n1, n2);
+}
+
+static _Bool depend_valid(struct depend const *d) {
+	struct node *n = NULL;
+	switch (d->type) {
+	case depend_type_symbol:
+		n = symbol_try_get(d->name);
+		break;
+	case depend_type_backref:
+		n = symbol_local_try_backref(cur_section->local_labels, d->num, cur_section->line_number);
+		break;
+	case depend_type_fwdref:
+		n = symbol_local_try_fwdref(cur_section->local_labels, d->num, cur_section->line_number);
+		break;
+	case depend_type_interp:
+		n = interp_try_get(d->num);
+		break;
+	}
+	_Bool valid = value_equal(n, d->value);
+	node_free(n);
+	return valid;
+}
+
+struct depend_record *depend_lookup(struct prog_line *line) {
+	struct depend_cache *cache = cur_section->depend;
+	unsigned line_number = cur_section->line_number;
+	if (!cache || line_number >= cache->nrecords)
+		return NULL;
+	struct depend_record *rec = cache->records[line_number];
+	if (!rec || rec->line != line)
+		return NULL;
+	if (rec->pc != cur_section->pc || rec->put != cur_section->put ||
+	    rec->dp != cur_section->dp)
+		return NULL;
+	for (int i = 0; i < rec->ndeps; i++) {
+		if (!depend_valid(&rec->deps[i]))
+			return NULL;
+	}
+	return rec;
+}
+
+_Bool depend_replay(struct depend_record *rec) {
+	for (int i = 0; i < rec->nwarnings; i++)
+		error(rec->warnings[i].type, "%s", rec->warnings[i].message);
+	if (rec->nbytes > 0)
+		section_emit_buf(rec->data, rec->nbytes);
+	if (rec->skip > 0)
+		section_skip(rec->skip);
+	return rec->is_data;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Assemble a fixup's line again with the section state restored to that at
+ * the start of the line, but output diverted to a fresh list of spans.  If the
+ * result is the same size, it replaces the placeholder output. */
+
+static void resolve_fixup(struct depend_fixup *fix) {
+	struct depend_record *rec = fix->rec;
+	struct section *sect = fix->section;
+
+	struct slist *spans = sect->spans;
+	struct section_span *span = sect->span;
+	int pc = sect->pc;
+	unsigned put = sect->put;
+	unsigned dp = sect->dp;
+	unsigned line_number = sect->line_number;
+
+	cur_section = sect;
+	sect->spans = NULL;
+	sect->span = NULL;
+	sect->pc = rec->pc;
+	sect->put = rec->put;
+	sect->dp = rec->dp;
+	sect->line_number = fix->line_number;
+	struct prog_ctx *ctx = prog_ctx_new(fix->prog);
+	ctx->line_number = fix->prog_line_number;
+	if (fix->have_interp)
+		interp_push(fix->interp);
+
+	depend_begin();
+	assemble_line(rec->line);
+	recording = 0;
+
+	struct section_span *nspan = sect->span;
+	unsigned nbytes = nspan ? nspan->size : 0;
+	_Bool ok = !rec_failed && !rec_inconsistent &&
+		   slist_length(sect->spans) <= 1 && nbytes == rec->nbytes &&
+		   sect->pc - rec->pc == (int)nbytes + rec->skip &&
+		   sect->put - rec->put == nbytes + rec->skip;
+
+	if (ok) {
+		if (nbytes > 0) {
+			memcpy(fix->span->data + fix->offset, nspan->data, nbytes);
+			memcpy(rec->data, nspan->data, nbytes);
+		}
+		take_notes(rec);
+	} else {
+		depend_discard();
+		struct depend_record **slot = record_slot();
+		depend_record_free(*slot);
+		*slot = NULL;
+		/* A change in size needs another pass. */
+		if (!rec_failed && !rec_inconsistent)
+			error(error_type_inconsistent, "size changed once forward references were known");
+	}
+
+	if (fix->have_interp)
+		interp_pop();
+	prog_ctx_free(ctx);
+	slist_free_full(sect->spans, (slist_free_func)section_span_free);
+	sect->spans = spans;
+	sect->span = span;
+	sect->pc = pc;
+	sect->put = put;
+	sect->dp = dp;
+	sect->line_number = line_number;
+}
+
+void depend_resolve_fixups(void) {
+	struct section *old_section = cur_section;
+	while (fixups) {
+		struct depend_fixup *fix = fixups->data;
+		fixups = slist_remove(fixups, fix);
+		resolve_fixup(fix);
+		node_free(fix->interp);
+		free(fix);
+	}
+	fixups_next = &fixups;
+	cur_section = old_section;
+}
@@ -0,0 +1,86 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#ifndef ASM6809_DEPEND_H_
+#define ASM6809_DEPEND_H_
+
+/*
+ * Track what each assembled line depends on, so that lines unaffected by
+ * changes made in the previous pass can be replayed instead of re-evaluated.
+ *
+ * Only instructions and data pseudo-ops are tracked.  Between depend_begin()
+ * and depend_end(), every symbol, local label and positional variable read is
+ * noted along with the value found.  If the line raised nothing worse than a
+ * warning, its output bytes (and any warnings) are recorded with those
+ * dependencies in the current section, keyed by the section's dummy line
+ * number (which is consistent across passes - see section.h).
+ *
+ * In the next pass, depend_lookup() finds the record for a line.  If the same
+ * line is being assembled at the same PC, put address and DP, and every
+ * dependency still evaluates to the same value, depend_replay() re-emits the
+ * recorded output and re-raises the recorded warnings.
+ *
+ * If depend_fixups is set, a line whose only problem was reading an undefined
+ * symbol or label is kept too, as a fixup: its errors are retracted and its
+ * placeholder output left in place.  Once the whole program has been seen,
+ * depend_resolve_fixups() assembles each such line again in its original
+ * context, patching the output in place if its size is unchanged.  Otherwise
+ * an inconsistency is raised, and another pass is needed.
+ */
+
+#include <stdint.h>
+
+#include "error.h"
+
+/* Keep lines that read undefined values as fixups (single-pass mode). */
+extern _Bool depend_fixups;
+
+struct depend_cache;
+struct depend_record;
+struct node;
+struct prog_line;
+
+/* Start recording dependencies of the current line. */
+void depend_begin(void);
+
+/* Stop recording and store the result against the current line.  Data
+ * pseudo-ops are listed slightly differently to instructions, so is_data is
+ * recorded for replay. */
+void depend_end(struct prog_line *line, _Bool is_data);
+
+/* Stop recording, discarding anything noted (line not suitable for replay). */
+void depend_cancel(void);
+
+/* Note values read while recording.  A NULL value notes an undefined symbol or
+ * label. */
+void depend_note_symbol(const char *key, struct node const *value);
+void depend_note_local(intptr_t key, _Bool fwd, struct node const *value);
+void depend_note_interp(int index, struct node const *value);
+
+/* Note errors raised while recording.  Warnings are replayed, anything more
+ * serious prevents the line being recorded. */
+void depend_note_error(enum error_type type, const char *message);
+
+/* Find a record for the current line that is still valid, or NULL. */
+struct depend_record *depend_lookup(struct prog_line *line);
+
+/* Emit the output recorded for a line.  Returns the is_data flag passed to
+ * depend_end(). */
+_Bool depend_replay(struct depend_record *rec);
+
+/* Patch the output of all fixups kept during this pass. */
+void depend_resolve_fixups(void);
+
+/* Free all records in a section's cache. */
+void depend_cache_free(struct depend_cache *cache);
+
+#endif
@@ -0,0 +1,263 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xalloc.h"
+
+#include "dpadvice.h"
+#include "opcode.h"
+#include "section.h"
+
+struct dpadvice_access {
+	struct section const *section;
+	int pc;
+	uint8_t page;
+	_Bool direct;
+	int cycles;  // saved by direct over extended
+};
+
+struct dpadvice_label {
+	struct section const *section;
+	char const *name;
+	int pc;
+	unsigned order;
+};
+
+static struct dpadvice_access *accesses = NULL;
+static unsigned naccesses = 0;
+static unsigned accesses_allocated = 0;
+
+static struct dpadvice_label *labels = NULL;
+static unsigned nlabels = 0;
+static unsigned labels_allocated = 0;
+
+/* How many pages to show in the summary for each section. */
+#define MAX_PAGES_SHOWN (8)
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void dpadvice_free_all(void) {
+	free(accesses);
+	accesses = NULL;
+	naccesses = accesses_allocated = 0;
+	free(labels);
+	labels = NULL;
+	nlabels = labels_allocated = 0;
+}
+
+void dpadvice_label(char const *name) {
+	if (nlabels >= labels_allocated) {
+		labels_allocated = labels_allocated ? labels_allocated * 2 : 256;
+		labels = xrealloc(labels, labels_allocated * sizeof(*labels));
+	}
+	struct dpadvice_label *l = &labels[nlabels];
+	l->section = cur_section;
+	l->name = name;
+	l->pc = cur_section->pc & 0xffff;
+	l->order = nlabels++;
+}
+
+static int op_cycles(unsigned code) {
+	uint8_t buf[2];
+	unsigned n = 0;
+	int extra;
+	if (code > 0xff)
+		buf[n++] = code >> 8;
+	buf[n++] = code & 0xff;
+	return opcode_cycles(buf, n, &extra);
+}
+
+void dpadvice_access(struct opcode const *op, unsigned addr, _Bool direct) {
+	if (naccesses >= accesses_allocated) {
+		accesses_allocated = accesses_allocated ? accesses_allocated * 2 : 256;
+		accesses = xrealloc(accesses, accesses_allocated * sizeof(*accesses));
+	}
+	struct dpadvice_access *a = &accesses[naccesses++];
+	a->section = cur_section;
+	a->pc = cur_section->pc & 0xffff;
+	a->page = (addr >> 8) & 0xff;
+	a->direct = direct;
+	int dcycles = op_cycles(op->direct);
+	int ecycles = op_cycles(op->extended);
+	a->cycles = (dcycles >= 0 && ecycles > dcycles) ? ecycles - dcycles : 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Effect of assuming one page for a section, relative to the code as
+ * assembled. */
+
+struct dpadvice_effect {
+	unsigned ndirect;
+	int bytes;
+	int cycles;
+};
+
+/* Direct accesses to other pages become extended, and extended accesses to
+ * this one become direct. */
+
+static void add_effect(struct dpadvice_effect *e, struct dpadvice_access const *a, unsigned page) {
+	if (a->page == page) {
+		e->ndirect++;
+		if (!a->direct) {
+			e->bytes++;
+			e->cycles += a->cycles;
+		}
+	} else if (a->direct) {
+		e->bytes--;
+		e->cycles -= a->cycles;
+	}
+}
+
+static int effect_cmp(struct dpadvice_effect const *a, struct dpadvice_effect const *b) {
+	if (a->bytes != b->bytes)
+		return (a->bytes > b->bytes) ? -1 : 1;
+	if (a->cycles != b->cycles)
+		return (a->cycles > b->cycles) ? -1 : 1;
+	return 0;
+}
+
+static struct dpadvice_effect page_effects[256];
+
+static int page_cmp(void const *va, void const *vb) {
+	unsigned pa = *(uint8_t const *)va;
+	unsigned pb = *(uint8_t const *)vb;
+	int c = effect_cmp(&page_effects[pa], &page_effects[pb]);
+	if (c)
+		return c;
+	return (pa > pb) - (pa < pb);
+}
+
+static int label_cmp(void const *va, void const *vb) {
+	struct dpadvice_label const *a = va;
+	struct dpadvice_label const *b = vb;
+	if (a->pc != b->pc)
+		return (a->pc > b->pc) ? 1 : -1;
+	return (a->order > b->order) - (a->order < b->order);
+}
+
+/* Index of the last label at or before pc, or nl if none. */
+
+static unsigned find_routine(struct dpadvice_label const *sl, unsigned nl, int pc) {
+	unsigned lo = 0, hi = nl;
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (sl[mid].pc <= pc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? lo - 1 : nl;
+}
+
+static void print_routines(FILE *f, struct section const *sect, unsigned page) {
+	struct dpadvice_label *sl = xmalloc((nlabels + 1) * sizeof(*sl));
+	unsigned nl = 0;
+	for (unsigned i = 0; i < nlabels; i++) {
+		if (labels[i].section == sect)
+			sl[nl++] = labels[i];
+	}
+	qsort(sl, nl, sizeof(*sl), label_cmp);
+
+	struct dpadvice_effect *re = xmalloc((nl + 1) * sizeof(*re));
+	memset(re, 0, (nl + 1) * sizeof(*re));
+	for (unsigned i = 0; i < naccesses; i++) {
+		struct dpadvice_access const *a = &accesses[i];
+		if (a->section == sect)
+			add_effect(&re[find_routine(sl, nl, a->pc)], a, page);
+	}
+
+	fprintf(f, "%-24s %6s %6s %6s\n", "Routine", "Direct", "Bytes", "Cycles");
+	for (unsigned i = 0; i <= nl; i++) {
+		if (re[i].bytes == 0 && re[i].cycles == 0)
+			continue;
+		fprintf(f, "%-24s %6u %+6d %+6d\n", (i < nl) ? sl[i].name : "(no label)",
+			re[i].ndirect, re[i].bytes, re[i].cycles);
+	}
+	free(re);
+	free(sl);
+}
+
+static void print_section(FILE *f, struct section const *sect) {
+	unsigned total = 0, ndirect = 0;
+	_Bool seen[256];
+	memset(seen, 0, sizeof(seen));
+	memset(page_effects, 0, sizeof(page_effects));
+	for (unsigned i = 0; i < naccesses; i++) {
+		struct dpadvice_access const *a = &accesses[i];
+		if (a->section != sect)
+			continue;
+		total++;
+		if (a->direct)
+			ndirect++;
+		seen[a->page] = 1;
+	}
+	uint8_t pages[256];
+	unsigned npages = 0;
+	for (unsigned p = 0; p < 256; p++) {
+		if (!seen[p])
+			continue;
+		pages[npages++] = p;
+		for (unsigned i = 0; i < naccesses; i++) {
+			if (accesses[i].section == sect)
+				add_effect(&page_effects[p], &accesses[i], p);
+		}
+	}
+	qsort(pages, npages, sizeof(*pages), page_cmp);
+
+	fprintf(f, "Section \"%s\"\n\nAccesses that could be direct: %u, of which direct: %u\n\n",
+		sect->name, total, ndirect);
+	fprintf(f, "%-6s %6s %6s %6s\n", "Page", "Direct", "Bytes", "Cycles");
+	for (unsigned i = 0; i < npages && i < MAX_PAGES_SHOWN; i++) {
+		struct dpadvice_effect const *e = &page_effects[pages[i]];
+		fprintf(f, "$%02X    %6u %+6d %+6d\n", pages[i], e->ndirect, e->bytes, e->cycles);
+	}
+	fprintf(f, "\n");
+
+	struct dpadvice_effect const *best = &page_effects[pages[0]];
+	if (best->bytes <= 0 && best->cycles <= 0) {
+		fprintf(f, "No single SETDP would improve on the code as assembled.\n\n");
+		return;
+	}
+	fprintf(f, "Best: SETDP $%02X, saving %d bytes, and %d cycles if each access is\n"
+		"executed once.\n\n", pages[0], best->bytes, best->cycles);
+	print_routines(f, sect, pages[0]);
+	fprintf(f, "\n");
+}
+
+void dpadvice_print_report(FILE *f) {
+	if (naccesses == 0) {
+		fprintf(f, "No accesses could be direct.\n");
+		return;
+	}
+	/* Sections in the order they were first seen */
+	struct section const **sects = xmalloc(naccesses * sizeof(*sects));
+	unsigned nsects = 0;
+	for (unsigned i = 0; i < naccesses; i++) {
+		unsigned j;
+		for (j = 0; j < nsects; j++) {
+			if (sects[j] == accesses[i].section)
+				break;
+		}
+		if (j == nsects)
+			sects[nsects++] = accesses[i].section;
+	}
+	for (unsigned i = 0; i < nsects; i++)
+		print_section(f, sects[i]);
+	free(sects);
+}
@@ -0,0 +1,48 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#ifndef ASM6809_DPADVICE_H_
+#define ASM6809_DPADVICE_H_
+
+#include <stdio.h>
+
+/*
+ * Advice on the choice of SETDP.
+ *
+ * When enabled (asm6809_options.dp_advice), every instruction memory operand
+ * that could use either direct or extended addressing is noted with
+ * dpadvice_access() during each pass, along with the address of each label
+ * that takes the value of PC.
+ *
+ * Once the last pass is complete, dpadvice_print_report() works out for each
+ * section which page, if assumed for the whole section, would make the most
+ * accesses direct, and the bytes and cycles that would save compared with the
+ * code as assembled.  Savings are broken down by routine, each routine running
+ * from one label to the next.
+ */
+
+struct opcode;
+
+/* Free everything noted in the previous pass. */
+void dpadvice_free_all(void);
+
+/* Note a label (an atom) taking the value of PC in the current section. */
+void dpadvice_label(char const *name);
+
+/* Note an instruction at PC in the current section with an operand of addr
+ * that was free to be direct or extended, and which was assembled as
+ * direct. */
+void dpadvice_access(struct opcode const *op, unsigned addr, _Bool direct);
+
+void dpadvice_print_report(FILE *f);
+
+#endif
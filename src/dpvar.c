@@ -0,0 +1,198 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "xalloc.h"
+
+#include "atom.h"
+#include "dict.h"
+#include "dpvar.h"
+#include "error.h"
+#include "node.h"
+#include "opcode.h"
+#include "slist.h"
+
+struct dpvar {
+	char const *name;
+	unsigned size;
+	unsigned order;
+	int addr;
+};
+
+_Bool dpvar_counting = 0;
+
+static struct dict *dpvars = NULL;  // by name
+static struct slist *dpvar_list = NULL;  // in reverse order of declaration
+static unsigned ndpvars = 0;
+static struct dict *ref_counts = NULL;  // symbol name -> count
+static int area_addr = -1;
+static int area_size = 0;
+static _Bool allocated = 0;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Only a single plain address argument can become direct.  Indexed, indirect
+ * and immediate forms don't benefit. */
+
+_Bool dpvar_countable(struct opcode const *op, struct node const *raw_args) {
+	if (allocated || !(op->type & OPCODE_DIRECT))
+		return 0;
+	if ((op->type & OPCODE_EXT_TYPE) == OPCODE_IMM8_MEM)
+		return 0;
+	if (node_array_count(raw_args) != 1)
+		return 0;
+	struct node const *arg = node_array_of(raw_args)[0];
+	if (node_attr_of(arg) == node_attr_immediate || node_attr_of(arg) == node_attr_16bit)
+		return 0;
+	return node_type_of(arg) != node_type_array;
+}
+
+void dpvar_note_ref(char const *key) {
+	if (!dpvar_counting)
+		return;
+	if (!ref_counts)
+		ref_counts = dict_new(atom_dict_hash, dict_direct_equal);
+	uintptr_t count = (uintptr_t)dict_lookup(ref_counts, key);
+	dict_insert(ref_counts, (void *)key, (void *)(count + 1));
+}
+
+static unsigned ref_count(char const *key) {
+	if (!ref_counts)
+		return 0;
+	return (uintptr_t)dict_lookup(ref_counts, key);
+}
+
+void dpvar_set_area(int addr, int size) {
+	if (size < 1 || size > 256 || addr < 0 || (addr >> 8) != ((addr + size - 1) >> 8)) {
+		error(error_type_out_of_range, "DPAREA must lie within one page");
+		return;
+	}
+	area_addr = addr;
+	area_size = size;
+}
+
+void dpvar_declare(char const *name, int size) {
+	if (!dpvars)
+		dpvars = dict_new_full(atom_dict_hash, dict_direct_equal, NULL, free);
+	if (dict_lookup(dpvars, name))
+		return;
+	struct dpvar *v = xmalloc(sizeof(*v));
+	v->name = name;
+	v->size = size;
+	v->order = ndpvars++;
+	v->addr = -1;
+	dict_insert(dpvars, (void *)name, v);
+	dpvar_list = slist_prepend(dpvar_list, v);
+}
+
+int dpvar_address(char const *name) {
+	if (!dpvars)
+		return -1;
+	struct dpvar *v = dict_lookup(dpvars, name);
+	return v ? v->addr : -1;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Each direct reference saves one byte and (almost always) one cycle over
+ * extended, so candidates are ranked by references per byte of the area they
+ * would use, earliest declared first where equal. */
+
+static int dpvar_cmp(void const *va, void const *vb) {
+	struct dpvar const *a = *(struct dpvar * const *)va;
+	struct dpvar const *b = *(struct dpvar * const *)vb;
+	uint64_t ra = (uint64_t)ref_count(a->name) * b->size;
+	uint64_t rb = (uint64_t)ref_count(b->name) * a->size;
+	if (ra != rb)
+		return (ra > rb) ? -1 : 1;
+	return (a->order > b->order) - (a->order < b->order);
+}
+
+static struct dpvar **sorted_dpvars(void) {
+	struct dpvar **sorted = xmalloc((ndpvars + 1) * sizeof(*sorted));
+	unsigned i = ndpvars;
+	for (struct slist *l = dpvar_list; l; l = l->next)
+		sorted[--i] = l->data;
+	qsort(sorted, ndpvars, sizeof(*sorted), dpvar_cmp);
+	return sorted;
+}
+
+_Bool dpvar_allocate(void) {
+	if (allocated)
+		return 0;
+	allocated = 1;
+	if (area_addr < 0 || ndpvars == 0)
+		return 0;
+	struct dpvar **sorted = sorted_dpvars();
+	int next = area_addr;
+	int end = area_addr + area_size;
+	_Bool any = 0;
+	for (unsigned i = 0; i < ndpvars; i++) {
+		struct dpvar *v = sorted[i];
+		if (ref_count(v->name) == 0 || next + (int)v->size > end)
+			continue;
+		v->addr = next;
+		next += v->size;
+		any = 1;
+	}
+	free(sorted);
+	return any;
+}
+
+void dpvar_print_report(FILE *f) {
+	if (area_addr < 0) {
+		fprintf(f, "No DPAREA declared.\n");
+	} else {
+		fprintf(f, "DPAREA $%04X-$%04X (%d bytes)\n\n",
+			area_addr, area_addr + area_size - 1, area_size);
+	}
+	if (ndpvars == 0)
+		return;
+	fprintf(f, "%-24s %5s %6s  %s\n", "Variable", "Size", "Refs", "Address");
+	struct dpvar **sorted = sorted_dpvars();
+	unsigned used = 0, saved = 0;
+	for (unsigned i = 0; i < ndpvars; i++) {
+		struct dpvar *v = sorted[i];
+		unsigned refs = ref_count(v->name);
+		fprintf(f, "%-24s %5u %6u  ", v->name, v->size, refs);
+		if (v->addr >= 0) {
+			fprintf(f, "$%04X\n", v->addr);
+			used += v->size;
+			saved += refs;
+		} else {
+			fprintf(f, "-\n");
+		}
+	}
+	free(sorted);
+	fprintf(f, "\nUsed %u of %d bytes.  Saved %u bytes, and %u cycles if each reference\n"
+		"is executed once.\n", used, area_addr < 0 ? 0 : area_size, saved, saved);
+}
+
+void dpvar_free_all(void) {
+	slist_free(dpvar_list);
+	dpvar_list = NULL;
+	if (dpvars)
+		dict_destroy(dpvars);
+	dpvars = NULL;
+	if (ref_counts)
+		dict_destroy(ref_counts);
+	ref_counts = NULL;
+	ndpvars = 0;
+	area_addr = -1;
+	area_size = 0;
+	allocated = 0;
+}
@@ -0,0 +1,66 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#ifndef ASM6809_DPVAR_H_
+#define ASM6809_DPVAR_H_
+
+#include <stdio.h>
+
+/*
+ * Allocation of variables to the direct page.
+ *
+ * DPAREA declares a range of addresses within one page available for
+ * variables, and DPVAR declares a candidate variable.  During the first pass,
+ * every candidate is placed as though reserved with RMB, and references to
+ * each symbol made by instructions that could use direct addressing are
+ * counted.
+ *
+ * At the end of the first pass, dpvar_allocate() assigns the candidates that
+ * save most per byte into the area.  That allocation is then fixed: in later
+ * passes, an allocated candidate's label takes its address in the area and it
+ * reserves no space where declared.
+ */
+
+struct node;
+struct opcode;
+
+/* Set while evaluating the arguments of an instruction whose references are
+ * to be counted. */
+extern _Bool dpvar_counting;
+
+/* True if the arguments (unevaluated) to an instruction mean it could use
+ * direct addressing. */
+_Bool dpvar_countable(struct opcode const *op, struct node const *raw_args);
+
+/* Count a reference to a symbol, if dpvar_counting is set. */
+void dpvar_note_ref(char const *key);
+
+/* Declare the area available for allocation. */
+void dpvar_set_area(int addr, int size);
+
+/* Declare a candidate variable (name is an atom). */
+void dpvar_declare(char const *name, int size);
+
+/* Address allocated to a candidate, or -1 if none. */
+int dpvar_address(char const *name);
+
+/* Allocate candidates to the area, if not already done.  This also ends the
+ * counting of references.  Returns true if any were allocated, meaning
+ * another pass is needed. */
+_Bool dpvar_allocate(void);
+
+/* Print a report of candidates and estimated savings. */
+void dpvar_print_report(FILE *f);
+
+void dpvar_free_all(void);
+
+#endif
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -21,12 +21,14 @@ option) any later version.
 #include "xvasprintf.h"
 
 #include "asm6809.h"
+#include "depend.h"
 #include "error.h"
 #include "program.h"
 #include "slist.h"
 
-/* Highest error level encountered */
-enum error_type error_level = error_type_none;
+/* Highest error level encountered.  Errors are tracked per-thread - see
+ * error_detach(). */
+THREAD_LOCAL enum error_type error_level = error_type_none;
 
 /* Track errors during a pass */
 struct error {
@@ -35,8 +37,26 @@ struct error {
 	unsigned line_number;
 	char *message;
 };
-static struct slist *error_list = NULL;
-static struct slist **error_list_next = &error_list;
+static THREAD_LOCAL struct slist *error_list = NULL;
+/* Thread-local storage can't be initialised with the address of another
+ * thread-local variable, so NULL stands for &error_list here. */
+static THREAD_LOCAL struct slist **error_list_next = NULL;
+
+static struct slist **list_end(void) {
+	if (!error_list_next)
+		error_list_next = &error_list;
+	return error_list_next;
+}
+
+/* Inconsistencies trump out of range errors, as they cause another pass */
+static enum error_type raise_level(enum error_type level, enum error_type type) {
+	if (type > level)
+		level = type;
+	if (type == error_type_inconsistent &&
+	    level == error_type_out_of_range)
+		level = error_type_inconsistent;
+	return level;
+}
 
 /*
  * Report an error.
@@ -44,12 +64,7 @@ static struct slist **error_list_next = &error_list;
 
 static void verror(enum error_type type, const char *fmt, va_list ap) {
 	struct error *err = NULL;
-	if (type > error_level) {
-		error_level = type;
-	}
-	if (type == error_type_inconsistent &&
-	    error_level == error_type_out_of_range)
-		error_level = error_type_inconsistent;
+	error_level = raise_level(error_level, type);
 	if (fmt) {
 		err = xmalloc(sizeof(*err));
 		err->type = type;
@@ -66,9 +81,11 @@ static void verror(enum error_type type, const char *fmt, va_list ap) {
 		}
 		err->message = xvasprintf(fmt, ap);
 	}
+	depend_note_error(type, err ? err->message : NULL);
 	if (err) {
-		*error_list_next = slist_append(*error_list_next, err);
-		error_list_next = &((*error_list_next)->next);
+		struct slist **next = list_end();
+		*next = slist_append(*next, err);
+		error_list_next = &((*next)->next);
 	}
 }
 
@@ -108,6 +125,75 @@ void error_clear_all(void) {
 	error_level = error_type_none;
 }
 
+/*
+ * Mark the current end of the error list.
+ */
+
+void error_mark(struct error_mark *mark) {
+	mark->next = list_end();
+	mark->level = error_level;
+}
+
+/*
+ * Discard errors raised since a mark that are no more serious than max_type.
+ * The error level is recalculated from those that remain.
+ */
+
+void error_discard(struct error_mark const *mark, enum error_type max_type) {
+	enum error_type level = mark->level;
+	struct slist **lp = mark->next;
+	while (*lp) {
+		struct slist *l = *lp;
+		struct error *err = l->data;
+		if (err->type <= max_type) {
+			*lp = l->next;
+			free(err->message);
+			free(err);
+			slist_free_1(l);
+			continue;
+		}
+		level = raise_level(level, err->type);
+		lp = &l->next;
+	}
+	error_list_next = lp;
+	error_level = level;
+}
+
+/*
+ * Detach the errors raised so far by this thread, or merge a detached set into
+ * this thread's list.  Used to collect errors from worker threads.
+ */
+
+struct error_set {
+	struct slist *list;
+	enum error_type level;
+};
+
+struct error_set *error_detach(void) {
+	struct error_set *set = xmalloc(sizeof(*set));
+	set->list = error_list;
+	set->level = error_level;
+	error_list = NULL;
+	error_list_next = &error_list;
+	error_level = error_type_none;
+	return set;
+}
+
+void error_merge(struct error_set *set) {
+	if (!set)
+		return;
+	struct slist **next = list_end();
+	*next = set->list;
+	while (*next) {
+		struct error *err = (*next)->data;
+		error_level = raise_level(error_level, err->type);
+		next = &((*next)->next);
+	}
+	error_list_next = next;
+	error_level = raise_level(error_level, set->level);
+	free(set);
+}
+
 /*
  * If finishing, this is called to print out the errors found in the last pass.
  * Frees data as it goes.  Resets error_level.
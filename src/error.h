@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -76,7 +76,7 @@ enum error_type {
  * or trigger another pass.
  */
 
-extern enum error_type error_level;
+extern THREAD_LOCAL enum error_type error_level;
 
 /*
  * Report an error.
@@ -94,6 +94,34 @@ _Noreturn void error_abort(const char *fmt, ...);
  */
 void error_clear_all(void);
 
+/*
+ * Mark the current end of the error list.  Errors raised after the mark that
+ * are no more serious than a given type can later be discarded, e.g. if the
+ * problem they describe is going to be resolved some other way.
+ */
+
+struct slist;
+
+struct error_mark {
+	struct slist **next;
+	enum error_type level;
+};
+
+void error_mark(struct error_mark *mark);
+void error_discard(struct error_mark const *mark, enum error_type max_type);
+
+/*
+ * Errors are tracked per-thread.  error_detach() takes all errors raised so
+ * far by the current thread (resetting its error level), and error_merge()
+ * appends them to the current thread's list, as if raised there, freeing the
+ * set.
+ */
+
+struct error_set;
+
+struct error_set *error_detach(void);
+void error_merge(struct error_set *set);
+
 /*
  * If finishing, this is called to print out the errors found in the last pass.
  */
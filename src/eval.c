@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -18,8 +18,8 @@ option) any later version.
 #include <string.h>
 
 #include "xalloc.h"
-#include "xvasprintf.h"
 
+#include "atom.h"
 #include "error.h"
 #include "eval.h"
 #include "interp.h"
@@ -75,21 +75,30 @@ struct node *eval_node(struct node *n) {
 	/* Identifier.  Either a single positional variable to be looked up
 	 * directly, or a list of strings, positional variables or register
 	 * names to be pasted together to form a symbol name, which is then
-	 * fetched and evaluated.  */
+	 * fetched and evaluated.  A single plain string always names the same
+	 * symbol, so is bound to its slot on first use.  */
 	case node_type_id:
-		if (n->data.as_list->next == NULL) {
-			struct node *arg = n->data.as_list->data;
-			if (arg && arg->type == node_type_interp)
-				return node_set_attr_if(eval_node(arg), attr);
-		}
-		if ((tmp1 = eval_string(n))) {
-			struct node *tmp2 = symbol_get(tmp1->data.as_string);
-			node_free(tmp1);
+		{
+			struct node *tmp2;
+			if (!n->data.as_list.symbol && n->data.as_list.parts->next == NULL) {
+				struct node *arg = n->data.as_list.parts->data;
+				if (arg && arg->type == node_type_interp)
+					return node_set_attr_if(eval_node(arg), attr);
+				if (arg && arg->type == node_type_string)
+					n->data.as_list.symbol = symbol_slot(arg->data.as_string);
+			}
+			if (n->data.as_list.symbol) {
+				tmp2 = symbol_slot_get(n->data.as_list.symbol);
+			} else if ((tmp1 = eval_string(n))) {
+				tmp2 = symbol_get(tmp1->data.as_string);
+				node_free(tmp1);
+			} else {
+				return NULL;
+			}
 			tmp1 = eval_node(tmp2);
 			node_free(tmp2);
 			return node_set_attr_if(tmp1, attr);
 		}
-		return NULL;
 
 	/* A list of strings and positional variables to be pasted together to
 	 * form a piece of text. */
@@ -112,12 +121,11 @@ struct node *eval_node(struct node *n) {
 		{
 			struct node **arga = n->data.as_array.args;
 			int nargs = n->data.as_array.nargs;
-			struct node *new = NULL;
-			for (int i = 0; i < nargs; i++) {
-				struct node *tmp;
-				tmp = eval_node(arga[i]);
-				new = node_array_push(new, tmp);
-			}
+			if (nargs == 0)
+				return NULL;
+			struct node *new = node_new_array_n(nargs);
+			for (int i = 0; i < nargs; i++)
+				new->data.as_array.args[i] = eval_node(arga[i]);
 			return node_set_attr(new, attr);
 		}
 
@@ -140,48 +148,72 @@ struct node *eval_string(struct node *n) {
 		return NULL;
 	if (n->type == node_type_string)
 		return node_ref(n);
+	if (n->type == node_type_opcode)
+		return node_ref(n->data.as_opcode.name);
 	if (n->type != node_type_id && n->type != node_type_text)
 		return NULL;
 	enum node_attr attr = node_attr_of(n);
-	struct node *out = node_new_string(NULL);
-	int size = 0;
-	for (struct slist *l = n->data.as_list; l; l = l->next) {
+	struct slist *list = n->data.as_list.parts;
+	/* Most common case is a single string, which is already the result. */
+	if (list && !list->next) {
+		struct node *elem = list->data;
+		if (node_type_of(elem) == node_type_string && elem->attr == attr)
+			return node_ref(elem);
+	}
+	/* Pasted text is collected in a local buffer, only moving to the heap if
+	 * it gets long, then interned. */
+	char buf[128];
+	char *text = buf;
+	size_t size = 0;
+	size_t allocated = sizeof(buf);
+	struct node *out = NULL;
+	for (struct slist *l = list; l; l = l->next) {
 		struct node *elem = l->data;
 		struct node *tmp;
-		if (!(tmp = eval_node(elem))) {
-			node_free(out);
-			return NULL;
-		}
-		char *addtext;
+		if (!(tmp = eval_node(elem)))
+			goto done;
+		char numtext[24];
+		char const *addtext;
+		size_t add;
 		switch (tmp->type) {
 		case node_type_string:
-			addtext = xstrdup(tmp->data.as_string);
+			addtext = tmp->data.as_string;
+			add = atom_length(addtext);
 			break;
 		case node_type_int:
-			addtext = xasprintf("%"PRId64, tmp->data.as_int);
+			add = snprintf(numtext, sizeof(numtext), "%"PRId64, tmp->data.as_int);
+			addtext = numtext;
 			break;
 		case node_type_reg:
 			if (tmp->attr != node_attr_none) {
 				node_free(tmp);
-				node_free(out);
-				return NULL;
+				goto done;
 			}
-			addtext = xstrdup(reg_id_to_name(tmp->data.as_reg));
+			addtext = reg_id_to_name(tmp->data.as_reg);
+			add = strlen(addtext);
 			break;
 		default:
 			node_free(tmp);
-			node_free(out);
-			return NULL;
+			goto done;
+		}
+		if (size + add > allocated) {
+			allocated = (size + add) * 2;
+			if (text == buf) {
+				text = xmalloc(allocated);
+				memcpy(text, buf, size);
+			} else {
+				text = xrealloc(text, allocated);
+			}
 		}
-		int add = strlen(addtext);
-		out->data.as_string = xrealloc(out->data.as_string, size + add + 1);
-		out->data.as_string[size] = 0;
+		memcpy(text + size, addtext, add);
 		size += add;
-		strcat(out->data.as_string, addtext);
-		free(addtext);
 		node_free(tmp);
 	}
-	return node_set_attr(out, attr);
+	out = node_set_attr(node_new_string(atom_new_n(text, size)), attr);
+done:
+	if (text != buf)
+		free(text);
+	return out;
 }
 
 struct node *eval_float(struct node *n) {
@@ -369,10 +401,10 @@ static struct node *eval_node_oper_2(struct node *n) {
 			ret = node_new_int(strcmp(leftn->data.as_string, rightn->data.as_string) >= 0);
 			break;
 		case EQ:
-			ret = node_new_int(strcmp(leftn->data.as_string, rightn->data.as_string) == 0);
+			ret = node_new_int(leftn->data.as_string == rightn->data.as_string);
 			break;
 		case NE:
-			ret = node_new_int(strcmp(leftn->data.as_string, rightn->data.as_string) != 0);
+			ret = node_new_int(leftn->data.as_string != rightn->data.as_string);
 			break;
 		default:
 			ret = NULL;
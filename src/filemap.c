@@ -0,0 +1,94 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "xalloc.h"
+
+#include "filemap.h"
+
+struct filemap *filemap_open(const char *filename) {
+	FILE *f = fopen(filename, "rb");
+	if (!f)
+		return NULL;
+	struct filemap *map = xmalloc(sizeof(*map));
+	map->data = NULL;
+	map->size = 0;
+	map->mapped = 0;
+
+#ifdef USE_MMAP
+	/* Only regular files can be usefully mapped.  Empty files are just
+	 * treated as zero-length reads. */
+	struct stat st;
+	if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+	    && (uintmax_t)st.st_size <= SIZE_MAX) {
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		if (data != MAP_FAILED) {
+			map->data = data;
+			map->size = st.st_size;
+			map->mapped = 1;
+			fclose(f);
+			return map;
+		}
+	}
+#endif
+
+	/* Otherwise read the whole file into a buffer */
+	char *buf = NULL;
+	size_t allocated = 0;
+	for (;;) {
+		if (map->size == allocated) {
+			allocated = allocated ? allocated * 2 : 65536;
+			buf = xrealloc(buf, allocated);
+		}
+		size_t n = fread(buf + map->size, 1, allocated - map->size, f);
+		if (n == 0)
+			break;
+		map->size += n;
+	}
+	if (ferror(f)) {
+		int err = errno;
+		free(buf);
+		free(map);
+		fclose(f);
+		errno = err;
+		return NULL;
+	}
+	fclose(f);
+	map->data = buf;
+	return map;
+}
+
+void filemap_close(struct filemap *map) {
+	if (!map)
+		return;
+#ifdef USE_MMAP
+	if (map->mapped) {
+		munmap((void *)map->data, map->size);
+		free(map);
+		return;
+	}
+#endif
+	free((void *)map->data);
+	free(map);
+}
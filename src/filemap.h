@@ -0,0 +1,35 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#ifndef ASM6809_FILEMAP_H_
+#define ASM6809_FILEMAP_H_
+
+/*
+ * Read-only access to the whole contents of a file.  Where supported, the
+ * file is memory mapped, otherwise it is read into an allocated buffer.
+ *
+ * The data is not NUL terminated.  It remains valid until filemap_close().
+ */
+
+#include <stddef.h>
+
+struct filemap {
+	char const *data;
+	size_t size;
+	_Bool mapped;
+};
+
+/* Returns NULL (with errno set) if the file could not be opened or read. */
+struct filemap *filemap_open(const char *filename);
+void filemap_close(struct filemap *map);
+
+#endif
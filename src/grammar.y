@@ -2,7 +2,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -17,34 +17,60 @@ option) any later version.
 #include <string.h>
 
 #include "c-strcase.h"
+#include "xalloc.h"
 
+#include "assemble.h"
 #include "error.h"
 #include "eval.h"
+#include "filemap.h"
 #include "node.h"
 #include "program.h"
 #include "register.h"
 #include "slist.h"
 
-static void raise_error(void);
-static void yyerror(const char *);
-void yylex_destroy(void);
-int yylex(void);
-char *lex_fetch_line(void);
-void lex_free_all(void);
-
-extern FILE *yyin;
-static struct prog_ctx *cur_ctx = NULL;
+void *lex_new(struct filemap *map);
+void lex_free(void *scanner);
+void lex_end_input(void *scanner);
+char const *lex_fetch_line(void *scanner, unsigned *length);
+
+/* Open conditional branches while parsing */
+struct cond_branch {
+	struct prog_line *line;
+	unsigned index;
+	_Bool seen_else;
+	_Bool unsafe;
+};
+
+/* All parser state is per-file, so that files may be parsed concurrently */
+struct parse_state {
+	struct prog_ctx *ctx;
+	struct slist *cond_stack;
+};
+
+struct prog *grammar_parse(const char *filename, struct filemap *map);
+
+static void raise_error(void *scanner, struct parse_state *ps);
+static void yyerror(void *scanner, struct parse_state *ps, const char *);
+
+static struct node *resolve_opcode(struct node *id);
+static void set_line_text(void *scanner, struct prog_line *line);
+static void track_cond(struct parse_state *ps, struct prog_line *line);
+static void check_end_opcode(void *scanner, struct prog_line *line);
+%}
 
-struct prog *grammar_parse_file(const char *filename);
+%define api.pure full
+%lex-param {void *scanner}
+%parse-param {void *scanner} {struct parse_state *ps}
 
-static void check_end_opcode(struct prog_line *line);
-%}
+%code requires {
+struct parse_state;
+}
 
 %union {
 	int as_token;
 	int64_t as_int;
 	double as_float;
-	char *as_string;
+	char const *as_string;
 	enum reg_id as_reg;
 	struct node *as_node;
 	struct prog_line *as_line;
@@ -63,10 +89,12 @@ static void check_end_opcode(struct prog_line *line);
 %token DELIM
 %token DEC2 INC2
 
-%destructor { free($$); } <as_string>
+%code {
+int yylex(YYSTYPE *lvalp, void *scanner);
+}
 
 %type <as_node> label
-%type <as_node> id string
+%type <as_node> opcode id string
 %type <as_node> idpart strpart arg
 %type <as_node> arglist
 %type <as_list> idlist strlist
@@ -90,14 +118,14 @@ static void check_end_opcode(struct prog_line *line);
 %%
 
 program	:
-	| program line	{ prog_line_set_text($2, lex_fetch_line()); prog_ctx_add_line(cur_ctx, $2); check_end_opcode($2); }
-	| program error '\n'	{ raise_error(); yyerrok; }
+	| program line	{ set_line_text(scanner, $2); prog_ctx_add_line(ps->ctx, $2); track_cond(ps, $2); check_end_opcode(scanner, $2); }
+	| program error '\n'	{ raise_error(scanner, ps); yyerrok; }
 	;
 
-line	: label WS id WS arglist '\n'	{ $$ = prog_line_new($1, $3, $5); }
-	| label WS id WS arglist error '\n'	{ $$ = prog_line_new($1, $3, $5); }
-	| label WS id '\n'		{ $$ = prog_line_new($1, $3, NULL); }
-	| label WS id error '\n'	{ $$ = prog_line_new($1, $3, NULL); }
+line	: label WS opcode WS arglist '\n'	{ $$ = prog_line_new($1, $3, $5); }
+	| label WS opcode WS arglist error '\n'	{ $$ = prog_line_new($1, $3, $5); }
+	| label WS opcode '\n'		{ $$ = prog_line_new($1, $3, NULL); }
+	| label WS opcode error '\n'	{ $$ = prog_line_new($1, $3, NULL); }
 	| label '\n'			{ $$ = prog_line_new($1, NULL, NULL); }
 	;
 
@@ -106,6 +134,9 @@ label	:			{ $$ = NULL; }
 	| id			{ $$ = $1; }
 	;
 
+opcode	: id			{ $$ = resolve_opcode($1); }
+	;
+
 id	: idlist		{ $$ = node_new_id($1); }
 	;
 
@@ -187,41 +218,125 @@ strpart	: TEXT			{ $$ = node_new_string($1); }
 
 %%
 
-static void raise_error(void) {
+static void raise_error(void *scanner, struct parse_state *ps) {
 	// discard line with error - going to fail anyway
-	char *l = lex_fetch_line();
-	free(l);
-	cur_ctx->line_number++;
+	unsigned length;
+	(void)lex_fetch_line(scanner, &length);
+	ps->ctx->line_number++;
 	error(error_type_syntax, "");
 }
 
-static void yyerror(const char *s) {
+static void yyerror(void *scanner, struct parse_state *ps, const char *s) {
+	(void)scanner;
+	(void)ps;
 	(void)s;
 }
 
-struct prog *grammar_parse_file(const char *filename) {
-	yyin = fopen(filename, "r");
-	if (!yyin) {
-		error(error_type_fatal, "file not found: %s", filename);
-		return NULL;
-	}
+struct prog *grammar_parse(const char *filename, struct filemap *map) {
 	struct prog *prog = prog_new(prog_type_file, filename);
-	cur_ctx = prog_ctx_new(prog);
-	yyparse();
-	prog_ctx_free(cur_ctx);
-	cur_ctx = NULL;
-	if (yyin)
-		fclose(yyin);
-	lex_free_all();
+	struct parse_state ps = {
+		.ctx = prog_ctx_new(prog),
+		.cond_stack = NULL,
+	};
+	void *scanner = lex_new(map);
+	yyparse(scanner, &ps);
+	lex_free(scanner);
+	slist_free_full(ps.cond_stack, (slist_free_func)free);
+	prog_ctx_free(ps.ctx);
 	return prog;
 }
 
-static void check_end_opcode(struct prog_line *line) {
+static void set_line_text(void *scanner, struct prog_line *line) {
+	unsigned length;
+	char const *text = lex_fetch_line(scanner, &length);
+	prog_line_set_text(line, text, length);
+}
+
+/* Track open conditional branches to find how many lines each would skip if
+ * excluded (see program.h).  Skipping is only safe across lines the assembler
+ * would otherwise just list: any macro definition, computed opcode or
+ * mismatched ELSE in between prevents it. */
+
+static void cond_unsafe(struct parse_state *ps) {
+	for (struct slist *l = ps->cond_stack; l; l = l->next) {
+		struct cond_branch *b = l->data;
+		b->unsafe = 1;
+	}
+}
+
+static void cond_close(struct parse_state *ps, unsigned index) {
+	struct cond_branch *b = ps->cond_stack->data;
+	if (!b->unsafe)
+		b->line->cond_skip = index - b->index;
+}
+
+static void track_cond(struct parse_state *ps, struct prog_line *line) {
+	unsigned index = ps->ctx->prog->nlines - 1;
+	if (node_type_of(line->opcode) != node_type_opcode) {
+		if (line->opcode)
+			cond_unsafe(ps);
+		return;
+	}
+	struct asm_op const *op = line->opcode->data.as_opcode.op;
+	struct cond_branch *b;
+	switch (op ? op->type : asm_op_none) {
+	case asm_op_macro:
+	case asm_op_endm:
+		cond_unsafe(ps);
+		break;
+	case asm_op_if:
+		b = xmalloc(sizeof(*b));
+		b->line = line;
+		b->index = index;
+		b->seen_else = 0;
+		b->unsafe = 0;
+		ps->cond_stack = slist_prepend(ps->cond_stack, b);
+		break;
+	case asm_op_elsif:
+	case asm_op_else:
+		if (!ps->cond_stack)
+			break;
+		b = ps->cond_stack->data;
+		if (b->seen_else) {
+			cond_unsafe(ps);
+			break;
+		}
+		cond_close(ps, index);
+		b->line = line;
+		b->index = index;
+		b->seen_else = (op->type == asm_op_else);
+		b->unsafe = 0;
+		break;
+	case asm_op_endif:
+		if (!ps->cond_stack)
+			break;
+		cond_close(ps, index);
+		b = ps->cond_stack->data;
+		ps->cond_stack = slist_remove(ps->cond_stack, b);
+		free(b);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Resolve an opcode field now, unless it contains positional variables. */
+
+static struct node *resolve_opcode(struct node *id) {
+	for (struct slist *l = id->data.as_list.parts; l; l = l->next) {
+		if (node_type_of(l->data) != node_type_string)
+			return id;
+	}
+	struct node *name = eval_string(id);
+	node_free(id);
+	return node_new_opcode(name, assemble_op_by_name(name->data.as_string));
+}
+
+static void check_end_opcode(void *scanner, struct prog_line *line) {
 	struct node *n = eval_string(line->opcode);
 	if (n) {
 		if (0 == c_strcasecmp("end", n->data.as_string)) {
-			fclose(yyin);
-			yyin = NULL;
+			lex_end_input(scanner);
 		}
 		node_free(n);
 	}
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -18,6 +18,7 @@ option) any later version.
 #include "array.h"
 #include "asm6809.h"
 #include "assemble.h"
+#include "dpadvice.h"
 #include "error.h"
 #include "eval.h"
 #include "instr.h"
@@ -86,6 +87,62 @@ static int to_rel16(int64_t i) {
 	return i;
 }
 
+/* Long form of a short branch and vice versa.  Most long branches are the
+ * short opcode on page 2, but BRA and BSR have their own. */
+
+static unsigned long_branch_op(unsigned short_op) {
+	switch (short_op) {
+	case 0x20: return 0x16;
+	case 0x8d: return 0x17;
+	default: break;
+	}
+	return 0x1000 | short_op;
+}
+
+static unsigned short_branch_op(unsigned long_op) {
+	switch (long_op) {
+	case 0x16: return 0x20;
+	case 0x17: return 0x8d;
+	default: break;
+	}
+	return long_op & 0xff;
+}
+
+/* Relaxing branch.  Assembled in short form unless the target is out of
+ * range, or an explicit 16-bit attribute asks for long.  A branch that needed
+ * its long form stays long in later passes, so code only ever grows and
+ * passes can't oscillate between forms. */
+
+static void instr_rel_relax(unsigned short_op, unsigned long_op, struct node const *arg) {
+	enum node_attr attr = node_attr_of(arg);
+	_Bool is_long = (attr == node_attr_16bit) || section_branch_is_long();
+	if (!is_long && attr != node_attr_8bit && node_type_of(arg) == node_type_int) {
+		int rel8 = to_rel16(arg->data.as_int - (cur_section->pc + 2));
+		if (rel8 < -128 || rel8 > 127) {
+			section_branch_set_long();
+			is_long = 1;
+		}
+	}
+	if (!is_long) {
+		section_emit_op(short_op);
+		if (node_type_of(arg) != node_type_int) {
+			section_emit_pad(1);
+			return;
+		}
+		int rel8 = to_rel16(arg->data.as_int - (cur_section->pc + 1));
+		if (rel8 < -128 || rel8 > 127)
+			error(error_type_out_of_range, "8-bit relative value out of range");
+		section_emit_uint8(rel8);
+		return;
+	}
+	section_emit_op(long_op);
+	if (node_type_of(arg) != node_type_int) {
+		section_emit_pad(2);
+		return;
+	}
+	section_emit_uint16(arg->data.as_int - (cur_section->pc + 2));
+}
+
 void instr_rel(struct opcode const *op, struct node const *args) {
 	int nargs = node_array_count(args);
 	struct node **arga = node_array_of(args);
@@ -93,6 +150,18 @@ void instr_rel(struct opcode const *op, struct node const *args) {
 		error(error_type_syntax, "invalid number of arguments");
 		return;
 	}
+	int op_ext_type = op->type & OPCODE_EXT_TYPE;
+	if (op_ext_type == OPCODE_RELAX) {
+		instr_rel_relax(op->immediate, op->extended, arga[0]);
+		return;
+	}
+	if (asm6809_options.relax_branches) {
+		if (op_ext_type == OPCODE_REL8)
+			instr_rel_relax(op->immediate, long_branch_op(op->immediate), arga[0]);
+		else
+			instr_rel_relax(short_branch_op(op->immediate), op->immediate, arga[0]);
+		return;
+	}
 	section_emit_op(op->immediate);
 	if (node_type_of(arga[0]) != node_type_int) {
 		if ((op->type & OPCODE_EXT_TYPE) == OPCODE_REL8)
@@ -438,6 +507,7 @@ void instr_address(struct opcode const *op, struct node const *args, int imm8_va
 	}
 
 	struct node *arg = eval_int(arga[0]);
+	_Bool have_arg = (arg != NULL);
 	enum node_attr attr = node_attr_16bit;
 	unsigned addr = cur_section->pc;
 	if (arg) {
@@ -446,6 +516,13 @@ void instr_address(struct opcode const *op, struct node const *args, int imm8_va
 		node_free(arg);
 	}
 
+	/* Only operands free to be either direct or extended interest the
+	 * SETDP advisor */
+	if (asm6809_options.dp_advice && have_arg && attr == node_attr_none &&
+	    (op->type & OPCODE_DIRECT) && (op->type & OPCODE_EXTENDED)) {
+		dpadvice_access(op, addr, cur_section->dp == (addr >> 8));
+	}
+
 	if ((op->type & OPCODE_DIRECT)) {
 		if (attr == node_attr_8bit ||
 		    (attr == node_attr_none && (cur_section->dp == (addr >> 8)))) {
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -16,6 +16,7 @@ option) any later version.
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "depend.h"
 #include "error.h"
 #include "interp.h"
 #include "node.h"
@@ -45,6 +46,13 @@ void interp_pop(void) {
 	node_free(n);
 }
 
+_Bool interp_peek(struct node **n) {
+	if (!interp_stack)
+		return 0;
+	*n = node_ref(interp_stack->data);
+	return 1;
+}
+
 struct node *interp_get(int index) {
 	if (!interp_stack) {
 		error(error_type_syntax, "no positional variables on stack");
@@ -57,5 +65,16 @@ struct node *interp_get(int index) {
 		return NULL;
 	}
 	struct node *n = args->data.as_array.args[index-1];
+	depend_note_interp(index, n);
 	return node_ref(n);
 }
+
+struct node *interp_try_get(int index) {
+	if (!interp_stack)
+		return NULL;
+	struct node *args = interp_stack->data;
+	int nargs = args ? args->data.as_array.nargs : 0;
+	if (index < 1 || index > nargs)
+		return NULL;
+	return node_ref(args->data.as_array.args[index-1]);
+}
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -21,7 +21,14 @@ void interp_push(struct node *);
 /* Remove the current array from the stack. */
 void interp_pop(void);
 
+/* If the stack is not empty, store a new reference to the current array in *n
+ * and return true. */
+_Bool interp_peek(struct node **n);
+
 /* Fetch positional variable from the current array. */
 struct node *interp_get(int index);
 
+/* As above, but return NULL without raising an error if not available. */
+struct node *interp_try_get(int index);
+
 #endif
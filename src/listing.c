@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -22,6 +22,7 @@ option) any later version.
 
 #include "asm6809.h"
 #include "listing.h"
+#include "opcode.h"
 #include "program.h"
 #include "section.h"
 #include "slist.h"
@@ -31,27 +32,104 @@ struct listing_line {
 	int nbytes;
 	struct section_span const *span;
 	char const *text;
+	unsigned text_len;
+	_Bool instr;
+	_Bool label;
+	char const *note;
 };
 
 static struct slist *listing_lines = NULL;
 static struct slist **listing_next = &listing_lines;
+static _Bool label_pending = 0;
+static char const *note_pending = NULL;
 
-void listing_add_line(int pc, int nbytes, struct section_span const *span, char const *text) {
+static void add_line(int pc, int nbytes, struct section_span const *span, struct prog_line const *line, _Bool instr) {
 	if (!asm6809_options.listing_required)
 		return;
 	struct listing_line *l = xmalloc(sizeof(*l));
 	l->pc = pc;
 	l->nbytes = nbytes;
 	l->span = span;
-	l->text = text;
+	l->text = line->text;
+	l->text_len = line->text_len;
+	l->instr = instr;
+	l->label = label_pending;
+	label_pending = 0;
+	l->note = note_pending;
+	note_pending = NULL;
 	*listing_next = slist_append(*listing_next, l);
 	listing_next = &((*listing_next)->next);
 }
 
-void listing_print(FILE *f) {
+void listing_add_line(int pc, int nbytes, struct section_span const *span, struct prog_line const *line) {
+	add_line(pc, nbytes, span, line, 0);
+}
+
+void listing_add_instr(int pc, int nbytes, struct section_span const *span, struct prog_line const *line) {
+	add_line(pc, nbytes, span, line, 1);
+}
+
+void listing_label(void) {
+	label_pending = asm6809_options.listing_required;
+}
+
+void listing_note(char const *note) {
+	note_pending = asm6809_options.listing_required ? note : NULL;
+}
+
+/* Cycles column: the count for this instruction, then the subtotal. */
+
+#define CYCLES_WIDTH (13)
+
+static void print_cycles(FILE *f, struct listing_line const *l, unsigned *subtotal) {
+	if (l->label)
+		*subtotal = 0;
+	int cycles = -1, extra = 0;
+	if (l->instr && l->nbytes > 0 && l->span && l->span->data) {
+		int offset = l->pc - l->span->org;
+		cycles = opcode_cycles(l->span->data + offset, l->nbytes, &extra);
+	}
+	if (cycles < 0) {
+		fprintf(f, "%*s", CYCLES_WIDTH, "");
+		return;
+	}
+	*subtotal += cycles;
+	char buf[32];
+	if (extra > 0)
+		snprintf(buf, sizeof(buf), "%d(%d)", cycles, cycles + extra);
+	else if (extra < 0)
+		snprintf(buf, sizeof(buf), "%d+", cycles);
+	else
+		snprintf(buf, sizeof(buf), "%d", cycles);
+	fprintf(f, "%-6s%5u  ", buf, *subtotal);
+}
+
+/* Profile columns: times executed and total cycles.  Counts are by put
+ * address, which is where the instruction was run. */
+
+#define PROFILE_WIDTH (22)
+
+static void print_profile(FILE *f, struct listing_line const *l,
+			  unsigned long const *hits, unsigned long const *cycles) {
+	if (!l->instr || l->nbytes <= 0 || l->pc < 0 || !l->span) {
+		fprintf(f, "%*s", PROFILE_WIDTH, "");
+		return;
+	}
+	unsigned put = (l->span->put + (l->pc - l->span->org)) & 0xffff;
+	if (hits[put] == 0) {
+		fprintf(f, "%*s", PROFILE_WIDTH, "");
+		return;
+	}
+	fprintf(f, "%9lu %10lu  ", hits[put], cycles[put]);
+}
+
+static void print_listing(FILE *f, unsigned long const *hits, unsigned long const *cycles) {
+	unsigned subtotal = 0;
 	for (struct slist *ll = listing_lines; ll; ll = ll->next) {
 		struct listing_line *l = ll->data;
 		int col = 0;
+		if (hits)
+			print_profile(f, l, hits, cycles);
 		if (l->pc >= 0) {
 			fprintf(f, "%04X  ", l->pc & 0xffff);
 			col += 6;
@@ -67,8 +145,10 @@ void listing_print(FILE *f) {
 			fputc(' ', f);
 			col++;
 		} while (col < 22);
+		if (asm6809_options.listing_cycles)
+			print_cycles(f, l, &subtotal);
 		col = 0;
-		for (int i = 0; l->text[i]; i++) {
+		for (unsigned i = 0; i < l->text_len; i++) {
 			if (l->text[i] == '\t') {
 				do {
 					fputc(' ', f);
@@ -79,10 +159,20 @@ void listing_print(FILE *f) {
 				col++;
 			}
 		}
+		if (l->note)
+			fprintf(f, "  ; %s", l->note);
 		fputc('\n', f);
 	}
 }
 
+void listing_print(FILE *f) {
+	print_listing(f, NULL, NULL);
+}
+
+void listing_print_profile(FILE *f, unsigned long const *hits, unsigned long const *cycles) {
+	print_listing(f, hits, cycles);
+}
+
 void listing_free_all(void) {
 	while (listing_lines) {
 		struct listing_line *l = listing_lines->data;
@@ -90,4 +180,6 @@ void listing_free_all(void) {
 		free(l);
 	}
 	listing_next = &listing_lines;
+	label_pending = 0;
+	note_pending = NULL;
 }
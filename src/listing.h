@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -20,12 +20,28 @@ option) any later version.
  * Before each pass, listing_free_all() ensures any previous attempts at a
  * listing are cleared.  listing_add_line() does what it says on the tin.
  * listing_print() dumps the listing as it currently stands to file.
+ *
+ * If cycle counts are requested, lines added with listing_add_instr() show the
+ * cycles taken by their instruction, and a running subtotal.  Subtotals
+ * restart at a line following a call to listing_label().
+ *
+ * listing_note() attaches a note (a static string, or NULL for none) to the
+ * next line added, printed after its source text.
+ *
+ * listing_print_profile() prefixes each instruction with the number of times
+ * it was executed and the total cycles spent there, from arrays indexed by
+ * address (see profile.h).
  */
 
+struct prog_line;
 struct section_span;
 
-void listing_add_line(int pc, int nbytes, struct section_span const *span, char const *text);
+void listing_add_line(int pc, int nbytes, struct section_span const *span, struct prog_line const *line);
+void listing_add_instr(int pc, int nbytes, struct section_span const *span, struct prog_line const *line);
+void listing_label(void);
+void listing_note(char const *note);
 void listing_print(FILE *f);
+void listing_print_profile(FILE *f, unsigned long const *hits, unsigned long const *cycles);
 void listing_free_all(void);
 
 #endif
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -18,6 +18,10 @@ option) any later version.
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif
+
 #include "xalloc.h"
 
 #include "error.h"
@@ -29,8 +33,69 @@ option) any later version.
 
 static struct node *node_new_oper_n(int oper, int nargs);
 
+/* Nodes are created and destroyed in great numbers while evaluating each line
+ * of every pass.  Rather than going through malloc() every time, they are
+ * carved from large blocks and recycled through a free list.
+ *
+ * Each thread has its own free list.  Only adding a new block needs a lock. */
+
+#define NODE_BLOCK_SIZE (1024)
+
+union node_slot {
+	struct node node;
+	union node_slot *next;
+};
+
+struct node_block {
+	struct node_block *next;
+	union node_slot slots[NODE_BLOCK_SIZE];
+};
+
+static struct node_block *node_blocks = NULL;
+static THREAD_LOCAL union node_slot *node_free_list = NULL;
+
+#ifdef HAVE_THREADS
+static pthread_mutex_t node_blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static struct node *node_alloc(void) {
+	if (!node_free_list) {
+		struct node_block *b = xmalloc(sizeof(*b));
+#ifdef HAVE_THREADS
+		pthread_mutex_lock(&node_blocks_lock);
+#endif
+		b->next = node_blocks;
+		node_blocks = b;
+#ifdef HAVE_THREADS
+		pthread_mutex_unlock(&node_blocks_lock);
+#endif
+		for (int i = NODE_BLOCK_SIZE - 1; i >= 0; i--) {
+			b->slots[i].next = node_free_list;
+			node_free_list = &b->slots[i];
+		}
+	}
+	union node_slot *slot = node_free_list;
+	node_free_list = slot->next;
+	return &slot->node;
+}
+
+static void node_release(struct node *n) {
+	union node_slot *slot = (union node_slot *)n;
+	slot->next = node_free_list;
+	node_free_list = slot;
+}
+
+void node_free_all(void) {
+	while (node_blocks) {
+		struct node_block *b = node_blocks;
+		node_blocks = b->next;
+		free(b);
+	}
+	node_free_list = NULL;
+}
+
 struct node *node_new(int type) {
-	struct node *n = xmalloc(sizeof(*n));
+	struct node *n = node_alloc();
 	n->ref = 1;
 	n->type = type;
 	n->attr = node_attr_none;
@@ -49,10 +114,9 @@ void node_free(struct node *n) {
 
 	switch (n->type) {
 
-	/* Nodes containing string data: */
-	case node_type_string:
-	case node_type_interp:
-		free(n->data.as_string);
+	/* Resolved opcode keeps its name */
+	case node_type_opcode:
+		node_free(n->data.as_opcode.name);
 		break;
 
 	/* Node array */
@@ -65,7 +129,7 @@ void node_free(struct node *n) {
 	/* Nodes containing linked lists of other nodes: */
 	case node_type_id:
 	case node_type_text:
-		slist_free_full(n->data.as_list, (slist_free_func)node_free);
+		slist_free_full(n->data.as_list.parts, (slist_free_func)node_free);
 		break;
 
 	/* Operator node (operator type plus array of nodes): */
@@ -78,7 +142,7 @@ void node_free(struct node *n) {
 	default:
 		break;
 	}
-	free(n);
+	node_release(n);
 }
 
 struct node *node_ref(struct node *n) {
@@ -153,7 +217,7 @@ _Bool node_equal(struct node const *n1, struct node const *n2) {
 	case node_type_reg:
 		return n1->data.as_reg == n2->data.as_reg;
 	case node_type_string:
-		return (0 == strcmp(n1->data.as_string, n2->data.as_string));
+		return n1->data.as_string == n2->data.as_string;
 	default:
 		break;
 	}
@@ -191,7 +255,7 @@ struct node *node_new_reg(enum reg_id r) {
 	return n;
 }
 
-struct node *node_new_string(char *v) {
+struct node *node_new_string(char const *v) {
 	struct node *n = node_new(node_type_string);
 	n->data.as_string = v;
 	return n;
@@ -215,23 +279,32 @@ struct node *node_new_fwdref(int64_t v) {
 	return n;
 }
 
-struct node *node_new_interp(char *v) {
+struct node *node_new_interp(char const *v) {
 	struct node *n = node_new(node_type_interp);
 	n->data.as_string = v;
 	return n;
 }
 
+struct node *node_new_opcode(struct node *name, struct asm_op const *op) {
+	struct node *n = node_new(node_type_opcode);
+	n->data.as_opcode.name = name;
+	n->data.as_opcode.op = op;
+	return n;
+}
+
 /* Operator types */
 
 struct node *node_new_id(struct slist *v) {
 	struct node *n = node_new(node_type_id);
-	n->data.as_list = v;
+	n->data.as_list.parts = v;
+	n->data.as_list.symbol = NULL;
 	return n;
 }
 
 struct node *node_new_text(struct slist *v) {
 	struct node *n = node_new(node_type_text);
-	n->data.as_list = v;
+	n->data.as_list.parts = v;
+	n->data.as_list.symbol = NULL;
 	return n;
 }
 
@@ -270,17 +343,27 @@ struct node *node_new_oper_3(int oper, struct node *a1, struct node *a2, struct
 struct node *node_new_array(void) {
 	struct node *n = node_new(node_type_array);
 	n->data.as_array.nargs = 0;
+	n->data.as_array.allocated = 0;
 	n->data.as_array.args = NULL;
 	return n;
 }
 
+struct node *node_new_array_n(int nargs) {
+	struct node *n = node_new(node_type_array);
+	n->data.as_array.nargs = nargs;
+	n->data.as_array.allocated = nargs;
+	n->data.as_array.args = xmalloc(nargs * sizeof(struct node *));
+	return n;
+}
+
 struct node *node_array_push(struct node *a, struct node *n) {
 	struct node *ret = a ? a : node_new_array();
-	struct node **arga = ret->data.as_array.args;
-	int nargs = ++ret->data.as_array.nargs;
-	arga = xrealloc(arga, nargs * sizeof(*arga));
-	arga[nargs-1] = n;
-	ret->data.as_array.args = arga;
+	struct node_array *array = &ret->data.as_array;
+	if (array->nargs >= array->allocated) {
+		array->allocated = array->allocated ? array->allocated * 2 : 4;
+		array->args = xrealloc(array->args, array->allocated * sizeof(*array->args));
+	}
+	array->args[array->nargs++] = n;
 	return ret;
 }
 
@@ -364,16 +447,19 @@ void node_print(FILE *f, struct node const *n) {
 	case node_type_interp:
 		fprintf(f, "&{%s}", n->data.as_string);
 		break;
+	case node_type_opcode:
+		node_print(f, n->data.as_opcode.name);
+		break;
 
 	/* Operator types */
 	case node_type_id:
-		for (l = n->data.as_list; l; l = l->next) {
+		for (l = n->data.as_list.parts; l; l = l->next) {
 			node_print(f, (struct node *)l->data);
 		}
 		break;
 	case node_type_text:
 		fprintf(f, "/");
-		for (l = n->data.as_list; l; l = l->next) {
+		for (l = n->data.as_list.parts; l; l = l->next) {
 			node_print(f, (struct node *)l->data);
 		}
 		fprintf(f, "/");
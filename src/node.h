@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -38,6 +38,9 @@ option) any later version.
  * The attribute of a node is only used for elements of the arguments list.  It
  * indicates some source code annotation indicating things like immediate
  * values ("#") or forced direct addressing ("<").
+ *
+ * String data is always an atom (see atom.h), so is not owned by the node, and
+ * strings can be compared for equality by pointer.
  */
 
 enum node_attr {
@@ -73,6 +76,7 @@ enum node_type {
 	node_type_backref,  // int data, numeric label
 	node_type_fwdref,  // int data, numeric label
 	node_type_interp,  // string data, variable name to interpolate
+	node_type_opcode,  // opcode field resolved when parsed
 
 	/* Operator types */
 	node_type_id,  // linked list of string & interp
@@ -83,7 +87,28 @@ enum node_type {
 	node_type_array,
 };
 
+struct asm_op;
 struct node;
+struct symbol;
+
+/* The opcode field of a line is resolved once, as it is parsed, unless it has
+ * to be pasted together from positional variables.  The name is kept as a
+ * string node (some pseudo-ops use it), and op is NULL if the name matched no
+ * pseudo-op or instruction (so should be a macro). */
+
+struct node_opcode {
+	struct node *name;
+	struct asm_op const *op;
+};
+
+/* Identifiers and text are lists of parts to be pasted together.  An
+ * identifier that is a single plain string is bound to its symbol table slot
+ * when first evaluated, so later evaluations need not look it up by name. */
+
+struct node_list {
+	struct slist *parts;
+	struct symbol *symbol;  // identifiers only, NULL until bound
+};
 
 struct node_oper {
 	int oper;
@@ -93,6 +118,7 @@ struct node_oper {
 
 struct node_array {
 	int nargs;
+	int allocated;
 	struct node **args;
 };
 
@@ -104,10 +130,11 @@ struct node {
 		struct node_oper as_oper;
 		int64_t as_int;
 		double as_float;
-		char *as_string;
+		char const *as_string;
 		enum reg_id as_reg;
-		struct slist *as_list;
+		struct node_list as_list;
 		struct node_array as_array;
+		struct node_opcode as_opcode;
 	} data;
 };
 
@@ -122,6 +149,10 @@ struct node {
 struct node *node_new(int type);
 void node_free(struct node *n);
 
+/* Release all memory held for nodes (tidy up) */
+
+void node_free_all(void);
+
 /* Create a new reference to a node */
 
 struct node *node_ref(struct node *n);
@@ -173,14 +204,15 @@ struct node *node_new_empty(void);
 struct node *node_new_int(int64_t v);
 struct node *node_new_float(double v);
 struct node *node_new_reg(enum reg_id r);
-struct node *node_new_string(char *v);
+struct node *node_new_string(char const *v);
 
 /* Simple types */
 
 struct node *node_new_pc(void);
 struct node *node_new_backref(int64_t v);
 struct node *node_new_fwdref(int64_t v);
-struct node *node_new_interp(char *v);
+struct node *node_new_interp(char const *v);
+struct node *node_new_opcode(struct node *name, struct asm_op const *op);
 
 /* Operator types */
 
@@ -193,6 +225,7 @@ struct node *node_new_oper_3(int oper, struct node *a1, struct node *a2, struct
 /* Array type */
 
 struct node *node_new_array(void);
+struct node *node_new_array_n(int nargs);  // elements left for caller to fill
 struct node *node_array_push(struct node *a, struct node *n);
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -12,6 +12,7 @@ option) any later version.
 
 #include "config.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "array.h"
@@ -37,6 +38,7 @@ option) any later version.
 #define IMM8_MEM OPCODE_IMM8_MEM|OPCODE_MEM
 #define REG_MEM  OPCODE_REG_MEM
 #define TFM      OPCODE_TFM
+#define RELAX    OPCODE_RELAX
 
 /* MC6809 opcode table. */
 
@@ -203,6 +205,27 @@ static struct opcode const opcodes_6809[] = {
 	{ .op = "cmpu", .type = IMM16|MEM, .immediate = 0x1183, .direct = 0x1193, .indexed = 0x11a3, .extended = 0x11b3 },
 	{ .op = "cmps", .type = IMM16|MEM, .immediate = 0x118c, .direct = 0x119c, .indexed = 0x11ac, .extended = 0x11bc },
 
+	/* Relaxing branches, assembled to short or long form as needed */
+	{ .op = "jbra", .type = RELAX, .immediate = 0x20, .extended = 0x16 },
+	{ .op = "jbrn", .type = RELAX, .immediate = 0x21, .extended = 0x1021 },
+	{ .op = "jbhi", .type = RELAX, .immediate = 0x22, .extended = 0x1022 },
+	{ .op = "jbls", .type = RELAX, .immediate = 0x23, .extended = 0x1023 },
+	{ .op = "jbcc", .type = RELAX, .immediate = 0x24, .extended = 0x1024 },
+	{ .op = "jbhs", .type = RELAX, .immediate = 0x24, .extended = 0x1024 },
+	{ .op = "jbcs", .type = RELAX, .immediate = 0x25, .extended = 0x1025 },
+	{ .op = "jblo", .type = RELAX, .immediate = 0x25, .extended = 0x1025 },
+	{ .op = "jbne", .type = RELAX, .immediate = 0x26, .extended = 0x1026 },
+	{ .op = "jbeq", .type = RELAX, .immediate = 0x27, .extended = 0x1027 },
+	{ .op = "jbvc", .type = RELAX, .immediate = 0x28, .extended = 0x1028 },
+	{ .op = "jbvs", .type = RELAX, .immediate = 0x29, .extended = 0x1029 },
+	{ .op = "jbpl", .type = RELAX, .immediate = 0x2a, .extended = 0x102a },
+	{ .op = "jbmi", .type = RELAX, .immediate = 0x2b, .extended = 0x102b },
+	{ .op = "jbge", .type = RELAX, .immediate = 0x2c, .extended = 0x102c },
+	{ .op = "jblt", .type = RELAX, .immediate = 0x2d, .extended = 0x102d },
+	{ .op = "jbgt", .type = RELAX, .immediate = 0x2e, .extended = 0x102e },
+	{ .op = "jble", .type = RELAX, .immediate = 0x2f, .extended = 0x102f },
+	{ .op = "jbsr", .type = RELAX, .immediate = 0x8d, .extended = 0x17 },
+
 };
 
 /* HD6309 opcode table. */
@@ -308,6 +331,156 @@ static struct opcode const opcodes_6309[] = {
 
 };
 
+/* Cycle counts, indexed by opcode for each page (none, $10 and $11).  Zero
+ * marks an invalid opcode.  Counts for 6309 instructions are those for
+ * emulation mode, which shares the 6809's timings.  For indexed modes, the
+ * count excludes the extra cycles determined by the postbyte, and for stack
+ * operations the cycles per register pushed or pulled. */
+
+static uint8_t const cycles_page0[256] = {
+	/*       0   1   2   3   4   5   6   7   8   9   a   b   c   d   e   f */
+	/* 0 */  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  6,  3,  6,
+	/* 1 */  0,  0,  2,  4,  4,  0,  5,  9,  0,  2,  3,  0,  3,  2,  8,  6,
+	/* 2 */  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,  3,
+	/* 3 */  4,  4,  4,  4,  5,  5,  5,  5,  0,  5,  3,  6, 20, 11,  0, 19,
+	/* 4 */  2,  0,  0,  2,  2,  0,  2,  2,  2,  2,  2,  0,  2,  2,  0,  2,
+	/* 5 */  2,  0,  0,  2,  2,  0,  2,  2,  2,  2,  2,  0,  2,  2,  0,  2,
+	/* 6 */  6,  7,  7,  6,  6,  7,  6,  6,  6,  6,  6,  7,  6,  6,  3,  6,
+	/* 7 */  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  4,  7,
+	/* 8 */  2,  2,  2,  4,  2,  2,  2,  0,  2,  2,  2,  2,  4,  7,  3,  0,
+	/* 9 */  4,  4,  4,  6,  4,  4,  4,  4,  4,  4,  4,  4,  6,  7,  5,  5,
+	/* a */  4,  4,  4,  6,  4,  4,  4,  4,  4,  4,  4,  4,  6,  7,  5,  5,
+	/* b */  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  5,  7,  8,  6,  6,
+	/* c */  2,  2,  2,  4,  2,  2,  2,  0,  2,  2,  2,  2,  3,  5,  3,  0,
+	/* d */  4,  4,  4,  6,  4,  4,  4,  4,  4,  4,  4,  4,  5,  5,  5,  5,
+	/* e */  4,  4,  4,  6,  4,  4,  4,  4,  4,  4,  4,  4,  5,  5,  5,  5,
+	/* f */  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  5,  6,  6,  6,  6,
+};
+
+static uint8_t const cycles_page2[256] = {
+	/*       0   1   2   3   4   5   6   7   8   9   a   b   c   d   e   f */
+	/* 0 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 1 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 2 */  0,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,  5,
+	/* 3 */  4,  4,  4,  4,  4,  4,  4,  4,  6,  6,  6,  6,  0,  0,  0, 20,
+	/* 4 */  3,  0,  0,  3,  3,  0,  3,  3,  3,  3,  3,  0,  3,  3,  0,  3,
+	/* 5 */  0,  0,  0,  3,  3,  0,  3,  0,  0,  3,  3,  0,  3,  3,  0,  3,
+	/* 6 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 7 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 8 */  5,  5,  5,  5,  5,  5,  4,  0,  5,  5,  5,  5,  5,  0,  4,  0,
+	/* 9 */  7,  7,  7,  7,  7,  7,  6,  6,  7,  7,  7,  7,  7,  0,  6,  6,
+	/* a */  7,  7,  7,  7,  7,  7,  6,  6,  7,  7,  7,  7,  7,  0,  6,  6,
+	/* b */  8,  8,  8,  8,  8,  8,  7,  7,  8,  8,  8,  8,  8,  0,  7,  7,
+	/* c */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  4,  0,
+	/* d */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  8,  8,  6,  6,
+	/* e */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  8,  8,  6,  6,
+	/* f */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  9,  9,  7,  7,
+};
+
+static uint8_t const cycles_page3[256] = {
+	/*       0   1   2   3   4   5   6   7   8   9   a   b   c   d   e   f */
+	/* 0 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 1 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 2 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 3 */  7,  7,  7,  7,  7,  7,  7,  7,  6,  6,  6,  6,  4,  5,  0, 20,
+	/* 4 */  0,  0,  0,  3,  0,  0,  0,  0,  0,  0,  3,  0,  3,  3,  0,  3,
+	/* 5 */  0,  0,  0,  3,  0,  0,  0,  0,  0,  0,  3,  0,  3,  3,  0,  3,
+	/* 6 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 7 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 8 */  3,  3,  0,  5,  0,  0,  3,  0,  0,  0,  0,  3,  5, 25, 34, 28,
+	/* 9 */  5,  5,  0,  7,  0,  0,  5,  5,  0,  0,  0,  5,  7, 27, 36, 30,
+	/* a */  5,  5,  0,  7,  0,  0,  5,  5,  0,  0,  0,  5,  7, 27, 36, 30,
+	/* b */  6,  6,  0,  8,  0,  0,  6,  6,  0,  0,  0,  6,  8, 28, 37, 31,
+	/* c */  3,  3,  0,  0,  0,  0,  3,  0,  0,  0,  0,  3,  0,  0,  0,  0,
+	/* d */  5,  5,  0,  0,  0,  0,  5,  5,  0,  0,  0,  5,  0,  0,  0,  0,
+	/* e */  5,  5,  0,  0,  0,  0,  5,  5,  0,  0,  0,  5,  0,  0,  0,  0,
+	/* f */  6,  6,  0,  0,  0,  0,  6,  6,  0,  0,  0,  6,  0,  0,  0,  0,
+};
+
+/* Extra cycles for each indexed mode, by the low four bits of the postbyte,
+ * for direct and indirect forms.  Offsets of 5 bits take one extra cycle. */
+
+static uint8_t const cycles_indexed[16][2] = {
+	{ 2, 0 }, { 3, 6 }, { 2, 0 }, { 3, 6 },  // ,R+  ,R++  ,-R  ,--R
+	{ 0, 3 }, { 1, 4 }, { 1, 4 }, { 1, 4 },  // ,R  B,R  A,R  E,R
+	{ 1, 4 }, { 4, 7 }, { 1, 4 }, { 4, 7 },  // n8,R  n16,R  F,R  D,R
+	{ 1, 4 }, { 5, 8 }, { 4, 7 }, { 0, 5 },  // n8,PC  n16,PC  W,R  [n16]
+};
+
+static int indexed_cycles(uint8_t postbyte) {
+	if (!(postbyte & 0x80))
+		return 1;
+	if (asm6809_options.isa == asm6809_isa_6309) {
+		/* Modes indexed by W */
+		switch (postbyte) {
+		case 0x8f: return 0;  // ,W
+		case 0x90: return 3;  // [,W]
+		case 0xaf: return 2;  // n16,W
+		case 0xb0: return 5;  // [n16,W]
+		case 0xcf: case 0xef: return 1;  // ,W++  ,--W
+		case 0xd0: case 0xf0: return 4;  // [,W++]  [,--W]
+		default: break;
+		}
+	}
+	return cycles_indexed[postbyte & 0x0f][(postbyte >> 4) & 1];
+}
+
+static _Bool opcode_is_indexed(unsigned page, uint8_t op) {
+	if ((op & 0xf0) == 0xa0 || (op & 0xf0) == 0xe0)
+		return 1;
+	return page == 0 && ((op & 0xf0) == 0x60 || (op >= 0x30 && op <= 0x33));
+}
+
+int opcode_cycles(uint8_t const *code, unsigned nbytes, int *extra) {
+	int more = 0;
+	if (nbytes < 1)
+		return -1;
+	unsigned page = 0;
+	uint8_t const *table = cycles_page0;
+	if (code[0] == 0x10 || code[0] == 0x11) {
+		page = code[0];
+		table = (page == 0x10) ? cycles_page2 : cycles_page3;
+		code++;
+		nbytes--;
+		if (nbytes < 1)
+			return -1;
+	}
+	uint8_t op = code[0];
+	int cycles = table[op];
+	if (cycles == 0)
+		return -1;
+
+	if (opcode_is_indexed(page, op)) {
+		/* The 6309's OIM, AIM, EIM and TIM have an immediate byte
+		 * before the postbyte. */
+		unsigned i = 1;
+		if (page == 0 && (op == 0x61 || op == 0x62 || op == 0x65 || op == 0x6b))
+			i = 2;
+		if (nbytes <= i)
+			return -1;
+		cycles += indexed_cycles(code[i]);
+	} else if (page == 0 && op >= 0x34 && op <= 0x37) {
+		/* One cycle per byte pushed or pulled */
+		if (nbytes < 2)
+			return -1;
+		for (unsigned i = 0; i < 8; i++) {
+			if (code[1] & (1 << i))
+				cycles += (i < 4) ? 1 : 2;
+		}
+	} else if (page == 0x10 && op >= 0x22 && op <= 0x2f) {
+		more = 1;  // long branch taken
+	} else if (page == 0 && op == 0x3b) {
+		more = 9;  // RTI with entire state stacked
+	} else if ((page == 0 && (op == 0x13 || op == 0x3c)) ||
+		   (page == 0x11 && op >= 0x38 && op <= 0x3b)) {
+		more = -1;  // SYNC, CWAI, TFM: open-ended
+	}
+
+	if (extra)
+		*extra = more;
+	return cycles;
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 static struct dict *opcodes = NULL;
@@ -340,3 +513,22 @@ void opcode_free_all(void) {
 struct opcode const *opcode_by_name(const char *name) {
 	return dict_lookup(opcodes, name);
 }
+
+struct foreach_data {
+	void (*func)(struct opcode const *, void *);
+	void *data;
+};
+
+static void foreach_opcode(void *k, void *v, void *data) {
+	(void)k;
+	struct foreach_data *fd = data;
+	fd->func(v, fd->data);
+}
+
+void opcode_foreach(void (*func)(struct opcode const *, void *), void *data) {
+	struct foreach_data fd = {
+		.func = func,
+		.data = data
+	};
+	dict_foreach(opcodes, foreach_opcode, &fd);
+}
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -13,6 +13,8 @@ option) any later version.
 #ifndef ASM6809_OPCODES_H_
 #define ASM6809_OPCODES_H_
 
+#include <stdint.h>
+
 /*
  * Each instruction opcode may have many forms.
  *
@@ -22,6 +24,8 @@ option) any later version.
  *
  * - immediate, direct, indexed, extended: Opcode value for the corresponding
  *   mode.  If bits 8-15 are non-zero, they indicate an instruction page byte.
+ *   Relaxing branches use immediate for the short form and extended for the
+ *   long form.
  */
 
 struct opcode {
@@ -52,10 +56,21 @@ struct opcode {
 #define OPCODE_IMM8_MEM (10 << 3)
 #define OPCODE_REG_MEM  (11 << 3)
 #define OPCODE_TFM      (12 << 3)
+#define OPCODE_RELAX    (13 << 3)
 
 void opcode_init(void);
 void opcode_free_all(void);
 
 struct opcode const *opcode_by_name(const char *name);
 
+/* Call a function for each instruction available in the selected ISA. */
+void opcode_foreach(void (*func)(struct opcode const *, void *), void *data);
+
+/* Cycle count for the instruction encoded in code[].  Returns -1 if not
+ * recognised.  Otherwise returns the minimum count, and if extra is not NULL,
+ * sets *extra to the additional cycles an instruction may take (e.g. when a
+ * long branch is taken), or to -1 if there is no fixed limit (e.g. SYNC or
+ * TFM). */
+int opcode_cycles(uint8_t const *code, unsigned nbytes, int *extra);
+
 #endif
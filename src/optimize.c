@@ -0,0 +1,311 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+
+#include "asm6809.h"
+#include "assemble.h"
+#include "node.h"
+#include "opcode.h"
+#include "optimize.h"
+#include "program.h"
+#include "section.h"
+
+/* Longest instruction considered. */
+#define MAX_CODE (5)
+
+/* How many following instructions to examine when deciding whether the carry
+ * flag is needed. */
+#define CARRY_LOOKAHEAD (8)
+
+/* The previous instruction assembled in an optimised section. */
+
+static struct {
+	struct section const *section;
+	int pc;  // address following the instruction
+	unsigned nbytes;
+	uint8_t code[MAX_CODE];
+} prev;
+
+void optimize_reset(void) {
+	prev.section = NULL;
+}
+
+static _Bool have_prev(int pc) {
+	return prev.section == cur_section && prev.pc == pc;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Instructions that overwrite the carry flag without reading it, and those
+ * that leave it alone and always continue to the next instruction.  Both
+ * lists are sorted for bsearch(). */
+
+static char const * const carry_set[] = {
+	"adda", "addb", "addd", "adde", "addf", "addw",
+	"asl", "asla", "aslb", "asld", "asr", "asra", "asrb", "asrd",
+	"clr", "clra", "clrb", "clrd", "clre", "clrf", "clrw",
+	"cmpa", "cmpb", "cmpd", "cmpe", "cmpf", "cmps", "cmpu", "cmpw", "cmpx", "cmpy",
+	"com", "coma", "comb", "comd", "come", "comf", "comw",
+	"lsl", "lsla", "lslb", "lsld", "lsr", "lsra", "lsrb", "lsrd", "lsrw",
+	"mul",
+	"neg", "nega", "negb", "negd",
+	"suba", "subb", "subd", "sube", "subf", "subw",
+};
+
+static char const * const carry_unaffected[] = {
+	"abx",
+	"anda", "andb", "andd",
+	"bita", "bitb", "bitd",
+	"dec", "deca", "decb", "decd", "dece", "decf", "decw",
+	"eora", "eorb", "eord",
+	"inc", "inca", "incb", "incd", "ince", "incf", "incw",
+	"lda", "ldb", "ldd", "lde", "ldf", "ldq", "lds", "ldu", "ldw", "ldx", "ldy",
+	"leas", "leau", "leax", "leay",
+	"nop",
+	"ora", "orb", "ord",
+	"sex", "sexw",
+	"sta", "stb", "std", "ste", "stf", "stq", "sts", "stu", "stw", "stx", "sty",
+	"tst", "tsta", "tstb", "tstd", "tste", "tstf", "tstw",
+};
+
+static int name_cmp(void const *va, void const *vb) {
+	return strcmp(*(char const * const *)va, *(char const * const *)vb);
+}
+
+static _Bool name_in(char const *name, char const * const *list, size_t n) {
+	return bsearch(&name, list, n, sizeof(*list), name_cmp) != NULL;
+}
+
+/* True if the carry flag is overwritten before being read by the lines
+ * following the current one.  Anything not understood (pseudo-ops, macros,
+ * branches, the end of the file or macro) is assumed to read it. */
+
+static _Bool carry_unused(struct prog_ctx const *ctx) {
+	struct prog const *prog = ctx->prog;
+	unsigned ninstr = 0;
+	for (unsigned i = ctx->line_number; i < prog->nlines && ninstr < CARRY_LOOKAHEAD; i++) {
+		struct prog_line const *l = prog->lines[i];
+		if (!l->opcode)
+			continue;
+		if (node_type_of(l->opcode) != node_type_opcode)
+			return 0;
+		struct asm_op const *op = l->opcode->data.as_opcode.op;
+		if (!op)
+			return 0;
+		if (op->type == asm_op_skip)
+			continue;
+		if (op->type != asm_op_instruction)
+			return 0;
+		if (name_in(op->opcode->op, carry_set, ARRAY_N_ELEMENTS(carry_set)))
+			return 1;
+		if (!name_in(op->opcode->op, carry_unaffected, ARRAY_N_ELEMENTS(carry_unaffected)))
+			return 0;
+		ninstr++;
+	}
+	return 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Load immediate zero, and the equivalent clear. */
+
+static struct {
+	uint8_t code[4];
+	unsigned nbytes;
+	uint16_t clear;
+	_Bool hd6309;
+} const load_zero[] = {
+	{ { 0x86, 0x00 }, 2, 0x4f, 0 },              // LDA #0 -> CLRA
+	{ { 0xc6, 0x00 }, 2, 0x5f, 0 },              // LDB #0 -> CLRB
+	{ { 0xcc, 0x00, 0x00 }, 3, 0x104f, 1 },      // LDD #0 -> CLRD
+	{ { 0x10, 0x86, 0x00, 0x00 }, 4, 0x105f, 1 },  // LDW #0 -> CLRW
+	{ { 0x11, 0x86, 0x00 }, 3, 0x114f, 1 },      // LDE #0 -> CLRE
+	{ { 0x11, 0xc6, 0x00 }, 3, 0x115f, 1 },      // LDF #0 -> CLRF
+};
+
+static int rewrite_load_zero(uint8_t const *code, unsigned nbytes, struct prog_ctx const *ctx) {
+	for (unsigned i = 0; i < ARRAY_N_ELEMENTS(load_zero); i++) {
+		if (load_zero[i].nbytes != nbytes || memcmp(load_zero[i].code, code, nbytes) != 0)
+			continue;
+		if (load_zero[i].hd6309 && asm6809_options.isa != asm6809_isa_6309)
+			return 0;
+		if (!carry_unused(ctx))
+			return 0;
+		section_retract(nbytes);
+		section_emit_op(load_zero[i].clear);
+		return 1;
+	}
+	return 0;
+}
+
+/* Long branches, JMP and JSR to an address that a short branch can reach. */
+
+static int rewrite_branch(int pc, uint8_t const *code, unsigned nbytes) {
+	int target;
+	uint8_t short_op;
+	if (nbytes == 3 && (code[0] == 0x16 || code[0] == 0x17)) {
+		target = pc + 3 + (int16_t)((code[1] << 8) | code[2]);
+		short_op = (code[0] == 0x16) ? 0x20 : 0x8d;
+	} else if (nbytes == 3 && (code[0] == 0x7e || code[0] == 0xbd)) {
+		target = (code[1] << 8) | code[2];
+		short_op = (code[0] == 0x7e) ? 0x20 : 0x8d;
+	} else if (nbytes == 4 && code[0] == 0x10 && code[1] >= 0x21 && code[1] <= 0x2f) {
+		target = pc + 4 + (int16_t)((code[2] << 8) | code[3]);
+		short_op = code[1];
+	} else {
+		return 0;
+	}
+	if (section_branch_is_long())
+		return 0;
+	int rel = (int16_t)((target - (pc + 2)) & 0xffff);
+	if (rel < -128 || rel > 127) {
+		section_branch_set_long();
+		return 0;
+	}
+	section_retract(nbytes);
+	section_emit_op(short_op);
+	section_emit_uint8(rel);
+	return 1;
+}
+
+/* Store and load of the same register. */
+
+static struct {
+	uint16_t store;
+	uint16_t load;
+} const store_load[] = {
+	{ 0x97, 0x96 }, { 0xa7, 0xa6 }, { 0xb7, 0xb6 },  // A
+	{ 0xd7, 0xd6 }, { 0xe7, 0xe6 }, { 0xf7, 0xf6 },  // B
+	{ 0xdd, 0xdc }, { 0xed, 0xec }, { 0xfd, 0xfc },  // D
+	{ 0x9f, 0x9e }, { 0xaf, 0xae }, { 0xbf, 0xbe },  // X
+	{ 0xdf, 0xde }, { 0xef, 0xee }, { 0xff, 0xfe },  // U
+	{ 0x109f, 0x109e }, { 0x10af, 0x10ae }, { 0x10bf, 0x10be },  // Y
+	{ 0x10df, 0x10de }, { 0x10ef, 0x10ee }, { 0x10ff, 0x10fe },  // S
+};
+
+static uint16_t code_op(uint8_t const *code) {
+	if (code[0] == 0x10 || code[0] == 0x11)
+		return (code[0] << 8) | code[1];
+	return code[0];
+}
+
+/* Indexed modes that address the same location when repeated: constant
+ * offsets and accumulator offsets from a register, not indirect, PC relative
+ * or auto increment/decrement. */
+
+static _Bool stable_postbyte(uint8_t postbyte) {
+	if (!(postbyte & 0x80))
+		return 1;
+	switch (postbyte & 0x9f) {
+	case 0x84: case 0x85: case 0x86: case 0x88: case 0x89: case 0x8b:
+		return 1;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static _Bool redundant_load(uint8_t const *code, unsigned nbytes) {
+	if (!cur_section->optimize_loads || prev.nbytes != nbytes)
+		return 0;
+	uint16_t store = code_op(prev.code);
+	uint16_t load = code_op(code);
+	unsigned oplen = (load > 0xff) ? 2 : 1;
+	for (unsigned i = 0; i < ARRAY_N_ELEMENTS(store_load); i++) {
+		if (store_load[i].store != store || store_load[i].load != load)
+			continue;
+		if (memcmp(prev.code + oplen, code + oplen, nbytes - oplen) != 0)
+			return 0;
+		if ((load & 0xf0) == 0xa0 || (load & 0xf0) == 0xe0)
+			return stable_postbyte(code[oplen]);
+		return 1;
+	}
+	return 0;
+}
+
+/* TFR between two registers of the same size, neither of them PC. */
+
+static int tfr_size(unsigned reg) {
+	switch (reg) {
+	case 0: case 1: case 2: case 3: case 4: case 6: case 7:
+		return 16;
+	case 8: case 9: case 10: case 11: case 14: case 15:
+		return 8;
+	default:
+		break;
+	}
+	return -1;
+}
+
+static _Bool redundant_tfr(uint8_t const *code, unsigned nbytes) {
+	if (nbytes != 2 || code[0] != 0x1f || prev.nbytes != 2 || prev.code[0] != 0x1f)
+		return 0;
+	unsigned src = code[1] >> 4, dst = code[1] & 15;
+	int size = tfr_size(src);
+	if (size < 0 || size != tfr_size(dst))
+		return 0;
+	uint8_t swapped = (dst << 4) | src;
+	return prev.code[1] == code[1] || prev.code[1] == swapped;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+char const *optimize_instr(int old_pc, struct node const *args, struct prog_ctx const *ctx) {
+	struct section_span const *span = cur_section->span;
+	int nbytes = cur_section->pc - old_pc;
+	if (!span || nbytes <= 0 || nbytes > MAX_CODE || (unsigned)nbytes > span->size ||
+	    cur_section->pc != (int)(span->org + span->size)) {
+		optimize_reset();
+		return NULL;
+	}
+
+	/* Placeholder code for undefined arguments is never rewritten. */
+	int nargs = node_array_count(args);
+	struct node **arga = node_array_of(args);
+	_Bool defined = 1;
+	_Bool long_forced = 0;
+	for (int i = 0; i < nargs; i++) {
+		if (node_type_of(arga[i]) == node_type_undef)
+			defined = 0;
+		if (node_attr_of(arga[i]) == node_attr_16bit)
+			long_forced = 1;
+	}
+
+	uint8_t code[MAX_CODE];
+	memcpy(code, span->data + span->size - nbytes, nbytes);
+
+	char const *note = NULL;
+	if (defined) {
+		if (have_prev(old_pc) && (redundant_load(code, nbytes) || redundant_tfr(code, nbytes))) {
+			section_retract(nbytes);
+			return "peephole: redundant, removed";
+		}
+		if (rewrite_load_zero(code, nbytes, ctx))
+			note = "peephole: load of zero as clear";
+		else if (!long_forced && rewrite_branch(old_pc, code, nbytes))
+			note = "peephole: short branch";
+	}
+
+	/* Remember what was finally assembled */
+	prev.section = cur_section;
+	prev.pc = cur_section->pc;
+	prev.nbytes = cur_section->pc - old_pc;
+	memcpy(prev.code, span->data + span->size - prev.nbytes, prev.nbytes);
+	return note;
+}
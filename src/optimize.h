@@ -0,0 +1,53 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#ifndef ASM6809_OPTIMIZE_H_
+#define ASM6809_OPTIMIZE_H_
+
+/*
+ * Peephole optimisation of assembled instructions.
+ *
+ * In a section with optimisation enabled, each instruction is assembled as
+ * normal, then optimize_instr() examines the code just emitted and may
+ * rewrite it in place:
+ *
+ * - A load of immediate zero becomes a clear, if the carry flag it would
+ *   change is overwritten before being read by the source lines that follow.
+ *
+ * - A long branch, JMP or JSR becomes a short branch if its target is in
+ *   range.  As with relaxing branches, one that was ever out of range stays
+ *   long in later passes, so that code only grows.
+ *
+ * - A TFR repeating the effect of the previous one is removed.
+ *
+ * - Only with OPTIMIZE LOADS (cur_section->optimize_loads), a load from where
+ *   the previous instruction stored the same register is removed.  This is
+ *   wrong for hardware registers, so is not enabled by --optimize.
+ *
+ * Rewrites that look at the previous instruction only consider one assembled
+ * immediately before, with no label in between (see optimize_reset()).
+ */
+
+struct node;
+struct prog_ctx;
+
+/* Forget the previous instruction, e.g. because a label means control may
+ * arrive from elsewhere. */
+void optimize_reset(void);
+
+/* Examine the instruction just assembled from old_pc in the current section,
+ * with evaluated arguments args, rewriting it if possible.  ctx is used to
+ * look ahead at the source lines that follow.  Returns a note for the listing
+ * if the instruction was rewritten, otherwise NULL. */
+char const *optimize_instr(int old_pc, struct node const *args, struct prog_ctx const *ctx);
+
+#endif
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -13,10 +13,20 @@ option) any later version.
 #include "config.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif
+
+#include "xalloc.h"
+
+#include "asm6809.h"
+#include "atom.h"
 #include "error.h"
 #include "eval.h"
 #include "node.h"
@@ -35,7 +45,7 @@ static void write_single_binary(FILE *f, struct section_span *span) {
 /* Helper to figure out exec address. */
 
 static int get_exec_addr(void) {
-	struct node *n = symbol_try_get(".exec");
+	struct node *n = symbol_try_get(atom_new(".exec"));
 	int ret = -1;
 	if (n) {
 		if (n->data.as_int >= 0)
@@ -45,33 +55,22 @@ static int get_exec_addr(void) {
 	return ret;
 }
 
-/* Output format: Plain binary.  All coalesced into one big blob. */
+/* Each output format is written from spans coalesced either with padding
+ * (a single span) or without.  exec_addr is negative if none was given. */
 
-void output_binary(const char *filename) {
-	FILE *f = fopen(filename, "wb");
-	if (!f)
-		return;
+/* Output format: Plain binary.  All coalesced into one big blob. */
 
-	struct section *sect = section_coalesce_all(1);
+static void output_binary(FILE *f, struct section *sect, int exec_addr) {
+	(void)exec_addr;  // unused
 	if (sect->spans) {
 		struct section_span *span = sect->spans->data;
 		write_single_binary(f, span);
 	}
-
-	section_free(sect);
-	fclose(f);
 }
 
 /* Output format: DragonDOS binary. */
 
-void output_dragondos(const char *filename) {
-	int exec_addr = get_exec_addr();
-
-	FILE *f = fopen(filename, "wb");
-	if (!f)
-		return;
-
-	struct section *sect = section_coalesce_all(1);
+static void output_dragondos(FILE *f, struct section *sect, int exec_addr) {
 	struct section_span *span = NULL;
 	unsigned put = 0;
 	unsigned size = 0;
@@ -94,9 +93,6 @@ void output_dragondos(const char *filename) {
 	fputc(0xaa, f);
 	if (span)
 		write_single_binary(f, span);
-
-	section_free(sect);
-	fclose(f);
 }
 
 /* Output format: CoCo RSDOS binary. */
@@ -107,15 +103,7 @@ void output_dragondos(const char *filename) {
  * order.
  */
 
-void output_coco(const char *filename) {
-	int exec_addr = get_exec_addr();
-
-	FILE *f = fopen(filename, "wb");
-	if (!f)
-		return;
-
-	struct section *sect = section_coalesce_all(0);
-
+static void output_coco(FILE *f, struct section *sect, int exec_addr) {
 	for (struct slist *l = sect->spans; l; l = l->next) {
 		struct section_span *span = l->data;
 		unsigned put = span->put;
@@ -135,21 +123,119 @@ void output_coco(const char *filename) {
 	fputc(0x00, f);
 	fputc((exec_addr >> 8) & 0xff, f);
 	fputc(exec_addr  & 0xff, f);
+}
+
+/* Hex record formats are built up in a buffer, one record at a time, and
+ * written out a block at a time.  Each byte is converted with a pair of
+ * lookups in a table of hex digits. */
+
+#define HEX_BLOCK_SIZE (8192)
+
+/* Enough for the largest record: a leading character, three header fields
+ * and a checksum, 255 data bytes, and a newline. */
+#define HEX_RECORD_MAX (1 + 2*5 + 2*255 + 1)
 
-	section_free(sect);
-	fclose(f);
+static char const hex_digits[16] = "0123456789ABCDEF";
+
+struct hex_writer {
+	FILE *f;
+	size_t length;
+	char buf[HEX_BLOCK_SIZE];
+};
+
+static void hex_init(struct hex_writer *hw, FILE *f) {
+	hw->f = f;
+	hw->length = 0;
 }
 
-/* Output format: Motorola SREC. */
+static void hex_flush(struct hex_writer *hw) {
+	if (hw->length > 0)
+		fwrite(hw->buf, 1, hw->length, hw->f);
+	hw->length = 0;
+}
 
-void output_motorola_srec(const char *filename) {
-	int exec_addr = get_exec_addr();
+/* Returns a pointer to where the next record should be built. */
 
-	FILE *f = fopen(filename, "wb");
-	if (!f)
-		return;
+static char *hex_record_start(struct hex_writer *hw) {
+	if (hw->length + HEX_RECORD_MAX > sizeof(hw->buf))
+		hex_flush(hw);
+	return hw->buf + hw->length;
+}
 
-	struct section *sect = section_coalesce_all(0);
+static void hex_record_end(struct hex_writer *hw, char *p) {
+	*(p++) = '\n';
+	hw->length = p - hw->buf;
+}
+
+static char *hex_byte(char *p, unsigned v) {
+	*(p++) = hex_digits[(v >> 4) & 15];
+	*(p++) = hex_digits[v & 15];
+	return p;
+}
+
+/* Appends the data bytes, returning their sum in *sum. */
+
+static char *hex_data(char *p, uint8_t const *data, unsigned nbytes, unsigned *sum) {
+	unsigned s = 0;
+	for (unsigned i = 0; i < nbytes; i++) {
+		s += data[i];
+		p = hex_byte(p, data[i]);
+	}
+	*sum = s;
+	return p;
+}
+
+/* Maximum number of data bytes per record.  A Motorola record's length byte
+ * also counts the address and checksum, so it can hold fewer. */
+
+#define SREC_MAX_DATA (252)
+#define IHEX_MAX_DATA (255)
+
+static unsigned record_length(unsigned max) {
+	unsigned len = asm6809_options.record_length;
+	if (len == 0)
+		len = 32;
+	return (len > max) ? max : len;
+}
+
+static void srec_record(struct hex_writer *hw, char type, unsigned addr,
+			uint8_t const *data, unsigned nbytes) {
+	char *p = hex_record_start(hw);
+	unsigned sum;
+	addr &= 0xffff;
+	*(p++) = 'S';
+	*(p++) = type;
+	p = hex_byte(p, nbytes + 3);
+	p = hex_byte(p, addr >> 8);
+	p = hex_byte(p, addr);
+	p = hex_data(p, data, nbytes, &sum);
+	sum += nbytes + 3 + (addr >> 8) + (addr & 0xff);
+	p = hex_byte(p, ~sum);
+	hex_record_end(hw, p);
+}
+
+static void ihex_record(struct hex_writer *hw, unsigned type, unsigned addr,
+			uint8_t const *data, unsigned nbytes) {
+	char *p = hex_record_start(hw);
+	unsigned sum;
+	addr &= 0xffff;
+	*(p++) = ':';
+	p = hex_byte(p, nbytes);
+	p = hex_byte(p, addr >> 8);
+	p = hex_byte(p, addr);
+	p = hex_byte(p, type);
+	p = hex_data(p, data, nbytes, &sum);
+	sum += nbytes + (addr >> 8) + (addr & 0xff) + type;
+	p = hex_byte(p, ~sum + 1);
+	hex_record_end(hw, p);
+}
+
+/* Output format: Motorola SREC. */
+
+static void output_motorola_srec(FILE *f, struct section *sect, int exec_addr) {
+	struct hex_writer *hw = xmalloc(sizeof(*hw));
+	hex_init(hw, f);
+	unsigned max_nbytes = record_length(SREC_MAX_DATA);
 
 	for (struct slist *l = sect->spans; l; l = l->next) {
 		struct section_span *span = l->data;
@@ -157,42 +243,25 @@ void output_motorola_srec(const char *filename) {
 		unsigned size = span->size;
 		unsigned base = 0;
 		while (size > 0) {
-			unsigned nbytes = (size > 32) ? 32 : size;
-			unsigned sum = nbytes + 3 + (put >> 8) + (put & 0xff);
-			fprintf(f, "S1%02X%04X", nbytes + 3, put);
-			for (unsigned i = 0; i < nbytes; i++) {
-				fprintf(f, "%02X", (unsigned)span->data[base + i]);
-				sum += span->data[base + i];
-			}
-			sum = ~sum & 0xff;
-			fprintf(f, "%02X\n", sum);
+			unsigned nbytes = (size > max_nbytes) ? max_nbytes : size;
+			srec_record(hw, '1', put, span->data + base, nbytes);
 			put += nbytes;
 			base += nbytes;
 			size -= nbytes;
 		}
 	}
 
-	if (exec_addr >= 0) {
-		unsigned sum = exec_addr + (exec_addr >> 8) + 3;
-		fprintf(f, "S903%04X%02X\n", exec_addr, ~sum & 0xff);
-	} else {
-		fprintf(f, "S9030000FC\n");
-        }
-
-	section_free(sect);
-	fclose(f);
+	srec_record(hw, '9', (exec_addr >= 0) ? exec_addr : 0, NULL, 0);
+	hex_flush(hw);
+	free(hw);
 }
 
 /* Output format: Intel HEX. */
 
-void output_intel_hex(const char *filename) {
-	int exec_addr = get_exec_addr();
-
-	FILE *f = fopen(filename, "wb");
-	if (!f)
-		return;
-
-	struct section *sect = section_coalesce_all(0);
+static void output_intel_hex(FILE *f, struct section *sect, int exec_addr) {
+	struct hex_writer *hw = xmalloc(sizeof(*hw));
+	hex_init(hw, f);
+	unsigned max_nbytes = record_length(IHEX_MAX_DATA);
 
 	for (struct slist *l = sect->spans; l; l = l->next) {
 		struct section_span *span = l->data;
@@ -200,28 +269,168 @@ void output_intel_hex(const char *filename) {
 		unsigned size = span->size;
 		unsigned base = 0;
 		while (size > 0) {
-			unsigned nbytes = (size > 32) ? 32 : size;
-			unsigned sum = nbytes + put + (put >> 8);
-			fprintf(f, ":%02X%04X00", nbytes, put);
-			for (unsigned i = 0; i < nbytes; i++) {
-				fprintf(f, "%02X", (unsigned)span->data[base + i]);
-				sum += span->data[base + i];
-			}
-			sum = (~sum + 1) & 0xff;
-			fprintf(f, "%02X\n", sum);
+			unsigned nbytes = (size > max_nbytes) ? max_nbytes : size;
+			ihex_record(hw, 0x00, put, span->data + base, nbytes);
 			put += nbytes;
 			base += nbytes;
 			size -= nbytes;
 		}
 	}
 
-	if (exec_addr < 0) {
-		fprintf(f, ":00000001FF\n");
+	ihex_record(hw, 0x01, (exec_addr >= 0) ? exec_addr : 0, NULL, 0);
+	hex_flush(hw);
+	free(hw);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static struct {
+	const char *name;
+	void (*write)(FILE *, struct section *, int);
+	_Bool pad;
+} const output_formats[] = {
+	[output_format_binary] = { "bin", output_binary, 1 },
+	[output_format_dragondos] = { "dragondos", output_dragondos, 1 },
+	[output_format_coco] = { "coco", output_coco, 0 },
+	[output_format_motorola_srec] = { "srec", output_motorola_srec, 0 },
+	[output_format_intel_hex] = { "hex", output_intel_hex, 0 },
+};
+
+#define NUM_OUTPUT_FORMATS (sizeof(output_formats) / sizeof(output_formats[0]))
+
+int output_format_by_name(const char *name) {
+	for (unsigned i = 0; i < NUM_OUTPUT_FORMATS; i++) {
+		if (0 == strcmp(name, output_formats[i].name))
+			return i;
+	}
+	return -1;
+}
+
+/* Each output file is one job.  Errors raised by a job are collected with
+ * it, so that they are merged in order however the jobs were run. */
+
+struct output_job {
+	struct output_file const *output;
+	struct section *sect;
+	int exec_addr;
+	struct error_set *errors;
+};
+
+static void write_output(struct output_job *job) {
+	FILE *f = fopen(job->output->filename, "wb");
+	if (!f) {
+		error(error_type_fatal, "%s: %s", job->output->filename, strerror(errno));
+	} else {
+		output_formats[job->output->format].write(f, job->sect, job->exec_addr);
+		fclose(f);
+	}
+	job->errors = error_detach();
+}
+
+#ifdef HAVE_THREADS
+
+struct output_queue {
+	pthread_mutex_t lock;
+	struct output_job *jobs;
+	unsigned njobs;
+	unsigned next_job;
+};
+
+static void *output_worker(void *data) {
+	struct output_queue *queue = data;
+	for (;;) {
+		pthread_mutex_lock(&queue->lock);
+		unsigned i = queue->next_job;
+		if (i < queue->njobs)
+			queue->next_job++;
+		pthread_mutex_unlock(&queue->lock);
+		if (i >= queue->njobs)
+			break;
+		write_output(&queue->jobs[i]);
+	}
+	return NULL;
+}
+
+/* Returns false if no threads could be started, in which case nothing has
+ * been written. */
+
+static _Bool write_concurrently(struct output_job *jobs, unsigned njobs, unsigned nthreads) {
+	struct output_queue queue = {
+		.jobs = jobs,
+		.njobs = njobs,
+		.next_job = 0,
+	};
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_t *threads = xmalloc(nthreads * sizeof(*threads));
+	unsigned nstarted = 0;
+	for (unsigned i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[nstarted], NULL, output_worker, &queue) == 0)
+			nstarted++;
+	}
+	for (unsigned i = 0; i < nstarted; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&queue.lock);
+	return nstarted > 0;
+}
+
+#endif
+
+void output_write_all(struct slist *outputs, unsigned nthreads) {
+	unsigned njobs = slist_length(outputs);
+	if (njobs == 0)
+		return;
+
+	/* Spans are coalesced at most once for each padding mode.  The padded
+	 * form is derived from the unpadded one, so that any overlaps are only
+	 * reported once. */
+	_Bool need_pad[2] = { 0, 0 };
+	for (struct slist *l = outputs; l; l = l->next) {
+		struct output_file const *output = l->data;
+		need_pad[output_formats[output->format].pad] = 1;
+	}
+	struct section *sects[2] = { NULL, NULL };
+	if (need_pad[0]) {
+		sects[0] = section_coalesce_all(0);
+		if (need_pad[1])
+			sects[1] = section_coalesce_copy(sects[0], 1);
 	} else {
-		unsigned sum = exec_addr + (exec_addr >> 8) + 1;
-		fprintf(f, ":00%04X01%02X\n", exec_addr, (~sum + 1) & 0xff);
+		sects[1] = section_coalesce_all(1);
+	}
+
+	int exec_addr = get_exec_addr();
+	struct output_job *jobs = xmalloc(njobs * sizeof(*jobs));
+	unsigned j = 0;
+	for (struct slist *l = outputs; l; l = l->next) {
+		struct output_file const *output = l->data;
+		jobs[j].output = output;
+		jobs[j].sect = sects[output_formats[output->format].pad];
+		jobs[j].exec_addr = exec_addr;
+		jobs[j].errors = NULL;
+		j++;
+	}
+
+	/* Errors so far are set aside while the jobs run, and everything is
+	 * merged back in order afterwards. */
+	struct error_set *errors = error_detach();
+	_Bool done = 0;
+#ifdef HAVE_THREADS
+	if (nthreads > njobs)
+		nthreads = njobs;
+	if (nthreads > 1)
+		done = write_concurrently(jobs, njobs, nthreads);
+#else
+	(void)nthreads;
+#endif
+	if (!done) {
+		for (j = 0; j < njobs; j++)
+			write_output(&jobs[j]);
 	}
+	error_merge(errors);
+	for (j = 0; j < njobs; j++)
+		error_merge(jobs[j].errors);
+	free(jobs);
 
-	section_free(sect);
-	fclose(f);
+	section_free(sects[0]);
+	section_free(sects[1]);
 }
@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -17,19 +17,32 @@ option) any later version.
  * Write assembled data to a variety of output formats.
  */
 
-/* Output format: Binary. */
-void output_binary(const char *filename);
+struct slist;
 
-/* Output format: DragonDOS binary. */
-void output_dragondos(const char *filename);
+enum output_format {
+	output_format_binary,
+	output_format_dragondos,
+	output_format_coco,
+	output_format_motorola_srec,
+	output_format_intel_hex,
+};
 
-/* Output format: CoCo RSDOS binary. */
-void output_coco(const char *filename);
+/* An output file requested on the command line. */
 
-/* Output format: Motorola SREC. */
-void output_motorola_srec(const char *filename);
+struct output_file {
+	enum output_format format;
+	const char *filename;
+};
 
-/* Output format: Intel HEX. */
-void output_intel_hex(const char *filename);
+/* Returns the format named as by its long option (e.g. "srec"), or -1 if not
+ * recognised. */
+
+int output_format_by_name(const char *name);
+
+/* Write each output file in a list of struct output_file.  Section data is
+ * coalesced once per padding mode and shared between files.  If nthreads is
+ * greater than 1, files may be written concurrently. */
+
+void output_write_all(struct slist *outputs, unsigned nthreads);
 
 #endif
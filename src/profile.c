@@ -0,0 +1,378 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c-strcase.h"
+#include "xalloc.h"
+
+#include "error.h"
+#include "listing.h"
+#include "profile.h"
+#include "section.h"
+#include "sim.h"
+#include "slist.h"
+
+/* Labels are noted by their put address, as that is where the code is run. */
+
+struct profile_label {
+	char const *name;
+	int addr;
+	unsigned order;
+};
+
+/* Memory initialised by the script, or returned by successive reads. */
+struct profile_bytes {
+	unsigned addr;
+	unsigned nbytes;
+	unsigned next;
+	uint8_t *bytes;
+};
+
+static struct profile_label *labels = NULL;
+static unsigned nlabels = 0;
+static unsigned labels_allocated = 0;
+
+static struct slist *sets = NULL;
+static struct profile_bytes *inputs = NULL;
+static unsigned ninputs = 0;
+static uint8_t *input_index = NULL;  // by address: 1 + index into inputs[]
+static unsigned stack = 0;
+static unsigned long max_cycles = 100000000;
+
+/* Results of the last run, by address */
+static unsigned long *hits = NULL;
+static unsigned long *cycles = NULL;
+static unsigned start_addr;
+static enum sim_stop stop;
+
+/* Maximum number of input addresses in a script */
+#define MAX_INPUTS (255)
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void free_bytes(struct profile_bytes *b) {
+	free(b->bytes);
+	free(b);
+}
+
+void profile_free_all(void) {
+	free(labels);
+	labels = NULL;
+	nlabels = labels_allocated = 0;
+	slist_free_full(sets, (slist_free_func)free_bytes);
+	sets = NULL;
+	for (unsigned i = 0; i < ninputs; i++)
+		free(inputs[i].bytes);
+	free(inputs);
+	inputs = NULL;
+	ninputs = 0;
+	free(input_index);
+	input_index = NULL;
+	free(hits);
+	hits = NULL;
+	free(cycles);
+	cycles = NULL;
+}
+
+void profile_label(char const *name) {
+	if (nlabels >= labels_allocated) {
+		labels_allocated = labels_allocated ? labels_allocated * 2 : 256;
+		labels = xrealloc(labels, labels_allocated * sizeof(*labels));
+	}
+	struct profile_label *l = &labels[nlabels];
+	l->name = name;
+	l->addr = cur_section->put & 0xffff;
+	l->order = nlabels++;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Script parsing.  Numbers are as accepted on the command line. */
+
+static _Bool parse_number(char const *str, long *v) {
+	int base = 10;
+	if (*str == '$') {
+		base = 16;
+		str++;
+	} else if (*str == '@') {
+		base = 8;
+		str++;
+	} else if (*str == '%') {
+		base = 2;
+		str++;
+	} else if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+		base = 16;
+		str += 2;
+	}
+	if (!*str)
+		return 0;
+	char *end;
+	errno = 0;
+	*v = strtol(str, &end, base);
+	return errno == 0 && *end == 0;
+}
+
+static struct profile_bytes *new_bytes(unsigned addr, unsigned nbytes) {
+	struct profile_bytes *b = xmalloc(sizeof(*b));
+	b->addr = addr;
+	b->nbytes = nbytes;
+	b->next = 0;
+	b->bytes = xmalloc(nbytes + 1);
+	return b;
+}
+
+static _Bool script_line(char *line, char const *filename, unsigned lineno) {
+	char *args[257];
+	unsigned nargs = 0;
+	for (char *tok = strtok(line, " \t\r\n,"); tok; tok = strtok(NULL, " \t\r\n,")) {
+		if (nargs >= 257) {
+			error(error_type_fatal, "%s:%u: too many arguments", filename, lineno);
+			return 0;
+		}
+		args[nargs++] = tok;
+	}
+	if (nargs == 0)
+		return 1;
+
+	long v[257];
+	for (unsigned i = 1; i < nargs; i++) {
+		if (!parse_number(args[i], &v[i]) || v[i] < 0) {
+			error(error_type_fatal, "%s:%u: invalid number '%s'", filename, lineno, args[i]);
+			return 0;
+		}
+	}
+
+	_Bool bytes_cmd = (c_strcasecmp(args[0], "set") == 0 ||
+			   c_strcasecmp(args[0], "input") == 0);
+	if (bytes_cmd) {
+		if (nargs < 3) {
+			error(error_type_fatal, "%s:%u: %s needs an address and bytes", filename, lineno, args[0]);
+			return 0;
+		}
+		struct profile_bytes *b = new_bytes(v[1] & 0xffff, nargs - 2);
+		for (unsigned i = 2; i < nargs; i++)
+			b->bytes[i - 2] = v[i];
+		if (c_strcasecmp(args[0], "set") == 0) {
+			sets = slist_append(sets, b);
+			return 1;
+		}
+		if (ninputs >= MAX_INPUTS) {
+			error(error_type_fatal, "%s:%u: too many inputs", filename, lineno);
+			free_bytes(b);
+			return 0;
+		}
+		if (!input_index) {
+			input_index = xmalloc(0x10000);
+			memset(input_index, 0, 0x10000);
+		}
+		inputs = xrealloc(inputs, (ninputs + 1) * sizeof(*inputs));
+		inputs[ninputs++] = *b;
+		input_index[b->addr] = ninputs;
+		free(b);
+		return 1;
+	}
+
+	if (nargs != 2) {
+		error(error_type_fatal, "%s:%u: %s needs one argument", filename, lineno, args[0]);
+		return 0;
+	}
+	if (c_strcasecmp(args[0], "stack") == 0) {
+		stack = v[1] & 0xffff;
+	} else if (c_strcasecmp(args[0], "limit") == 0) {
+		max_cycles = v[1];
+	} else {
+		error(error_type_fatal, "%s:%u: unknown command '%s'", filename, lineno, args[0]);
+		return 0;
+	}
+	return 1;
+}
+
+_Bool profile_read_script(char const *filename) {
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		error(error_type_fatal, "%s: %s", filename, strerror(errno));
+		return 0;
+	}
+	char buf[1024];
+	unsigned lineno = 0;
+	_Bool ok = 1;
+	while (ok && fgets(buf, sizeof(buf), f)) {
+		lineno++;
+		buf[strcspn(buf, ";#")] = 0;
+		ok = script_line(buf, filename, lineno);
+	}
+	fclose(f);
+	return ok;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void trace(unsigned pc, unsigned ncycles, void *data) {
+	(void)data;
+	hits[pc]++;
+	cycles[pc] += ncycles;
+}
+
+static int read_input(unsigned addr, void *data) {
+	(void)data;
+	unsigned i = input_index[addr];
+	if (i == 0)
+		return -1;
+	struct profile_bytes *b = &inputs[i - 1];
+	uint8_t v = b->bytes[b->next];
+	if (b->next + 1 < b->nbytes)
+		b->next++;
+	return v;
+}
+
+static _Bool write_input(unsigned addr, uint8_t v, void *data) {
+	(void)v;
+	(void)data;
+	return input_index[addr] != 0;
+}
+
+void profile_run(struct section const *image, unsigned addr) {
+	if (!hits) {
+		hits = xmalloc(0x10000 * sizeof(*hits));
+		cycles = xmalloc(0x10000 * sizeof(*cycles));
+	}
+	memset(hits, 0, 0x10000 * sizeof(*hits));
+	memset(cycles, 0, 0x10000 * sizeof(*cycles));
+
+	sim_reset();
+	for (struct slist *l = image->spans; l; l = l->next) {
+		struct section_span const *span = l->data;
+		sim_load(span->put, span->data, span->size);
+	}
+	for (struct slist *l = sets; l; l = l->next) {
+		struct profile_bytes const *b = l->data;
+		sim_load(b->addr, b->bytes, b->nbytes);
+	}
+	struct sim_hooks h = {
+		.trace = trace,
+		.read = input_index ? read_input : NULL,
+		.write = input_index ? write_input : NULL,
+		.data = NULL,
+	};
+	sim_set_hooks(&h);
+	start_addr = addr;
+	stop = sim_call(addr, stack, max_cycles);
+	sim_set_hooks(NULL);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* A routine runs from a label to the next, by address. */
+
+struct profile_routine {
+	struct profile_label const *label;
+	unsigned long entries;
+	unsigned long instrs;
+	unsigned long cycles;
+};
+
+static int label_cmp(void const *va, void const *vb) {
+	struct profile_label const *a = va;
+	struct profile_label const *b = vb;
+	if (a->addr != b->addr)
+		return (a->addr > b->addr) ? 1 : -1;
+	return (a->order > b->order) - (a->order < b->order);
+}
+
+static int routine_cmp(void const *va, void const *vb) {
+	struct profile_routine const *a = va;
+	struct profile_routine const *b = vb;
+	if (a->cycles != b->cycles)
+		return (a->cycles > b->cycles) ? -1 : 1;
+	int pa = a->label ? a->label->addr : -1;
+	int pb = b->label ? b->label->addr : -1;
+	return (pa > pb) - (pa < pb);
+}
+
+static void print_stop(FILE *f, unsigned long total) {
+	fprintf(f, "Profile of $%04X: ", start_addr);
+	switch (stop) {
+	case sim_stop_return:
+		fprintf(f, "returned");
+		break;
+	case sim_stop_limit:
+		fprintf(f, "cycle limit reached at $%04X", sim_stop_pc());
+		break;
+	case sim_stop_illegal:
+		fprintf(f, "illegal instruction at $%04X", sim_stop_pc());
+		break;
+	case sim_stop_wait:
+		fprintf(f, "waiting for interrupt at $%04X", sim_stop_pc());
+		break;
+	case sim_stop_divzero:
+		fprintf(f, "division by zero at $%04X", sim_stop_pc());
+		break;
+	}
+	fprintf(f, " after %lu cycles.\n\n", total);
+}
+
+static void print_flat(FILE *f, unsigned long total) {
+	/* Sorted labels, keeping only the first at each address */
+	struct profile_label *sl = xmalloc((nlabels + 1) * sizeof(*sl));
+	memcpy(sl, labels, nlabels * sizeof(*sl));
+	qsort(sl, nlabels, sizeof(*sl), label_cmp);
+	unsigned nl = 0;
+	for (unsigned i = 0; i < nlabels; i++) {
+		if (nl == 0 || sl[nl - 1].addr != sl[i].addr)
+			sl[nl++] = sl[i];
+	}
+
+	/* Code before the first label is attributed to an extra entry */
+	struct profile_routine *r = xmalloc((nl + 1) * sizeof(*r));
+	memset(r, 0, (nl + 1) * sizeof(*r));
+	for (unsigned i = 0; i < nl; i++) {
+		r[i].label = &sl[i];
+		r[i].entries = hits[sl[i].addr];
+	}
+	unsigned ri = nl;
+	unsigned next = 0;
+	for (unsigned pc = 0; pc < 0x10000; pc++) {
+		while (next < nl && sl[next].addr <= (int)pc)
+			ri = next++;
+		r[ri].instrs += hits[pc];
+		r[ri].cycles += cycles[pc];
+	}
+	qsort(r, nl + 1, sizeof(*r), routine_cmp);
+
+	fprintf(f, "%6s %10s %10s %10s  %s\n", "%Time", "Cycles", "Entries", "Instrs", "Routine");
+	for (unsigned i = 0; i <= nl; i++) {
+		if (r[i].instrs == 0)
+			continue;
+		double pct = total ? (100.0 * r[i].cycles) / total : 0.0;
+		fprintf(f, "%6.2f %10lu %10lu %10lu  %s\n", pct, r[i].cycles,
+			r[i].entries, r[i].instrs, r[i].label ? r[i].label->name : "(no label)");
+	}
+	free(r);
+	free(sl);
+}
+
+void profile_print_report(FILE *f) {
+	if (!hits)
+		return;
+	unsigned long total = sim_cycles();
+	print_stop(f, total);
+	print_flat(f, total);
+	fprintf(f, "\n");
+	listing_print_profile(f, hits, cycles);
+}
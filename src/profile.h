@@ -0,0 +1,60 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#ifndef ASM6809_PROFILE_H_
+#define ASM6809_PROFILE_H_
+
+#include <stdio.h>
+
+/*
+ * Profile the assembled program on the simulator (see sim.h).
+ *
+ * When enabled (asm6809_options.profile), the address of each label that
+ * takes the value of PC is noted with profile_label() during each pass.
+ * Labels, counts and the annotated listing are all keyed by put address,
+ * which differs from PC for code assembled to run elsewhere (see PUT).
+ *
+ * Once assembly is complete, profile_run() loads the coalesced output into
+ * memory and calls a routine, counting the times each instruction is executed
+ * and the cycles spent there.  A script may initialise memory and stub out
+ * hardware registers:
+ *
+ *   set ADDR BYTE...     store bytes in memory before running
+ *   input ADDR BYTE...   successive reads of ADDR return each byte in turn,
+ *                        repeating the last; writes to ADDR are ignored
+ *   stack ADDR           initial stack pointer (default 0)
+ *   limit CYCLES         stop after this many cycles (default 100000000)
+ *
+ * Arguments may be separated by spaces or commas, and text following ';' or
+ * '#' is ignored.
+ *
+ * profile_print_report() writes a flat profile, with each routine running
+ * from one label to the next, then the listing annotated with counts.
+ */
+
+struct section;
+
+/* Free everything noted in the previous pass, and any script or results. */
+void profile_free_all(void);
+
+/* Note a label (an atom) taking the value of PC in the current section. */
+void profile_label(char const *name);
+
+/* Read a script.  Errors are reported, and return 0. */
+_Bool profile_read_script(char const *filename);
+
+/* Run the routine at addr with memory loaded from the coalesced output. */
+void profile_run(struct section const *image, unsigned addr);
+
+void profile_print_report(FILE *f);
+
+#endif
@@ -17,12 +17,19 @@ option) any later version.
 #include <string.h>
 #include <stdlib.h>
 
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif
+
 #include "xalloc.h"
 
 #include "asm6809.h"
+#include "atom.h"
+#include "cache.h"
 #include "dict.h"
 #include "error.h"
 #include "eval.h"
+#include "filemap.h"
 #include "node.h"
 #include "program.h"
 #include "register.h"
@@ -31,12 +38,12 @@ option) any later version.
 
 #include "grammar.h"
 
-struct prog *grammar_parse_file(const char *filename);
+struct prog *grammar_parse(const char *filename, struct filemap *map);
 
 static struct slist *files = NULL;
 static struct slist *macros = NULL;
 
-struct slist *prog_ctx_stack = NULL;
+THREAD_LOCAL struct slist *prog_ctx_stack = NULL;
 
 static struct dict *exports = NULL;
 
@@ -45,26 +52,169 @@ static struct dict *exports = NULL;
 struct prog *prog_new(enum prog_type type, const char *name) {
 	struct prog *new = xmalloc(sizeof(*new));
 	new->type = type;
-	new->name = xstrdup(name);
+	new->name = atom_new(name);
+	new->source = NULL;
+	new->nlines = 0;
+	new->lines_allocated = 0;
 	new->lines = NULL;
-	new->next_new_line = &new->lines;
 	return new;
 }
 
-struct prog *prog_new_file(const char *filename) {
+static struct prog *prog_file_by_name(const char *filename) {
+	filename = atom_new(filename);
 	for (struct slist *l = files; l; l = l->next) {
 		struct prog *f = l->data;
-		if (0 == strcmp(filename, f->name)) {
+		if (filename == f->name) {
 			return f;
 		}
 	}
-	struct prog *file = grammar_parse_file(filename);
+	return NULL;
+}
+
+/* Read and parse a file, or fetch the result from the parse cache.  Only files
+ * that parse without error are cached. */
+
+static struct prog *parse_file(const char *filename) {
+	struct filemap *map = filemap_open(filename);
+	if (!map) {
+		error(error_type_fatal, "file not found: %s", filename);
+		return NULL;
+	}
+	struct prog *prog = NULL;
+	if (asm6809_options.cache_dir)
+		prog = cache_load(filename, map);
+	if (!prog) {
+		struct error_mark mark;
+		error_mark(&mark);
+		prog = grammar_parse(filename, map);
+		if (asm6809_options.cache_dir && !*mark.next && error_level == mark.level)
+			cache_store(prog, map);
+	}
+	/* Line text points into the source, so keep it around if needed for
+	 * the listing. */
+	if (asm6809_options.listing_required)
+		prog->source = map;
+	else
+		filemap_close(map);
+	return prog;
+}
+
+struct prog *prog_new_file(const char *filename) {
+	struct prog *file = prog_file_by_name(filename);
+	if (file)
+		return file;
+	file = parse_file(filename);
 	if (!file)
 		return NULL;
 	files = slist_prepend(files, file);
 	return file;
 }
 
+#ifdef HAVE_THREADS
+
+/* Files are parsed by a pool of threads, each taking the next job from a
+ * shared list.  Errors raised are detached from the worker thread with the
+ * result, to be merged in order by the caller. */
+
+struct parse_job {
+	const char *filename;
+	struct prog *prog;
+	struct error_set *errors;
+};
+
+struct parse_queue {
+	pthread_mutex_t lock;
+	struct parse_job *jobs;
+	unsigned njobs;
+	unsigned next_job;
+};
+
+static void *parse_worker(void *data) {
+	struct parse_queue *queue = data;
+	for (;;) {
+		pthread_mutex_lock(&queue->lock);
+		unsigned i = queue->next_job;
+		if (i < queue->njobs)
+			queue->next_job++;
+		pthread_mutex_unlock(&queue->lock);
+		if (i >= queue->njobs)
+			break;
+		struct parse_job *job = &queue->jobs[i];
+		job->prog = parse_file(job->filename);
+		job->errors = error_detach();
+	}
+	return NULL;
+}
+
+static void parse_concurrently(struct parse_job *jobs, unsigned njobs, unsigned nthreads) {
+	struct parse_queue queue = {
+		.jobs = jobs,
+		.njobs = njobs,
+		.next_job = 0,
+	};
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_t *threads = xmalloc(nthreads * sizeof(*threads));
+	unsigned nstarted = 0;
+	for (unsigned i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[nstarted], NULL, parse_worker, &queue) == 0)
+			nstarted++;
+	}
+	/* If no threads could be started, do the work here */
+	if (nstarted == 0) {
+		struct error_set *errors = error_detach();
+		parse_worker(&queue);
+		error_merge(errors);
+	}
+	for (unsigned i = 0; i < nstarted; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&queue.lock);
+}
+
+#endif
+
+void prog_new_files(int nfiles, char * const *filenames, struct prog **progs, unsigned nthreads) {
+#ifdef HAVE_THREADS
+	/* One job per distinct file not already parsed */
+	struct parse_job *jobs = xmalloc(nfiles * sizeof(*jobs));
+	unsigned njobs = 0;
+	for (int i = 0; i < nfiles; i++) {
+		if (prog_file_by_name(filenames[i]))
+			continue;
+		unsigned j;
+		for (j = 0; j < njobs; j++) {
+			if (0 == strcmp(filenames[i], jobs[j].filename))
+				break;
+		}
+		if (j < njobs)
+			continue;
+		jobs[njobs].filename = filenames[i];
+		jobs[njobs].prog = NULL;
+		jobs[njobs].errors = NULL;
+		njobs++;
+	}
+	if (nthreads > njobs)
+		nthreads = njobs;
+	if (nthreads > 1) {
+		parse_concurrently(jobs, njobs, nthreads);
+		for (unsigned j = 0; j < njobs; j++) {
+			error_merge(jobs[j].errors);
+			if (jobs[j].prog)
+				files = slist_prepend(files, jobs[j].prog);
+		}
+		free(jobs);
+		for (int i = 0; i < nfiles; i++)
+			progs[i] = prog_file_by_name(filenames[i]);
+		return;
+	}
+	free(jobs);
+#else
+	(void)nthreads;
+#endif
+	for (int i = 0; i < nfiles; i++)
+		progs[i] = prog_new_file(filenames[i]);
+}
+
 struct prog *prog_new_macro(const char *name) {
 	if (prog_macro_by_name(name)) {
 		error(error_type_syntax, "attempt to redefined macro '%s'", name);
@@ -76,8 +226,10 @@ struct prog *prog_new_macro(const char *name) {
 }
 
 void prog_free(struct prog *f) {
-	slist_free_full(f->lines, (slist_free_func)prog_line_free);
-	free(f->name);
+	for (unsigned i = 0; i < f->nlines; i++)
+		prog_line_free(f->lines[i]);
+	free(f->lines);
+	filemap_close(f->source);
 	free(f);
 }
 
@@ -90,7 +242,7 @@ void prog_free_all(void) {
 struct prog *prog_macro_by_name(const char *name) {
 	for (struct slist *l = macros; l; l = l->next) {
 		struct prog *f = l->data;
-		if (0 == strcmp(name, f->name)) {
+		if (name == f->name) {
 			return f;
 		}
 	}
@@ -107,6 +259,8 @@ struct prog_line *prog_line_new(struct node *label, struct node *opcode, struct
 	l->opcode = opcode;
 	l->args = args;
 	l->text = NULL;
+	l->text_len = 0;
+	l->cond_skip = 0;
 	return l;
 }
 
@@ -122,8 +276,6 @@ void prog_line_free(struct prog_line *line) {
 	node_free(line->label);
 	node_free(line->opcode);
 	node_free(line->args);
-	if (line->text)
-		free(line->text);
 	free(line);
 }
 
@@ -134,13 +286,12 @@ struct prog_line *prog_line_ref(struct prog_line *line) {
 	return line;
 }
 
-void prog_line_set_text(struct prog_line *line, char *text) {
-	if (!asm6809_options.listing_required) {
-		free(text);
+void prog_line_set_text(struct prog_line *line, char const *text, unsigned length) {
+	if (!asm6809_options.listing_required)
 		return;
-	}
 	if (line) {
 		line->text = text;
+		line->text_len = length;
 	}
 }
 
@@ -149,7 +300,6 @@ void prog_line_set_text(struct prog_line *line, char *text) {
 struct prog_ctx *prog_ctx_new(struct prog *prog) {
 	struct prog_ctx *new = xmalloc(sizeof(*new));
 	new->prog = prog;
-	new->line = NULL;
 	new->line_number = 0;
 	prog_ctx_stack = slist_prepend(prog_ctx_stack, new);
 	return new;
@@ -174,32 +324,35 @@ void prog_ctx_add_line(struct prog_ctx *ctx, struct prog_line *line) {
 	assert(ctx != NULL);
 	struct prog *prog = ctx->prog;
 	assert(prog != NULL);
-	assert(prog->next_new_line != NULL);
-	*(prog->next_new_line) = slist_append(*prog->next_new_line, line);
-	prog->next_new_line = &(*prog->next_new_line)->next;
+	if (prog->nlines >= prog->lines_allocated) {
+		prog->lines_allocated = prog->lines_allocated ? prog->lines_allocated * 2 : 64;
+		prog->lines = xrealloc(prog->lines, prog->lines_allocated * sizeof(*prog->lines));
+	}
+	prog->lines[prog->nlines++] = line;
 	ctx->line_number++;
 }
 
 struct prog_line *prog_ctx_next_line(struct prog_ctx *ctx) {
 	assert(ctx != NULL);
 	assert(ctx->prog != NULL);
-	if (ctx->line_number == 0) {
-		ctx->line = ctx->prog->lines;
-		ctx->line_number++;
-	} else if (ctx->line) {
-		ctx->line = ctx->line->next;
-		ctx->line_number++;
-	}
-	return ctx->line->data;
+	assert(ctx->line_number < ctx->prog->nlines);
+	return ctx->prog->lines[ctx->line_number++];
+}
+
+/* Skip lines without returning them. */
+
+void prog_ctx_skip(struct prog_ctx *ctx, unsigned nlines) {
+	assert(ctx != NULL);
+	assert(ctx->prog != NULL);
+	assert(ctx->line_number + nlines <= ctx->prog->nlines);
+	ctx->line_number += nlines;
 }
 
 _Bool prog_ctx_end(struct prog_ctx *ctx) {
 	assert(ctx != NULL);
-	if (!ctx->prog || !ctx->prog->lines)
+	if (!ctx->prog)
 		return 1;
-	if (ctx->line_number == 0 || ctx->line->next)
-		return 0;
-	return 1;
+	return ctx->line_number >= ctx->prog->nlines;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -210,9 +363,9 @@ _Bool prog_ctx_end(struct prog_ctx *ctx) {
 
 void prog_export(const char *name) {
 	if (!exports) {
-		exports = dict_new_full(dict_str_hash, dict_str_equal, free, NULL);
+		exports = dict_new(atom_dict_hash, dict_direct_equal);
 	}
-	dict_add(exports, xstrdup(name));
+	dict_add(exports, (void *)name);
 }
 
 void prog_free_exports(void) {
@@ -260,8 +413,8 @@ static void print_exported(const char *key, void *value, FILE *f) {
 	struct prog *macro = prog_macro_by_name(key);
 	if (macro) {
 		fprintf(f, "%s\tmacro\n", key);
-		for (struct slist *l = macro->lines; l; l = l->next) {
-			struct prog_line *line = l->data;
+		for (unsigned i = 0; i < macro->nlines; i++) {
+			struct prog_line *line = macro->lines[i];
 			if (!line)
 				continue;
 			node_print(f, line->label);
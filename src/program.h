@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -26,6 +26,12 @@ option) any later version.
  * creating a context with prog_ctx_new() and using prog_ctx_next_line().  Free
  * that context when done.  The context stack is used in error reporting.
  *
+ * Conditional assembly directives (IF, ELSIF, ELSE) record in cond_skip how
+ * many lines ahead the next branch at the same level is (ELSIF, ELSE or
+ * ENDIF), so that excluded code can be skipped with prog_ctx_skip() without
+ * examining each line.  Zero if not known to be safe to skip, e.g. if the
+ * lines in between contain part of a macro definition.
+ *
  * Tracking exported labels (symbols & macros) is done here too.
  */
 
@@ -33,6 +39,7 @@ option) any later version.
 
 #include <stdio.h>
 
+struct filemap;
 struct node;
 struct slist;
 
@@ -46,42 +53,50 @@ struct prog_line {
 	struct node *label;
 	struct node *opcode;
 	struct node *args;  /* must be of type node_arglist */
-	char *text;
+	char const *text;  /* not NUL terminated, points into source */
+	unsigned text_len;
+	unsigned cond_skip;
 };
 
 struct prog {
 	enum prog_type type;
-	char *name;
+	char const *name;  // atom
+	struct filemap *source;  // kept while line text is needed
 	unsigned pass;  // only used to detect macro redefinitions
-	struct slist *lines;
-	struct slist **next_new_line;
+	unsigned nlines;
+	unsigned lines_allocated;
+	struct prog_line **lines;
 };
 
 struct prog_ctx {
 	struct prog *prog;
-	struct slist *line;
-	unsigned line_number;
+	unsigned line_number;  // also index of next line
 };
 
-/* The first element on this stack is the current context. */
-extern struct slist *prog_ctx_stack;
+/* The first element on this stack is the current context.  Each thread has its
+ * own stack. */
+extern THREAD_LOCAL struct slist *prog_ctx_stack;
 
 struct prog *prog_new(enum prog_type type, const char *name);
 struct prog *prog_new_file(const char *filename);
+/* As prog_new_file() for each of a list of files, parsing up to nthreads of
+ * them at a time.  Any errors are reported in list order. */
+void prog_new_files(int nfiles, char * const *filenames, struct prog **progs, unsigned nthreads);
 struct prog *prog_new_macro(const char *name);
 void prog_free(struct prog *f);
 void prog_free_all(void);  // for tidying up
-struct prog *prog_macro_by_name(const char *name);
+struct prog *prog_macro_by_name(const char *name);  // name is an atom
 
 struct prog_line *prog_line_new(struct node *label, struct node *opcode, struct node *args);
 void prog_line_free(struct prog_line *line);
 struct prog_line *prog_line_ref(struct prog_line *line);
-void prog_line_set_text(struct prog_line *line, char *text);
+void prog_line_set_text(struct prog_line *line, char const *text, unsigned length);
 
 struct prog_ctx *prog_ctx_new(struct prog *prog);
 void prog_ctx_free(struct prog_ctx *ctx);
 void prog_ctx_add_line(struct prog_ctx *ctx, struct prog_line *line);
 struct prog_line *prog_ctx_next_line(struct prog_ctx *ctx);
+void prog_ctx_skip(struct prog_ctx *ctx, unsigned nlines);
 _Bool prog_ctx_end(struct prog_ctx *ctx);
 
 void prog_export(const char *name);
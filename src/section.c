@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -22,6 +22,8 @@ option) any later version.
 #include "xalloc.h"
 
 #include "asm6809.h"
+#include "atom.h"
+#include "depend.h"
 #include "dict.h"
 #include "error.h"
 #include "opcode.h"
@@ -49,14 +51,7 @@ static struct section_span *section_span_new(void) {
 	return new;
 }
 
-static struct section_span *section_span_ref(struct section_span *span) {
-	if (!span)
-		return NULL;
-	span->ref++;
-	return span;
-}
-
-static void section_span_free(struct section_span *span) {
+void section_span_free(struct section_span *span) {
 	if (!span)
 		return;
 	if (span->ref == 0) {
@@ -74,6 +69,7 @@ static void section_span_free(struct section_span *span) {
 
 static struct section *section_new(void) {
 	struct section *sect = xmalloc(sizeof(*sect));
+	sect->name = NULL;
 	sect->spans = NULL;
 	sect->span = NULL;
 	sect->local_labels = symbol_local_table_new();
@@ -84,6 +80,12 @@ static struct section *section_new(void) {
 	sect->dp = asm6809_options.setdp;
 	sect->last_pc = 0;
 	sect->last_put = 0;
+	sect->last_used = 0;
+	sect->depend = NULL;
+	sect->nlong_branches = 0;
+	sect->long_branches = NULL;
+	sect->optimize = 0;
+	sect->optimize_loads = 0;
 	return sect;
 }
 
@@ -92,6 +94,8 @@ void section_free(struct section *sect) {
 		return;
 	dict_destroy(sect->local_labels);
 	slist_free_full(sect->spans, (slist_free_func)section_span_free);
+	depend_cache_free(sect->depend);
+	free(sect->long_branches);
 	free(sect);
 }
 
@@ -106,13 +110,13 @@ void section_free_all(void) {
 
 void section_set(const char *name, unsigned pass) {
 	if (!sections)
-		sections = dict_new_full(dict_str_hash, dict_str_equal, free, (Hash_data_freer)section_free);
+		sections = dict_new_full(atom_dict_hash, dict_direct_equal, NULL, (Hash_data_freer)section_free);
 
 	struct section *next_section = dict_lookup(sections, name);
 	if (!next_section) {
 		next_section = section_new();
-		char *key = xstrdup(name);
-		dict_insert(sections, key, next_section);
+		next_section->name = name;
+		dict_insert(sections, (void *)name, next_section);
 	}
 
 	if (next_section->pass != pass) {
@@ -124,12 +128,15 @@ void section_set(const char *name, unsigned pass) {
 		if (cur_section && cur_section->pass == pass) {
 			next_section->pc = cur_section->last_pc;
 			next_section->put = cur_section->last_put;
+			cur_section->last_used = 1;
 		} else {
 			next_section->pc = 0;
 			next_section->put = 0;
 		}
 		next_section->pass = pass;
 		next_section->dp = asm6809_options.setdp;
+		next_section->optimize = asm6809_options.optimize;
+		next_section->optimize_loads = 0;
 		next_section->line_number = 0;
 	}
 
@@ -146,7 +153,8 @@ static void verify_section(void *key, void *value, void *data) {
 	if (sect->last_pc != sect->pc) {
 		sect->last_pc = sect->pc;
 		sect->last_put = sect->put;
-		error(error_type_inconsistent, NULL);
+		if (sect->last_used)
+			error(error_type_inconsistent, NULL);
 	}
 }
 
@@ -154,77 +162,215 @@ void section_finish_pass(void) {
 	dict_foreach(sections, verify_section, NULL);
 }
 
+_Bool section_branch_is_long(void) {
+	unsigned line_number = cur_section->line_number;
+	if (line_number >= cur_section->nlong_branches)
+		return 0;
+	return cur_section->long_branches[line_number];
+}
+
+void section_branch_set_long(void) {
+	unsigned line_number = cur_section->line_number;
+	if (line_number >= cur_section->nlong_branches) {
+		unsigned n = cur_section->nlong_branches ? cur_section->nlong_branches : 256;
+		while (n <= line_number)
+			n *= 2;
+		cur_section->long_branches = xrealloc(cur_section->long_branches, n);
+		memset(cur_section->long_branches + cur_section->nlong_branches, 0,
+		       n - cur_section->nlong_branches);
+		cur_section->nlong_branches = n;
+	}
+	cur_section->long_branches[line_number] = 1;
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-static int span_cmp(struct section_span *a, struct section_span *b) {
+/* Coalescing works on an array of spans sorted by put address, which is
+ * divided into regions in one linear pass.  Each region becomes one output
+ * span, allocated once at its final size.  Without padding, a region is a run
+ * of spans that touch or overlap.  With padding, everything is one region,
+ * and gaps are zero filled. */
+
+static int span_cmp_put(void const *va, void const *vb) {
+	struct section_span const *a = *(struct section_span * const *)va;
+	struct section_span const *b = *(struct section_span * const *)vb;
 	if (a->put < b->put) return -1;
 	if (a->put > b->put) return 1;
 	if (a->sequence < b->sequence) return -1;
-	return 1;
-}
-
-/* TODO: When merging spans this should create a new span and free the old
- * ones.  At the moment it breaks reference counting... */
-
-void section_coalesce(struct section *sect, _Bool sort, _Bool pad) {
-
-	struct slist *spans = slist_copy(sect->spans);
-	if (sort)
-		spans = slist_sort(spans, (slist_cmp_func)span_cmp);
-	for (struct slist *l = spans; l && l->next; l = l->next) {
-		do {
-			struct slist *ln = l->next;
-			struct section_span *span = l->data;
-			struct section_span *nspan = ln->data;
-			unsigned span_end = span->put + span->size;
-
-			if (span_end > nspan->put) {
-				error(error_type_data, "data at $%04X overlaps data at $%04X", span->put, nspan->put);
-				// truncate earlier span
-				span->size -= (span_end - nspan->put);
-			} else if (pad && span_end < nspan->put) {
-				unsigned npad = nspan->put - span_end;
-				if ((span->size + npad) > span->allocated) {
-					span->allocated = span->size + npad;
-					span->data = xrealloc(span->data, span->allocated);
-				}
-				memset(span->data + span->size, 0, npad);
-				span->size = span->size + npad;
-				span_end = span->put + span->size;
+	return (a->sequence > b->sequence);
+}
+
+static int span_cmp_sequence(void const *va, void const *vb) {
+	struct section_span const *a = *(struct section_span * const *)va;
+	struct section_span const *b = *(struct section_span * const *)vb;
+	if (a->sequence < b->sequence) return -1;
+	return (a->sequence > b->sequence);
+}
+
+/* Data is copied into a region in sequence order, so where spans overlap, the
+ * one emitted later wins. */
+
+static struct section_span *coalesce_region(struct section_span **spans, unsigned nspans,
+					    unsigned start, unsigned end) {
+	struct section_span *region = xmalloc(sizeof(*region));
+	region->ref = 1;
+	region->sequence = spans[0]->sequence;
+	region->org = spans[0]->org;
+	region->put = start;
+	region->size = end - start;
+	region->allocated = region->size;
+	region->data = xmalloc(region->size);
+	if (nspans > 1) {
+		/* Zero any gaps while the spans are still in put order */
+		unsigned filled = start;
+		for (unsigned i = 0; i < nspans; i++) {
+			if (spans[i]->put > filled)
+				memset(region->data + (filled - start), 0, spans[i]->put - filled);
+			if (spans[i]->put + spans[i]->size > filled)
+				filled = spans[i]->put + spans[i]->size;
+		}
+		qsort(spans, nspans, sizeof(*spans), span_cmp_sequence);
+	}
+	for (unsigned i = 0; i < nspans; i++) {
+		memcpy(region->data + (spans[i]->put - start), spans[i]->data, spans[i]->size);
+	}
+	return region;
+}
+
+/* Reports each range of addresses written more than once.  A byte is in such
+ * a range if the span starting there (in put order) is not the first to cover
+ * it. */
+
+static void report_overlaps(struct section_span * const *spans, unsigned nspans) {
+	unsigned covered = 0;
+	unsigned lo = 0, hi = 0;
+	for (unsigned i = 0; i < nspans; i++) {
+		unsigned put = spans[i]->put;
+		unsigned end = put + spans[i]->size;
+		if (i > 0 && put < covered) {
+			unsigned ohi = (end < covered) ? end : covered;
+			if (lo < hi && put > hi) {
+				error(error_type_data, "overlapping data at $%04X-$%04X", lo, hi - 1);
+				lo = hi;
 			}
-			if (span_end == nspan->put) {
-				if ((span->size + nspan->size) > span->allocated) {
-					span->allocated = span->size + nspan->size;
-					span->data = xrealloc(span->data, span->allocated);
-				}
-				memcpy(span->data + span->size, nspan->data, nspan->size);
-				span->size += nspan->size;
-				l->next = l->next->next;
-				section_span_free(nspan);
-				slist_free_1(ln);
-			} else {
+			if (lo >= hi)
+				lo = put;
+			if (ohi > hi)
+				hi = ohi;
+		}
+		if (i == 0 || end > covered)
+			covered = end;
+	}
+	if (lo < hi)
+		error(error_type_data, "overlapping data at $%04X-$%04X", lo, hi - 1);
+}
+
+/* Coalesce a sorted array of spans into a new list of spans.  Empty spans are
+ * dropped. */
+
+static struct slist *coalesce_spans(struct section_span **spans, unsigned nspans, _Bool pad) {
+	unsigned n = 0;
+	for (unsigned i = 0; i < nspans; i++) {
+		if (spans[i]->size > 0)
+			spans[n++] = spans[i];
+	}
+	nspans = n;
+
+	report_overlaps(spans, nspans);
+
+	struct slist *regions = NULL;
+	unsigned first = 0;
+	while (first < nspans) {
+		unsigned start = spans[first]->put;
+		unsigned end = start + spans[first]->size;
+		unsigned last;
+		for (last = first + 1; last < nspans; last++) {
+			if (!pad && spans[last]->put > end)
 				break;
-			}
-		} while (l->next);
+			if (spans[last]->put + spans[last]->size > end)
+				end = spans[last]->put + spans[last]->size;
+		}
+		regions = slist_prepend(regions, coalesce_region(spans + first, last - first, start, end));
+		first = last;
 	}
-	slist_free(sect->spans);
-	sect->spans = spans;
+	return slist_reverse(regions);
+}
+
+static struct slist *coalesce_list(struct slist *list, _Bool pad) {
+	unsigned nspans = slist_length(list);
+	struct section_span **spans = xmalloc((nspans + 1) * sizeof(*spans));
+	unsigned i = 0;
+	for (struct slist *l = list; l; l = l->next)
+		spans[i++] = l->data;
+	qsort(spans, nspans, sizeof(*spans), span_cmp_put);
+	struct slist *regions = coalesce_spans(spans, nspans, pad);
+	free(spans);
+	return regions;
+}
+
+static void count_spans(void *k, struct section *s, unsigned *nspans) {
+	(void)k;  // unused
+	*nspans += slist_length(s->spans);
+}
+
+static void collect_spans(void *k, struct section *s, struct section_span ***next) {
+	(void)k;  // unused
+	for (struct slist *l = s->spans; l; l = l->next)
+		*((*next)++) = l->data;
 }
 
 struct section *section_coalesce_all(_Bool pad) {
 	struct section *sect = section_new();
 
-	struct slist *section_list = dict_get_values(sections);
-	for (struct slist *l = section_list; l; l = l->next) {
-		struct section *s = l->data;
-		sect->spans = slist_concat(sect->spans, slist_copy_deep(s->spans, (slist_copy_func)section_span_ref, NULL));
-	}
-	slist_free(section_list);
+	unsigned nspans = 0;
+	dict_foreach(sections, (dict_iter_func)count_spans, &nspans);
+	struct section_span **spans = xmalloc((nspans + 1) * sizeof(*spans));
+	struct section_span **next = spans;
+	dict_foreach(sections, (dict_iter_func)collect_spans, &next);
+
+	qsort(spans, nspans, sizeof(*spans), span_cmp_put);
+	sect->spans = coalesce_spans(spans, nspans, pad);
+	free(spans);
+	return sect;
+}
 
-	section_coalesce(sect, 1, pad);
+struct section *section_coalesce_copy(struct section const *src, _Bool pad) {
+	struct section *sect = section_new();
+	sect->spans = coalesce_list(src->spans, pad);
 	return sect;
 }
 
+struct span_collect {
+	unsigned pass;
+	unsigned nspans;
+	struct section_span **spans;
+};
+
+static void collect_pass_spans(void *k, struct section *s, struct span_collect *c) {
+	(void)k;  // unused
+	if (s->pass != c->pass)
+		return;
+	for (struct slist *l = s->spans; l; l = l->next) {
+		if (c->spans)
+			c->spans[c->nspans] = l->data;
+		c->nspans++;
+	}
+}
+
+void section_foreach_span(unsigned pass, void (*func)(struct section_span const *, void *), void *data) {
+	if (!sections)
+		return;
+	struct span_collect c = { .pass = pass, .nspans = 0, .spans = NULL };
+	dict_foreach(sections, (dict_iter_func)collect_pass_spans, &c);
+	c.spans = xmalloc((c.nspans + 1) * sizeof(*c.spans));
+	c.nspans = 0;
+	dict_foreach(sections, (dict_iter_func)collect_pass_spans, &c);
+	qsort(c.spans, c.nspans, sizeof(*c.spans), span_cmp_sequence);
+	for (unsigned i = 0; i < c.nspans; i++)
+		func(c.spans[i], data);
+	free(c.spans);
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
 /*
@@ -235,7 +381,11 @@ struct section *section_coalesce_all(_Bool pad) {
 #define next_put(s) ((s)->put + (s)->size)
 #define next_pc(s) ((int)((s)->org + (s)->size))
 
-static void section_emit(uint8_t const *buf, int nbytes) {
+/* Make room for nbytes at the end of the current span (creating a new span if
+ * necessary), advance PC and return a pointer to the space.  Span data grows
+ * geometrically, so emitting byte by byte doesn't mean a realloc each time. */
+
+static uint8_t *section_reserve(int nbytes) {
 	assert(cur_section != NULL);
 	struct section_span *span = cur_section->span;
 
@@ -257,25 +407,37 @@ static void section_emit(uint8_t const *buf, int nbytes) {
 	cur_section->put += nbytes;
 	cur_section->pc += nbytes;
 
-	if (cur_section->pc >= (int)(span->org + span->allocated)) {
-		span->allocated += 128;
+	if (span->size + nbytes > span->allocated) {
+		unsigned allocated = span->allocated ? span->allocated : 128;
+		while (span->size + nbytes > allocated)
+			allocated *= 2;
+		span->allocated = allocated;
 		span->data = xrealloc(span->data, span->allocated);
 	}
 
-	if (!buf) {
-		memset(&span->data[span->size], 0, nbytes);
-	} else for (int i = 0; i < nbytes; i++) {
-		memcpy(&span->data[span->size], buf, nbytes);
-	}
+	uint8_t *data = &span->data[span->size];
 	span->size += nbytes;
 
 	if (cur_section->pc > 0x10000) {
 		error(error_type_out_of_range, "assembling beyond addressable memory");
 	}
+	return data;
+}
+
+static void section_emit(uint8_t const *buf, int nbytes) {
+	if (nbytes <= 0)
+		return;
+	memcpy(section_reserve(nbytes), buf, nbytes);
 }
 
 void section_emit_pad(int nbytes) {
-	section_emit(NULL, nbytes);
+	section_emit_fill(0, nbytes);
+}
+
+void section_emit_fill(uint8_t v, int nbytes) {
+	if (nbytes <= 0)
+		return;
+	memset(section_reserve(nbytes), v, nbytes);
 }
 
 void section_emit_op(uint16_t op) {
@@ -298,8 +460,22 @@ void section_emit_uint32(uint32_t v) {
 	section_emit(buf, 4);
 }
 
+void section_emit_buf(uint8_t const *buf, int nbytes) {
+	section_emit(buf, nbytes);
+}
+
 void section_skip(int nbytes) {
 	assert(cur_section != NULL);
 	cur_section->put += nbytes;
 	cur_section->pc += nbytes;
 }
+
+void section_retract(int nbytes) {
+	assert(cur_section != NULL);
+	struct section_span *span = cur_section->span;
+	assert(span != NULL && span->size >= (unsigned)nbytes);
+	assert(cur_section->pc == next_pc(span) && cur_section->put == next_put(span));
+	span->size -= nbytes;
+	cur_section->put -= nbytes;
+	cur_section->pc -= nbytes;
+}
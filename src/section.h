@@ -1,7 +1,7 @@
 /*
 
 asm6809, a Motorola 6809 cross assembler
-Copyright 2013-2017 Ciaran Anscomb
+Copyright 2013-2018 Ciaran Anscomb
 
 This program is free software: you can redistribute it and/or modify it
 under the terms of the GNU General Public License as published by the
@@ -17,6 +17,8 @@ option) any later version.
 
 #include "dict.h"
 
+struct depend_cache;
+
 /*
  * A section span is one region of consecutive data.  Reference counted so that
  * meta-sections can be created combining other sections, and coelesced.
@@ -46,6 +48,8 @@ struct section_span {
  * created by section_set().  Later, unnamed sections are created in order to
  * coalesce span data for output.  Other important data tracked per section:
  *
+ * - name: The name of a named section (an atom), otherwise NULL.
+ *
  * - local_labels: A hash passed to symbol_local_*() to manipulate local
  *   labels.
  *
@@ -69,9 +73,25 @@ struct section_span {
  * - last_pc, last_put: Maintained across passes, when switching sections the
  *   new one will default to coming after the last address in the previous.
  *   Obviously these can be overridden with ORG or PUT.
+ *
+ * - last_used: Set once another section has been placed after this one.  Only
+ *   then does a change to last_pc need another pass to settle.
+ *
+ * - depend: Maintained across passes, records of each line's dependencies and
+ *   output used to skip re-evaluating unchanged lines.  See depend.h.
+ *
+ * - long_branches: Maintained across passes, flags (indexed by line number)
+ *   each relaxing branch that has needed its long form.
+ *
+ * - optimize: Peephole optimisation enabled, see optimize.h.  Reset to the
+ *   command line default at the start of each pass, changed by OPTIMIZE.
+ *
+ * - optimize_loads: Removal of redundant loads also enabled.  Only set by
+ *   OPTIMIZE LOADS.
  */
 
 struct section {
+	char const *name;
 	struct slist *spans;
 	struct section_span *span;
 	struct dict *local_labels;
@@ -82,6 +102,12 @@ struct section {
 	unsigned dp;
 	int last_pc;
 	unsigned last_put;
+	_Bool last_used;
+	struct depend_cache *depend;
+	unsigned nlong_branches;
+	uint8_t *long_branches;
+	_Bool optimize;
+	_Bool optimize_loads;
 };
 
 /* Current section made available */
@@ -97,7 +123,12 @@ void section_free(struct section *sect);
 
 void section_free_all(void);
 
-/* Select a named section or creates a new one if it does not already exist */
+/* Drop a reference to a span, freeing it if no longer used */
+
+void section_span_free(struct section_span *span);
+
+/* Select a named section or creates a new one if it does not already exist.
+ * The name is an atom (see atom.h). */
 
 void section_set(const char *name, unsigned pass);
 
@@ -105,18 +136,31 @@ void section_set(const char *name, unsigned pass);
 
 void section_finish_pass(void);
 
-/* Coalesce all the spans in a section.  Adjacent sequential spans are joined
- * together into one.  If sort is 1, spans are sorted first.  If pad is 1, all
- * spans are coalesced into one large span with zero padding between them. */
+/* Query or set whether the relaxing branch on the current line needs its long
+ * form.  Once set, this persists for all subsequent passes. */
 
-void section_coalesce(struct section *, _Bool sort, _Bool pad);
+_Bool section_branch_is_long(void);
+void section_branch_set_long(void);
 
-/* Coalesce all spans from all sections, returning a new unnamed section.  If
- * pad is 1, this will result in one large zero-padded span.  If more than one
- * section is involved, all spans will be sorted before coalescing. */
+/* Coalesce all spans from all sections, returning a new unnamed section.
+ * Spans are sorted by put address, and adjacent spans joined together into
+ * one.  If pad is 1, this will result in one large zero-padded span.  Where
+ * spans overlap, the one emitted later wins, and each overlapping range of
+ * addresses is reported as an error.  The original spans are unchanged. */
 
 struct section *section_coalesce_all(_Bool pad);
 
+/* Coalesce the spans of a section into a new unnamed section, e.g. to pad the
+ * result of section_coalesce_all(0).  The source section is
+ * unchanged. */
+
+struct section *section_coalesce_copy(struct section const *src, _Bool pad);
+
+/* Call a function for each span in the named sections selected during the
+ * specified pass, in the order they were emitted. */
+
+void section_foreach_span(unsigned pass, void (*func)(struct section_span const *, void *), void *data);
+
 /* Types of data that assembly instructions and pseudo-ops can pass to
  * section_emit() */
 
@@ -136,8 +180,19 @@ void section_emit_uint8(uint8_t v);
 void section_emit_uint16(uint16_t v);
 void section_emit_uint32(uint32_t v);
 
+/* Add a buffer of raw bytes to the current section. */
+void section_emit_buf(uint8_t const *buf, int nbytes);
+
+/* Add nbytes copies of the same byte to the current section. */
+void section_emit_fill(uint8_t v, int nbytes);
+
 /* Skip a number of bytes in the current section - used by RMB. */
 
 void section_skip(int nbytes);
 
+/* Remove the last nbytes emitted to the current section, which must all be at
+ * the end of the current span - used to rewrite an instruction. */
+
+void section_retract(int nbytes);
+
 #endif
@@ -0,0 +1,1206 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "asm6809.h"
+#include "opcode.h"
+#include "sim.h"
+
+/* Condition code register bits */
+
+#define CC_E (0x80)
+#define CC_F (0x40)
+#define CC_H (0x20)
+#define CC_I (0x10)
+#define CC_N (0x08)
+#define CC_Z (0x04)
+#define CC_V (0x02)
+#define CC_C (0x01)
+
+/* Arithmetic and logic operations, numbered as in the low nibble of the
+ * accumulator opcodes (e.g. $80-$8B) */
+
+enum {
+	alu_sub = 0x0, alu_cmp = 0x1, alu_sbc = 0x2,
+	alu_and = 0x4, alu_bit = 0x5, alu_ld = 0x6, alu_st = 0x7,
+	alu_eor = 0x8, alu_adc = 0x9, alu_or = 0xa, alu_add = 0xb,
+};
+
+/* Addressing modes, as bits 4-5 of most opcodes */
+
+enum { mode_imm, mode_direct, mode_indexed, mode_extended };
+
+static uint8_t mem[0x10000];
+
+static struct {
+	uint8_t a, b, e, f;
+	uint8_t dp, cc, md;
+	uint16_t x, y, u, s, v, pc;
+} cpu;
+
+static struct sim_hooks hooks;
+static _Bool hd6309;
+static _Bool fault;  // illegal postbyte found during an instruction
+static unsigned long ncycles;
+static unsigned stop_pc;
+
+/* Valid opcodes for the selected ISA, by page (none, $10, $11) */
+static uint8_t valid[3][256];
+static _Bool valid_init = 0;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void mark_valid(unsigned code) {
+	unsigned page = 0;
+	if ((code >> 8) == 0x10)
+		page = 1;
+	else if ((code >> 8) == 0x11)
+		page = 2;
+	valid[page][code & 0xff] = 1;
+}
+
+static void mark_opcode(struct opcode const *op, void *data) {
+	(void)data;
+	unsigned ext_type = op->type & OPCODE_EXT_TYPE;
+	if (ext_type == OPCODE_RELAX)
+		return;
+	if (ext_type == OPCODE_TFM) {
+		for (unsigned i = 0; i < 4; i++)
+			mark_valid(op->immediate + i);
+		return;
+	}
+	if (ext_type == OPCODE_REG_MEM || (op->type & OPCODE_DIRECT))
+		mark_valid(op->direct);
+	if (op->type & OPCODE_INDEXED)
+		mark_valid(op->indexed);
+	if (op->type & OPCODE_EXTENDED)
+		mark_valid(op->extended);
+	if (ext_type && ext_type != OPCODE_IMM8_MEM && ext_type != OPCODE_REG_MEM)
+		mark_valid(op->immediate);
+}
+
+static void init_valid(void) {
+	memset(valid, 0, sizeof(valid));
+	opcode_foreach(mark_opcode, NULL);
+	valid_init = 1;
+}
+
+void sim_reset(void) {
+	memset(mem, 0, sizeof(mem));
+	memset(&cpu, 0, sizeof(cpu));
+	memset(&hooks, 0, sizeof(hooks));
+	cpu.cc = CC_I | CC_F;
+	hd6309 = (asm6809_options.isa == asm6809_isa_6309);
+	if (!valid_init)
+		init_valid();
+}
+
+void sim_set_hooks(struct sim_hooks const *h) {
+	if (h)
+		hooks = *h;
+	else
+		memset(&hooks, 0, sizeof(hooks));
+}
+
+void sim_load(unsigned addr, uint8_t const *data, unsigned size) {
+	for (unsigned i = 0; i < size; i++)
+		mem[(addr + i) & 0xffff] = data[i];
+}
+
+uint8_t sim_read(unsigned addr) {
+	return mem[addr & 0xffff];
+}
+
+unsigned sim_stop_pc(void) {
+	return stop_pc;
+}
+
+unsigned long sim_cycles(void) {
+	return ncycles;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Memory and registers */
+
+static uint8_t rd8(uint16_t a) {
+	if (hooks.read) {
+		int v = hooks.read(a, hooks.data);
+		if (v >= 0)
+			return v;
+	}
+	return mem[a];
+}
+
+static uint16_t rd16(uint16_t a) {
+	return (rd8(a) << 8) | rd8(a + 1);
+}
+
+static void wr8(uint16_t a, uint8_t v) {
+	if (hooks.write && hooks.write(a, v, hooks.data))
+		return;
+	mem[a] = v;
+}
+
+static void wr16(uint16_t a, uint16_t v) {
+	wr8(a, v >> 8);
+	wr8(a + 1, v);
+}
+
+static uint8_t fetch8(void) {
+	return mem[cpu.pc++];
+}
+
+static uint16_t fetch16(void) {
+	uint16_t v = (mem[cpu.pc] << 8) | mem[(uint16_t)(cpu.pc + 1)];
+	cpu.pc += 2;
+	return v;
+}
+
+static uint16_t get_d(void) {
+	return (cpu.a << 8) | cpu.b;
+}
+
+static void set_d(uint16_t v) {
+	cpu.a = v >> 8;
+	cpu.b = v;
+}
+
+static uint16_t get_w(void) {
+	return (cpu.e << 8) | cpu.f;
+}
+
+static void set_w(uint16_t v) {
+	cpu.e = v >> 8;
+	cpu.f = v;
+}
+
+static uint32_t get_q(void) {
+	return ((uint32_t)get_d() << 16) | get_w();
+}
+
+static void set_q(uint32_t v) {
+	set_d(v >> 16);
+	set_w(v);
+}
+
+static void push8(uint16_t *sp, uint8_t v) {
+	*sp -= 1;
+	wr8(*sp, v);
+}
+
+static void push16(uint16_t *sp, uint16_t v) {
+	push8(sp, v);
+	push8(sp, v >> 8);
+}
+
+static uint8_t pull8(uint16_t *sp) {
+	uint8_t v = rd8(*sp);
+	*sp += 1;
+	return v;
+}
+
+static uint16_t pull16(uint16_t *sp) {
+	uint16_t v = pull8(sp) << 8;
+	return v | pull8(sp);
+}
+
+/* Stack operations, other being the stack pointer not in use */
+
+static void push_regs(uint16_t *sp, uint16_t other, uint8_t mask) {
+	if (mask & 0x80) push16(sp, cpu.pc);
+	if (mask & 0x40) push16(sp, other);
+	if (mask & 0x20) push16(sp, cpu.y);
+	if (mask & 0x10) push16(sp, cpu.x);
+	if (mask & 0x08) push8(sp, cpu.dp);
+	if (mask & 0x04) push8(sp, cpu.b);
+	if (mask & 0x02) push8(sp, cpu.a);
+	if (mask & 0x01) push8(sp, cpu.cc);
+}
+
+static void pull_regs(uint16_t *sp, uint16_t *other, uint8_t mask) {
+	if (mask & 0x01) cpu.cc = pull8(sp);
+	if (mask & 0x02) cpu.a = pull8(sp);
+	if (mask & 0x04) cpu.b = pull8(sp);
+	if (mask & 0x08) cpu.dp = pull8(sp);
+	if (mask & 0x10) cpu.x = pull16(sp);
+	if (mask & 0x20) cpu.y = pull16(sp);
+	if (mask & 0x40) *other = pull16(sp);
+	if (mask & 0x80) cpu.pc = pull16(sp);
+}
+
+/* Registers as numbered in TFR/EXG and 6309 inter-register postbytes */
+
+static unsigned reg_size(unsigned r) {
+	return (r < 8) ? 16 : 8;
+}
+
+static uint16_t reg_get(unsigned r) {
+	switch (r) {
+	case 0x0: return get_d();
+	case 0x1: return cpu.x;
+	case 0x2: return cpu.y;
+	case 0x3: return cpu.u;
+	case 0x4: return cpu.s;
+	case 0x5: return cpu.pc;
+	case 0x6: return hd6309 ? get_w() : 0xffff;
+	case 0x7: return hd6309 ? cpu.v : 0xffff;
+	case 0x8: return cpu.a;
+	case 0x9: return cpu.b;
+	case 0xa: return cpu.cc;
+	case 0xb: return cpu.dp;
+	case 0xe: return hd6309 ? cpu.e : 0xff;
+	case 0xf: return hd6309 ? cpu.f : 0xff;
+	default: break;
+	}
+	return hd6309 ? 0 : 0xff;  // 6309 zero register
+}
+
+static void reg_set(unsigned r, uint16_t v) {
+	switch (r) {
+	case 0x0: set_d(v); break;
+	case 0x1: cpu.x = v; break;
+	case 0x2: cpu.y = v; break;
+	case 0x3: cpu.u = v; break;
+	case 0x4: cpu.s = v; break;
+	case 0x5: cpu.pc = v; break;
+	case 0x6: if (hd6309) set_w(v); break;
+	case 0x7: if (hd6309) cpu.v = v; break;
+	case 0x8: cpu.a = v; break;
+	case 0x9: cpu.b = v; break;
+	case 0xa: cpu.cc = v; break;
+	case 0xb: cpu.dp = v; break;
+	case 0xe: if (hd6309) cpu.e = v; break;
+	case 0xf: if (hd6309) cpu.f = v; break;
+	default: break;
+	}
+}
+
+/* Read a register for transfer to one of a different size.  The 6809 fills
+ * the high byte with $FF; the 6309 uses the 16-bit register containing an
+ * accumulator, and duplicates CC or DP. */
+
+static uint16_t reg_get_as(unsigned r, unsigned size) {
+	uint16_t v = reg_get(r);
+	if (reg_size(r) == size)
+		return v;
+	if (size == 8) {
+		if (hd6309 && (r == 0x0 || r == 0x6))
+			return v >> 8;
+		return v & 0xff;
+	}
+	if (!hd6309)
+		return 0xff00 | v;
+	switch (r) {
+	case 0x8: case 0x9: return get_d();
+	case 0xe: case 0xf: return get_w();
+	default: break;
+	}
+	return (v << 8) | v;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Flags and arithmetic */
+
+static void set_flag(uint8_t flag, _Bool v) {
+	if (v)
+		cpu.cc |= flag;
+	else
+		cpu.cc &= ~flag;
+}
+
+static void set_nz8(uint8_t r) {
+	set_flag(CC_N, r & 0x80);
+	set_flag(CC_Z, r == 0);
+}
+
+static void set_nz16(uint16_t r) {
+	set_flag(CC_N, r & 0x8000);
+	set_flag(CC_Z, r == 0);
+}
+
+static void set_nz32(uint32_t r) {
+	set_flag(CC_N, r & 0x80000000);
+	set_flag(CC_Z, r == 0);
+}
+
+static uint8_t add8(uint8_t a, uint8_t b, unsigned c) {
+	unsigned r = a + b + c;
+	set_flag(CC_H, (a ^ b ^ r) & 0x10);
+	set_flag(CC_V, (a ^ r) & (b ^ r) & 0x80);
+	set_flag(CC_C, r & 0x100);
+	set_nz8(r);
+	return r;
+}
+
+static uint8_t sub8(uint8_t a, uint8_t b, unsigned c) {
+	unsigned r = a - b - c;
+	set_flag(CC_V, (a ^ b) & (a ^ r) & 0x80);
+	set_flag(CC_C, r & 0x100);
+	set_nz8(r);
+	return r;
+}
+
+static uint16_t add16(uint16_t a, uint16_t b, unsigned c) {
+	uint32_t r = (uint32_t)a + b + c;
+	set_flag(CC_V, (a ^ r) & (b ^ r) & 0x8000);
+	set_flag(CC_C, r & 0x10000);
+	set_nz16(r);
+	return r;
+}
+
+static uint16_t sub16(uint16_t a, uint16_t b, unsigned c) {
+	uint32_t r = (uint32_t)a - b - c;
+	set_flag(CC_V, (a ^ b) & (a ^ r) & 0x8000);
+	set_flag(CC_C, r & 0x10000);
+	set_nz16(r);
+	return r;
+}
+
+static uint8_t logic8(uint8_t r) {
+	set_nz8(r);
+	cpu.cc &= ~CC_V;
+	return r;
+}
+
+static uint16_t logic16(uint16_t r) {
+	set_nz16(r);
+	cpu.cc &= ~CC_V;
+	return r;
+}
+
+/* Single operand operations, numbered as in the low nibble of the opcode
+ * (e.g. $40-$4F).  TST is handled by the caller, as it writes nothing. */
+
+static uint8_t unary8(unsigned op, uint8_t m) {
+	unsigned c = cpu.cc & CC_C;
+	uint8_t r;
+	switch (op) {
+	case 0x0:  // NEG
+		return sub8(0, m, 0);
+	case 0x3:  // COM
+		cpu.cc |= CC_C;
+		return logic8(~m);
+	case 0x4:  // LSR
+		r = m >> 1;
+		set_flag(CC_C, m & 1);
+		break;
+	case 0x6:  // ROR
+		r = (m >> 1) | (c << 7);
+		set_flag(CC_C, m & 1);
+		break;
+	case 0x7:  // ASR
+		r = (m >> 1) | (m & 0x80);
+		set_flag(CC_C, m & 1);
+		break;
+	case 0x8:  // ASL
+		r = m << 1;
+		set_flag(CC_C, m & 0x80);
+		set_flag(CC_V, (m ^ r) & 0x80);
+		break;
+	case 0x9:  // ROL
+		r = (m << 1) | c;
+		set_flag(CC_C, m & 0x80);
+		set_flag(CC_V, (m ^ r) & 0x80);
+		break;
+	case 0xa:  // DEC
+		r = m - 1;
+		set_flag(CC_V, m == 0x80);
+		break;
+	case 0xc:  // INC
+		r = m + 1;
+		set_flag(CC_V, m == 0x7f);
+		break;
+	case 0xf:  // CLR
+		cpu.cc &= ~(CC_V | CC_C);
+		r = 0;
+		break;
+	default:
+		fault = 1;
+		return m;
+	}
+	set_nz8(r);
+	return r;
+}
+
+static uint16_t unary16(unsigned op, uint16_t m) {
+	unsigned c = cpu.cc & CC_C;
+	uint16_t r;
+	switch (op) {
+	case 0x0:
+		return sub16(0, m, 0);
+	case 0x3:
+		cpu.cc |= CC_C;
+		return logic16(~m);
+	case 0x4:
+		r = m >> 1;
+		set_flag(CC_C, m & 1);
+		break;
+	case 0x6:
+		r = (m >> 1) | (c << 15);
+		set_flag(CC_C, m & 1);
+		break;
+	case 0x7:
+		r = (m >> 1) | (m & 0x8000);
+		set_flag(CC_C, m & 1);
+		break;
+	case 0x8:
+		r = m << 1;
+		set_flag(CC_C, m & 0x8000);
+		set_flag(CC_V, (m ^ r) & 0x8000);
+		break;
+	case 0x9:
+		r = (m << 1) | c;
+		set_flag(CC_C, m & 0x8000);
+		set_flag(CC_V, (m ^ r) & 0x8000);
+		break;
+	case 0xa:
+		r = m - 1;
+		set_flag(CC_V, m == 0x8000);
+		break;
+	case 0xc:
+		r = m + 1;
+		set_flag(CC_V, m == 0x7fff);
+		break;
+	case 0xf:
+		cpu.cc &= ~(CC_V | CC_C);
+		r = 0;
+		break;
+	default:
+		fault = 1;
+		return m;
+	}
+	set_nz16(r);
+	return r;
+}
+
+static _Bool branch_cond(unsigned cond) {
+	_Bool n = cpu.cc & CC_N, z = cpu.cc & CC_Z;
+	_Bool v = cpu.cc & CC_V, c = cpu.cc & CC_C;
+	_Bool r;
+	switch (cond >> 1) {
+	case 0: r = 1; break;  // BRA
+	case 1: r = !(c || z); break;  // BHI
+	case 2: r = !c; break;  // BCC
+	case 3: r = !z; break;  // BNE
+	case 4: r = !v; break;  // BVC
+	case 5: r = !n; break;  // BPL
+	case 6: r = (n == v); break;  // BGE
+	default: r = !z && (n == v); break;  // BGT
+	}
+	return (cond & 1) ? !r : r;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Addressing */
+
+static uint16_t *index_reg(uint8_t postbyte) {
+	switch ((postbyte >> 5) & 3) {
+	case 0: return &cpu.x;
+	case 1: return &cpu.y;
+	case 2: return &cpu.u;
+	default: break;
+	}
+	return &cpu.s;
+}
+
+static uint16_t indexed_ea(void) {
+	uint8_t pb = fetch8();
+	uint16_t *r = index_reg(pb);
+	uint16_t ea;
+
+	if (!(pb & 0x80))
+		return *r + (int)((pb & 0x1f) ^ 0x10) - 0x10;
+
+	if (hd6309) {
+		uint16_t w = get_w();
+		switch (pb) {
+		case 0x8f: return w;
+		case 0x90: return rd16(w);
+		case 0xaf: return w + fetch16();
+		case 0xb0: return rd16(w + fetch16());
+		case 0xcf: set_w(w + 2); return w;
+		case 0xd0: set_w(w + 2); return rd16(w);
+		case 0xef: set_w(w - 2); return w - 2;
+		case 0xf0: set_w(w - 2); return rd16(w - 2);
+		default: break;
+		}
+	}
+
+	_Bool indirect = pb & 0x10;
+	switch (pb & 0x0f) {
+	case 0x0:
+		ea = (*r)++;
+		if (indirect)
+			fault = 1;
+		break;
+	case 0x1:
+		ea = *r;
+		*r += 2;
+		break;
+	case 0x2:
+		ea = --(*r);
+		if (indirect)
+			fault = 1;
+		break;
+	case 0x3:
+		*r -= 2;
+		ea = *r;
+		break;
+	case 0x4: ea = *r; break;
+	case 0x5: ea = *r + (int8_t)cpu.b; break;
+	case 0x6: ea = *r + (int8_t)cpu.a; break;
+	case 0x7: ea = *r + (int8_t)cpu.e; fault |= !hd6309; break;
+	case 0x8: ea = *r + (int8_t)fetch8(); break;
+	case 0x9: ea = *r + fetch16(); break;
+	case 0xa: ea = *r + (int8_t)cpu.f; fault |= !hd6309; break;
+	case 0xb: ea = *r + get_d(); break;
+	case 0xc:
+		ea = (int8_t)fetch8();
+		ea += cpu.pc;
+		break;
+	case 0xd:
+		ea = fetch16();
+		ea += cpu.pc;
+		break;
+	case 0xe: ea = *r + get_w(); fault |= !hd6309; break;
+	default:
+		ea = fetch16();
+		if (!indirect)
+			fault = 1;
+		break;
+	}
+	return indirect ? rd16(ea) : ea;
+}
+
+static uint16_t mem_ea(unsigned mode) {
+	switch (mode) {
+	case mode_direct: return (cpu.dp << 8) | fetch8();
+	case mode_indexed: return indexed_ea();
+	default: break;
+	}
+	return fetch16();
+}
+
+static uint8_t operand8(unsigned mode) {
+	if (mode == mode_imm)
+		return fetch8();
+	return rd8(mem_ea(mode));
+}
+
+static uint16_t operand16(unsigned mode) {
+	if (mode == mode_imm)
+		return fetch16();
+	return rd16(mem_ea(mode));
+}
+
+/* Accumulator operations with a memory or immediate operand */
+
+static void alu8(unsigned op, unsigned mode, uint8_t *r) {
+	if (op == alu_st) {
+		wr8(mem_ea(mode), logic8(*r));
+		return;
+	}
+	uint8_t m = operand8(mode);
+	unsigned c = cpu.cc & CC_C;
+	switch (op) {
+	case alu_sub: *r = sub8(*r, m, 0); break;
+	case alu_cmp: sub8(*r, m, 0); break;
+	case alu_sbc: *r = sub8(*r, m, c); break;
+	case alu_and: *r = logic8(*r & m); break;
+	case alu_bit: logic8(*r & m); break;
+	case alu_ld: *r = logic8(m); break;
+	case alu_eor: *r = logic8(*r ^ m); break;
+	case alu_adc: *r = add8(*r, m, c); break;
+	case alu_or: *r = logic8(*r | m); break;
+	case alu_add: *r = add8(*r, m, 0); break;
+	default: fault = 1; break;
+	}
+}
+
+static void alu16(unsigned op, unsigned mode, uint16_t *r) {
+	if (op == alu_st) {
+		wr16(mem_ea(mode), logic16(*r));
+		return;
+	}
+	uint16_t m = operand16(mode);
+	unsigned c = cpu.cc & CC_C;
+	switch (op) {
+	case alu_sub: *r = sub16(*r, m, 0); break;
+	case alu_cmp: sub16(*r, m, 0); break;
+	case alu_sbc: *r = sub16(*r, m, c); break;
+	case alu_and: *r = logic16(*r & m); break;
+	case alu_bit: logic16(*r & m); break;
+	case alu_ld: *r = logic16(m); break;
+	case alu_eor: *r = logic16(*r ^ m); break;
+	case alu_adc: *r = add16(*r, m, c); break;
+	case alu_or: *r = logic16(*r | m); break;
+	case alu_add: *r = add16(*r, m, 0); break;
+	default: fault = 1; break;
+	}
+}
+
+static void alu_d(unsigned op, unsigned mode) {
+	uint16_t d = get_d();
+	alu16(op, mode, &d);
+	set_d(d);
+}
+
+static void alu_w(unsigned op, unsigned mode) {
+	uint16_t w = get_w();
+	alu16(op, mode, &w);
+	set_w(w);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Miscellaneous instructions */
+
+static void daa(void) {
+	unsigned msn = cpu.a & 0xf0, lsn = cpu.a & 0x0f;
+	unsigned cf = 0;
+	if (lsn > 0x09 || (cpu.cc & CC_H))
+		cf |= 0x06;
+	if (msn > 0x80 && lsn > 0x09)
+		cf |= 0x60;
+	if (msn > 0x90 || (cpu.cc & CC_C))
+		cf |= 0x60;
+	unsigned r = cpu.a + cf;
+	cpu.a = r;
+	set_nz8(r);
+	cpu.cc &= ~CC_V;
+	if (r & 0x100)
+		cpu.cc |= CC_C;
+}
+
+static void exg_tfr(_Bool exg, uint8_t pb) {
+	unsigned r0 = pb >> 4, r1 = pb & 15;
+	uint16_t v0 = reg_get_as(r0, reg_size(r1));
+	if (exg) {
+		uint16_t v1 = reg_get_as(r1, reg_size(r0));
+		reg_set(r0, v1);
+	}
+	reg_set(r1, v0);
+}
+
+/* 6309 inter-register arithmetic: the destination determines the size. */
+
+static void reg_op(unsigned op, uint8_t pb) {
+	unsigned src = pb >> 4, dst = pb & 15;
+	unsigned c = cpu.cc & CC_C;
+	if (reg_size(dst) == 16) {
+		uint16_t a = reg_get(dst), b = reg_get_as(src, 16), r = a;
+		switch (op) {
+		case 0x0: r = add16(a, b, 0); break;
+		case 0x1: r = add16(a, b, c); break;
+		case 0x2: r = sub16(a, b, 0); break;
+		case 0x3: r = sub16(a, b, c); break;
+		case 0x4: r = logic16(a & b); break;
+		case 0x5: r = logic16(a | b); break;
+		case 0x6: r = logic16(a ^ b); break;
+		default: sub16(a, b, 0); return;  // CMPR
+		}
+		reg_set(dst, r);
+	} else {
+		uint8_t a = reg_get(dst), b = reg_get_as(src, 8), r = a;
+		switch (op) {
+		case 0x0: r = add8(a, b, 0); break;
+		case 0x1: r = add8(a, b, c); break;
+		case 0x2: r = sub8(a, b, 0); break;
+		case 0x3: r = sub8(a, b, c); break;
+		case 0x4: r = logic8(a & b); break;
+		case 0x5: r = logic8(a | b); break;
+		case 0x6: r = logic8(a ^ b); break;
+		default: sub8(a, b, 0); return;
+		}
+		reg_set(dst, r);
+	}
+}
+
+/* 6309 bit transfers between a register and direct page memory. */
+
+static void bit_op(unsigned op) {
+	uint8_t pb = fetch8();
+	uint16_t ea = (cpu.dp << 8) | fetch8();
+	uint8_t *r;
+	switch (pb >> 6) {
+	case 0: r = &cpu.cc; break;
+	case 1: r = &cpu.a; break;
+	case 2: r = &cpu.b; break;
+	default: fault = 1; return;
+	}
+	unsigned sbit = (pb >> 3) & 7, dbit = pb & 7;
+	uint8_t m = rd8(ea);
+	if (op == 0x7) {  // STBT
+		unsigned v = (*r >> sbit) & 1;
+		wr8(ea, (m & ~(1 << dbit)) | (v << dbit));
+		return;
+	}
+	unsigned mb = (m >> sbit) & 1;
+	unsigned rb = (*r >> dbit) & 1;
+	switch (op) {
+	case 0x0: rb &= mb; break;   // BAND
+	case 0x1: rb &= !mb; break;  // BIAND
+	case 0x2: rb |= mb; break;   // BOR
+	case 0x3: rb |= !mb; break;  // BIOR
+	case 0x4: rb ^= mb; break;   // BEOR
+	case 0x5: rb ^= !mb; break;  // BIEOR
+	default: rb = mb; break;     // LDBT
+	}
+	*r = (*r & ~(1 << dbit)) | (rb << dbit);
+}
+
+/* 6309 block transfer.  Each byte takes three cycles. */
+
+static void tfm(unsigned op) {
+	uint8_t pb = fetch8();
+	unsigned src = pb >> 4, dst = pb & 15;
+	if (src > 4 || dst > 4) {
+		fault = 1;
+		return;
+	}
+	int sinc = (op == 0 || op == 2) ? 1 : (op == 1) ? -1 : 0;
+	int dinc = (op == 0 || op == 3) ? 1 : (op == 1) ? -1 : 0;
+	for (uint16_t w = get_w(); w; w--) {
+		uint16_t s = reg_get(src);
+		uint16_t d = reg_get(dst);
+		wr8(d, rd8(s));
+		reg_set(src, s + sinc);
+		reg_set(dst, reg_get(dst) + dinc);
+		set_w(w - 1);
+		ncycles += 3;
+	}
+}
+
+static void interrupt(uint16_t vector, uint8_t mask) {
+	cpu.cc |= CC_E;
+	push_regs(&cpu.s, cpu.u, 0xff);
+	cpu.cc |= mask;
+	cpu.pc = rd16(vector);
+}
+
+static enum sim_stop divd(uint8_t m) {
+	if (m == 0)
+		return sim_stop_divzero;
+	int dividend = (int16_t)get_d();
+	int divisor = (int8_t)m;
+	int q = dividend / divisor, r = dividend % divisor;
+	cpu.cc &= ~(CC_N | CC_Z | CC_V | CC_C);
+	if (q > 127 || q < -128) {
+		cpu.cc |= CC_V;
+		return sim_stop_return;
+	}
+	cpu.a = r;
+	cpu.b = q;
+	set_nz8(cpu.b);
+	set_flag(CC_C, q & 1);
+	return sim_stop_return;
+}
+
+static enum sim_stop divq(uint16_t m) {
+	if (m == 0)
+		return sim_stop_divzero;
+	int64_t dividend = (int32_t)get_q();
+	int64_t divisor = (int16_t)m;
+	int64_t q = dividend / divisor, r = dividend % divisor;
+	cpu.cc &= ~(CC_N | CC_Z | CC_V | CC_C);
+	if (q > 32767 || q < -32768) {
+		cpu.cc |= CC_V;
+		return sim_stop_return;
+	}
+	set_d(r);
+	set_w(q);
+	set_nz16(get_w());
+	set_flag(CC_C, q & 1);
+	return sim_stop_return;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Instruction execution.  Each returns sim_stop_return to continue (the
+ * caller decides whether a return has left the called routine). */
+
+static enum sim_stop exec_page0(uint8_t op) {
+	unsigned mode = (op >> 4) & 3;
+	unsigned low = op & 0x0f;
+	uint16_t ea;
+	uint8_t m, imm = 0;
+
+	switch (op >> 4) {
+	case 0x0: case 0x6: case 0x7:
+		if (low == 0x1 || low == 0x2 || low == 0x5 || low == 0xb)
+			imm = fetch8();
+		ea = mem_ea((op >> 4) == 0 ? mode_direct : mode);
+		if (low == 0xe) {  // JMP
+			cpu.pc = ea;
+			break;
+		}
+		m = rd8(ea);
+		switch (low) {
+		case 0x1: wr8(ea, logic8(m | imm)); break;  // OIM
+		case 0x2: wr8(ea, logic8(m & imm)); break;  // AIM
+		case 0x5: wr8(ea, logic8(m ^ imm)); break;  // EIM
+		case 0xb: logic8(m & imm); break;  // TIM
+		case 0xd: logic8(m); break;  // TST
+		default: wr8(ea, unary8(low, m)); break;
+		}
+		break;
+
+	case 0x1:
+		switch (op) {
+		case 0x12: break;  // NOP
+		case 0x13: return sim_stop_wait;  // SYNC
+		case 0x14:  // SEXW
+			set_d((cpu.e & 0x80) ? 0xffff : 0);
+			set_nz32(get_q());
+			break;
+		case 0x16:  // LBRA
+			ea = fetch16();
+			cpu.pc += ea;
+			break;
+		case 0x17:  // LBSR
+			ea = fetch16();
+			push16(&cpu.s, cpu.pc);
+			cpu.pc += ea;
+			break;
+		case 0x19: daa(); break;
+		case 0x1a: cpu.cc |= fetch8(); break;  // ORCC
+		case 0x1c: cpu.cc &= fetch8(); break;  // ANDCC
+		case 0x1d:  // SEX
+			cpu.a = (cpu.b & 0x80) ? 0xff : 0;
+			set_nz16(get_d());
+			break;
+		case 0x1e: exg_tfr(1, fetch8()); break;
+		case 0x1f: exg_tfr(0, fetch8()); break;
+		default: fault = 1; break;
+		}
+		break;
+
+	case 0x2:
+		m = fetch8();
+		if (branch_cond(low))
+			cpu.pc += (int8_t)m;
+		break;
+
+	case 0x3:
+		switch (op) {
+		case 0x30:  // LEAX
+			cpu.x = indexed_ea();
+			set_flag(CC_Z, cpu.x == 0);
+			break;
+		case 0x31:  // LEAY
+			cpu.y = indexed_ea();
+			set_flag(CC_Z, cpu.y == 0);
+			break;
+		case 0x32: cpu.s = indexed_ea(); break;  // LEAS
+		case 0x33: cpu.u = indexed_ea(); break;  // LEAU
+		case 0x34: m = fetch8(); push_regs(&cpu.s, cpu.u, m); break;
+		case 0x35: m = fetch8(); pull_regs(&cpu.s, &cpu.u, m); break;
+		case 0x36: m = fetch8(); push_regs(&cpu.u, cpu.s, m); break;
+		case 0x37: m = fetch8(); pull_regs(&cpu.u, &cpu.s, m); break;
+		case 0x39: cpu.pc = pull16(&cpu.s); break;  // RTS
+		case 0x3a: cpu.x += cpu.b; break;  // ABX
+		case 0x3b:  // RTI
+			cpu.cc = pull8(&cpu.s);
+			if (cpu.cc & CC_E) {
+				pull_regs(&cpu.s, &cpu.u, 0xfe);
+				ncycles += 9;
+			} else {
+				cpu.pc = pull16(&cpu.s);
+			}
+			break;
+		case 0x3c:  // CWAI
+			cpu.cc &= fetch8();
+			cpu.cc |= CC_E;
+			push_regs(&cpu.s, cpu.u, 0xff);
+			return sim_stop_wait;
+		case 0x3d:  // MUL
+			set_d(cpu.a * cpu.b);
+			set_flag(CC_Z, get_d() == 0);
+			set_flag(CC_C, cpu.b & 0x80);
+			break;
+		case 0x3f: interrupt(0xfffa, CC_I | CC_F); break;  // SWI
+		default: fault = 1; break;
+		}
+		break;
+
+	case 0x4:
+		if (low == 0xd)
+			logic8(cpu.a);
+		else
+			cpu.a = unary8(low, cpu.a);
+		break;
+
+	case 0x5:
+		if (low == 0xd)
+			logic8(cpu.b);
+		else
+			cpu.b = unary8(low, cpu.b);
+		break;
+
+	case 0x8: case 0x9: case 0xa: case 0xb:
+		switch (low) {
+		case 0x3: alu_d(alu_sub, mode); break;  // SUBD
+		case 0xc: alu16(alu_cmp, mode, &cpu.x); break;  // CMPX
+		case 0xd:
+			if (mode == mode_imm) {  // BSR
+				m = fetch8();
+				push16(&cpu.s, cpu.pc);
+				cpu.pc += (int8_t)m;
+			} else {  // JSR
+				ea = mem_ea(mode);
+				push16(&cpu.s, cpu.pc);
+				cpu.pc = ea;
+			}
+			break;
+		case 0xe: alu16(alu_ld, mode, &cpu.x); break;
+		case 0xf: alu16(alu_st, mode, &cpu.x); break;
+		default: alu8(low, mode, &cpu.a); break;
+		}
+		break;
+
+	default:
+		switch (low) {
+		case 0x3: alu_d(alu_add, mode); break;  // ADDD
+		case 0xc: alu_d(alu_ld, mode); break;  // LDD
+		case 0xd:
+			if (mode == mode_imm) {  // LDQ
+				uint32_t v = (uint32_t)fetch16() << 16;
+				set_q(v | fetch16());
+				set_nz32(get_q());
+				cpu.cc &= ~CC_V;
+			} else {
+				alu_d(alu_st, mode);  // STD
+			}
+			break;
+		case 0xe: alu16(alu_ld, mode, &cpu.u); break;
+		case 0xf: alu16(alu_st, mode, &cpu.u); break;
+		default: alu8(low, mode, &cpu.b); break;
+		}
+		break;
+	}
+	return sim_stop_return;
+}
+
+static enum sim_stop exec_page2(uint8_t op, int extra) {
+	unsigned mode = (op >> 4) & 3;
+	unsigned low = op & 0x0f;
+	uint16_t ea;
+
+	if (op >= 0x21 && op <= 0x2f) {
+		ea = fetch16();
+		if (branch_cond(low)) {
+			cpu.pc += ea;
+			ncycles += extra;
+		}
+		return sim_stop_return;
+	}
+
+	switch (op) {
+	case 0x30: case 0x31: case 0x32: case 0x33:
+	case 0x34: case 0x35: case 0x36: case 0x37:
+		reg_op(low, fetch8());
+		return sim_stop_return;
+	case 0x38: push16(&cpu.s, get_w()); return sim_stop_return;
+	case 0x39: set_w(pull16(&cpu.s)); return sim_stop_return;
+	case 0x3a: push16(&cpu.u, get_w()); return sim_stop_return;
+	case 0x3b: set_w(pull16(&cpu.u)); return sim_stop_return;
+	case 0x3f: interrupt(0xfff4, 0); return sim_stop_return;  // SWI2
+	default: break;
+	}
+
+	switch (op >> 4) {
+	case 0x4:
+		if (low == 0xd)
+			logic16(get_d());
+		else
+			set_d(unary16(low, get_d()));
+		break;
+	case 0x5:
+		if (low == 0xd)
+			logic16(get_w());
+		else
+			set_w(unary16(low, get_w()));
+		break;
+	case 0x8: case 0x9: case 0xa: case 0xb:
+		switch (low) {
+		case 0x0: case 0x1: case 0x6: case 0x7: case 0xb:
+			alu_w(low, mode);  // SUBW, CMPW, LDW, STW, ADDW
+			break;
+		case 0x3: alu_d(alu_cmp, mode); break;  // CMPD
+		case 0xc: alu16(alu_cmp, mode, &cpu.y); break;
+		case 0xe: alu16(alu_ld, mode, &cpu.y); break;
+		case 0xf: alu16(alu_st, mode, &cpu.y); break;
+		default: alu_d(low, mode); break;  // SBCD, ANDD, BITD, EORD, ADCD, ORD
+		}
+		break;
+	default:
+		switch (low) {
+		case 0xc:  // LDQ
+			ea = mem_ea(mode);
+			set_q(((uint32_t)rd16(ea) << 16) | rd16(ea + 2));
+			set_nz32(get_q());
+			cpu.cc &= ~CC_V;
+			break;
+		case 0xd:  // STQ
+			ea = mem_ea(mode);
+			wr16(ea, get_d());
+			wr16(ea + 2, get_w());
+			set_nz32(get_q());
+			cpu.cc &= ~CC_V;
+			break;
+		case 0xe: alu16(alu_ld, mode, &cpu.s); break;
+		case 0xf: alu16(alu_st, mode, &cpu.s); break;
+		default: fault = 1; break;
+		}
+		break;
+	}
+	return sim_stop_return;
+}
+
+static enum sim_stop exec_page3(uint8_t op) {
+	unsigned mode = (op >> 4) & 3;
+	unsigned low = op & 0x0f;
+	uint8_t m;
+
+	switch (op) {
+	case 0x30: case 0x31: case 0x32: case 0x33:
+	case 0x34: case 0x35: case 0x36: case 0x37:
+		bit_op(low);
+		return sim_stop_return;
+	case 0x38: case 0x39: case 0x3a: case 0x3b:
+		tfm(low - 8);
+		return sim_stop_return;
+	case 0x3c:  // BITMD
+		m = fetch8() & 0xc0;
+		set_flag(CC_Z, !(cpu.md & m));
+		cpu.md &= ~m;
+		return sim_stop_return;
+	case 0x3d:  // LDMD
+		cpu.md = (cpu.md & 0xc0) | (fetch8() & 0x03);
+		return sim_stop_return;
+	case 0x3f: interrupt(0xfff2, 0); return sim_stop_return;  // SWI3
+	default: break;
+	}
+
+	switch (op >> 4) {
+	case 0x4:
+		if (low == 0xd)
+			logic8(cpu.e);
+		else
+			cpu.e = unary8(low, cpu.e);
+		break;
+	case 0x5:
+		if (low == 0xd)
+			logic8(cpu.f);
+		else
+			cpu.f = unary8(low, cpu.f);
+		break;
+	case 0x8: case 0x9: case 0xa: case 0xb:
+		switch (low) {
+		case 0x3: alu16(alu_cmp, mode, &cpu.u); break;  // CMPU
+		case 0xc: alu16(alu_cmp, mode, &cpu.s); break;  // CMPS
+		case 0xd: return divd(operand8(mode));
+		case 0xe: return divq(operand16(mode));
+		case 0xf:  // MULD
+			set_q((uint32_t)((int16_t)get_d() * (int16_t)operand16(mode)));
+			set_nz32(get_q());
+			cpu.cc &= ~(CC_V | CC_C);
+			break;
+		default: alu8(low, mode, &cpu.e); break;
+		}
+		break;
+	default:
+		alu8(low, mode, &cpu.f);
+		break;
+	}
+	return sim_stop_return;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Execute one instruction.  Sets *ret if it was one that returns from a
+ * subroutine (RTS, RTI, or a pull including PC). */
+
+static enum sim_stop step(_Bool *ret) {
+	uint16_t pc = cpu.pc;
+	uint8_t code[6];
+	for (unsigned i = 0; i < sizeof(code); i++)
+		code[i] = mem[(uint16_t)(pc + i)];
+
+	unsigned page = 0;
+	uint8_t op = code[0];
+	if (op == 0x10 || op == 0x11) {
+		page = op - 0x0f;
+		op = code[1];
+	}
+	int extra = 0;
+	int base = opcode_cycles(code, sizeof(code), &extra);
+	if (base < 0 || !valid[page][op])
+		return sim_stop_illegal;
+	ncycles += base;
+
+	fault = 0;
+	enum sim_stop stop;
+	cpu.pc += page ? 2 : 1;
+	switch (page) {
+	case 0:
+		stop = exec_page0(op);
+		*ret = (op == 0x39 || op == 0x3b || (op == 0x35 && (code[1] & 0x80)));
+		break;
+	case 1:
+		stop = exec_page2(op, extra);
+		*ret = 0;
+		break;
+	default:
+		stop = exec_page3(op);
+		*ret = 0;
+		break;
+	}
+	if (fault)
+		return sim_stop_illegal;
+	return stop;
+}
+
+/* The routine is called with a return address of zero, and has returned when
+ * it pulls that from where it was pushed. */
+
+enum sim_stop sim_call(unsigned addr, unsigned stack, unsigned long max_cycles) {
+	cpu.s = stack;
+	push16(&cpu.s, 0);
+	cpu.pc = addr;
+	ncycles = 0;
+	enum sim_stop stop = sim_stop_return;
+	for (;;) {
+		if (ncycles >= max_cycles) {
+			stop = sim_stop_limit;
+			break;
+		}
+		stop_pc = cpu.pc;
+		unsigned long before = ncycles;
+		_Bool ret = 0;
+		stop = step(&ret);
+		if (stop != sim_stop_return)
+			break;
+		if (hooks.trace)
+			hooks.trace(stop_pc, ncycles - before, hooks.data);
+		if (ret && cpu.s == (uint16_t)stack && cpu.pc == 0)
+			break;
+	}
+	return stop;
+}
@@ -0,0 +1,71 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#ifndef ASM6809_SIM_H_
+#define ASM6809_SIM_H_
+
+#include <stdint.h>
+
+/*
+ * Instruction level simulation of a 6809 or 6309 (according to the selected
+ * ISA) with 64K of RAM.
+ *
+ * Which opcodes are valid is determined from the assembler's own opcode
+ * table, and instructions are timed using the same cycle counts as listings.
+ * 6309 instructions run as in emulation mode.  There are no interrupts, so
+ * SYNC and CWAI stop the simulation.
+ */
+
+enum sim_stop {
+	sim_stop_return,   // returned from the called routine
+	sim_stop_limit,    // cycle limit reached
+	sim_stop_illegal,  // illegal instruction or addressing mode
+	sim_stop_wait,     // SYNC or CWAI waiting for an interrupt
+	sim_stop_divzero,  // 6309 division by zero
+};
+
+/* Optional hooks, all passed the same data pointer.  The trace function is
+ * called after each instruction with its address and the cycles it took.  The
+ * read function may supply a byte read as data (returning -1 to read memory
+ * instead), and the write function may consume a byte written (returning 1 if
+ * it did, otherwise it is written to memory). */
+
+struct sim_hooks {
+	void (*trace)(unsigned pc, unsigned cycles, void *data);
+	int (*read)(unsigned addr, void *data);
+	_Bool (*write)(unsigned addr, uint8_t v, void *data);
+	void *data;
+};
+
+/* Clear memory, registers and hooks. */
+void sim_reset(void);
+
+/* Install hooks, or clear them if NULL. */
+void sim_set_hooks(struct sim_hooks const *hooks);
+
+/* Copy data into memory. */
+void sim_load(unsigned addr, uint8_t const *data, unsigned size);
+
+/* Read a byte of memory. */
+uint8_t sim_read(unsigned addr);
+
+/* Call the routine at addr with the stack pointer initially at stack, until
+ * it returns or max_cycles have elapsed. */
+enum sim_stop sim_call(unsigned addr, unsigned stack, unsigned long max_cycles);
+
+/* Address of the instruction at which the last call stopped. */
+unsigned sim_stop_pc(void);
+
+/* Cycles taken by the last call. */
+unsigned long sim_cycles(void);
+
+#endif
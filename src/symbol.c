@@ -18,12 +18,13 @@ option) any later version.
 #include <string.h>
 
 #include "dict.h"
-#include "gl_avltree_list.h"
-#include "gl_xlist.h"
 #include "slist.h"
 #include "xalloc.h"
 
 #include "assemble.h"
+#include "atom.h"
+#include "depend.h"
+#include "dpvar.h"
 #include "error.h"
 #include "eval.h"
 #include "node.h"
@@ -40,9 +41,14 @@ _Bool symbol_ignore_undefined = 0;
  * Record the pass in which each symbol was entered into the table.  This can
  * be used to detect multiple definitions without cycling through a new table
  * each pass.
+ *
+ * Slots are created on first reference and updated in place, never replaced,
+ * so pointers to them remain valid.  A slot is undefined until first set.
  */
 
 struct symbol {
+	char const *key;
+	_Bool defined;
 	unsigned pass;
 	struct node *node;
 };
@@ -60,7 +66,22 @@ static void symbol_free(struct symbol *s) {
 }
 
 static void init_table(void) {
-	symbols = dict_new_full(dict_str_hash, dict_str_equal, free, (Hash_data_freer)symbol_free);
+	symbols = dict_new_full(atom_dict_hash, dict_direct_equal, NULL, (Hash_data_freer)symbol_free);
+}
+
+struct symbol *symbol_slot(const char *key) {
+	if (!symbols)
+		init_table();
+	struct symbol *s = dict_lookup(symbols, key);
+	if (!s) {
+		s = xmalloc(sizeof(*s));
+		s->key = key;
+		s->defined = 0;
+		s->pass = 0;
+		s->node = NULL;
+		dict_insert(symbols, (void *)key, s);
+	}
+	return s;
 }
 
 void symbol_set(const char *key, struct node *value, _Bool changeable, unsigned pass) {
@@ -71,51 +92,56 @@ void symbol_set(const char *key, struct node *value, _Bool changeable, unsigned
 }
 
 _Bool symbol_force_set(const char *key, struct node *value, _Bool changeable, unsigned pass) {
-	if (!symbols)
-		init_table();
-	struct symbol *olds = dict_lookup(symbols, key);
-	if (!changeable && olds && olds->pass == pass) {
+	struct symbol *s = symbol_slot(key);
+	if (!changeable && s->defined && s->pass == pass) {
 		error(error_type_syntax, "symbol '%s' redefined", key);
 		return 0;
 	}
-	struct symbol *news = xmalloc(sizeof(*news));
-	news->pass = pass;
-	news->node = eval_node(value);
-	_Bool is_inconsistent = (olds && !node_equal(olds->node, news->node));
-	char *key_copy = xstrdup(key);
-	dict_insert(symbols, key_copy, news);
+	struct node *newn = eval_node(value);
+	_Bool is_inconsistent = (s->defined && !node_equal(s->node, newn));
+	node_free(s->node);
+	s->defined = 1;
+	s->pass = pass;
+	s->node = newn;
 	return is_inconsistent;
 }
 
-struct node *symbol_try_get(const char *key) {
-	if (!symbols)
-		init_table();
-	struct symbol *s = dict_lookup(symbols, key);
-	if (!s)
-		return NULL;
-	return node_ref(s->node);
+struct node *symbol_slot_try_get(struct symbol *s) {
+	struct node *n = node_ref(s->node);
+	depend_note_symbol(s->key, n);
+	dpvar_note_ref(s->key);
+	return n;
 }
 
-struct node *symbol_get(const char *key) {
-	struct node *n = symbol_try_get(key);
+struct node *symbol_slot_get(struct symbol *s) {
+	struct node *n = symbol_slot_try_get(s);
 	if (!n) {
 		if (symbol_ignore_undefined) {
 			return node_new_int(0);
 		} else {
-			error(error_type_inconsistent, "symbol '%s' not defined", key);
+			error(error_type_inconsistent, "symbol '%s' not defined", s->key);
 		}
 	}
 	return n;
 }
 
-static void add_to_list(const char *key, struct node *value, struct slist **l) {
-	(void)value;
-	*l = slist_prepend(*l, (void *)key);
+struct node *symbol_try_get(const char *key) {
+	return symbol_slot_try_get(symbol_slot(key));
+}
+
+struct node *symbol_get(const char *key) {
+	return symbol_slot_get(symbol_slot(key));
+}
+
+static void add_to_list(const char *key, struct symbol *s, struct slist **l) {
+	if (s->defined)
+		*l = slist_prepend(*l, (void *)key);
 }
 
 struct slist *symbol_get_list(void) {
 	struct slist *l = NULL;
-	dict_foreach(symbols, (dict_iter_func)add_to_list, &l);
+	if (symbols)
+		dict_foreach(symbols, (dict_iter_func)add_to_list, &l);
 	return l;
 }
 
@@ -128,118 +154,107 @@ void symbol_free_all(void) {
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-static void symbol_local_free(struct symbol_local *sym) {
-	node_free(sym->node);
-	free(sym);
-}
+/* Each local label number maps to an array of its definitions, sorted by line
+ * number.  Lines are assembled in order, so a new definition is nearly always
+ * appended, and in later passes each is found and updated in place. */
 
-static void symbol_local_list_free(gl_list_t sym_list) {
-	gl_list_iterator_t iter = gl_list_iterator(sym_list);
-	const void *elt;
-	gl_list_node_t node;
-	while (gl_list_iterator_next(&iter, &elt, &node)) {
-		gl_list_remove_node(sym_list, node);
-	}
-	gl_list_iterator_free(&iter);
-	gl_list_free(sym_list);
+struct symbol_local_list {
+	unsigned count;
+	unsigned allocated;
+	struct symbol_local *entries;
+};
+
+static void symbol_local_list_free(struct symbol_local_list *list) {
+	for (unsigned i = 0; i < list->count; i++)
+		node_free(list->entries[i].node);
+	free(list->entries);
+	free(list);
 }
 
 struct dict *symbol_local_table_new(void) {
 	return dict_new_full(dict_direct_hash, dict_direct_equal, NULL, (Hash_data_freer)symbol_local_list_free);
 }
 
-static struct symbol_local const *sym_found = NULL;
+/* Index of the first entry with line number greater than that supplied. */
 
-static bool sym_local_equals(const void *a, const void *b) {
-	struct symbol_local const *syma = a, *symb = b;
-	return syma->line_number == symb->line_number;
+static unsigned upper_bound(struct symbol_local_list const *list, unsigned line_number) {
+	unsigned lo = 0, hi = list->count;
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (list->entries[mid].line_number <= line_number)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
 }
 
-static int sym_local_compar(const void *a, const void *b) {
-	struct symbol_local const *syma = a, *symb = b;
-	if (syma->line_number < symb->line_number)
-		return -1;
-	if (syma->line_number > symb->line_number)
-		return 1;
-	return 0;
-}
+/* Backref finds the nearest definition at or before the line, fwdref the
+ * nearest one after it. */
 
-static int sym_local_compar_backref(const void *a, const void *b) {
-	struct symbol_local const *syma = a, *symb = b;
-	if (syma->line_number > symb->line_number)
-		return 1;
-	if (!sym_found || syma->line_number > sym_found->line_number)
-		sym_found = syma;
-	if (syma->line_number < symb->line_number)
-		return -1;
-	return 0;
+struct node *symbol_local_try_backref(struct dict *table, intptr_t key, unsigned line_number) {
+	struct symbol_local_list *list = dict_lookup(table, (void *)key);
+	if (list) {
+		unsigned i = upper_bound(list, line_number);
+		if (i > 0)
+			return node_ref(list->entries[i-1].node);
+	}
+	return NULL;
 }
 
-static int sym_local_compar_fwdref(const void *a, const void *b) {
-	struct symbol_local const *syma = a, *symb = b;
-	if (syma->line_number <= symb->line_number)
-		return -1;
-	if (!sym_found || syma->line_number < sym_found->line_number)
-		sym_found = syma;
-	if (syma->line_number > symb->line_number+1)
-		return 1;
-	return 0;
+struct node *symbol_local_try_fwdref(struct dict *table, intptr_t key, unsigned line_number) {
+	struct symbol_local_list *list = dict_lookup(table, (void *)key);
+	if (list) {
+		unsigned i = upper_bound(list, line_number);
+		if (i < list->count)
+			return node_ref(list->entries[i].node);
+	}
+	return NULL;
 }
 
 struct node *symbol_local_backref(struct dict *table, intptr_t key, unsigned line_number) {
-	gl_list_t sym_list = dict_lookup(table, (void *)key);
-	if (sym_list) {
-		sym_found = NULL;
-		struct symbol_local find = { .line_number = line_number };
-		(void)gl_sortedlist_search(sym_list, sym_local_compar_backref, &find);
-		if (sym_found) {
-			return node_ref(sym_found->node);
-		}
-	}
-	error(error_type_inconsistent, "backref '%ld' not defined", key);
-	return NULL;
+	struct node *n = symbol_local_try_backref(table, key, line_number);
+	depend_note_local(key, 0, n);
+	if (!n)
+		error(error_type_inconsistent, "backref '%ld' not defined", key);
+	return n;
 }
 
 struct node *symbol_local_fwdref(struct dict *table, intptr_t key, unsigned line_number) {
-	gl_list_t sym_list = dict_lookup(table, (void *)key);
-	if (sym_list) {
-		sym_found = NULL;
-		struct symbol_local find = { .line_number = line_number };
-		(void)gl_sortedlist_search(sym_list, sym_local_compar_fwdref, &find);
-		if (sym_found) {
-			return node_ref(sym_found->node);
-		}
-	}
-	error(error_type_inconsistent, "fwdref '%ld' not defined", key);
-	return NULL;
+	struct node *n = symbol_local_try_fwdref(table, key, line_number);
+	depend_note_local(key, 1, n);
+	if (!n)
+		error(error_type_inconsistent, "fwdref '%ld' not defined", key);
+	return n;
 }
 
 void symbol_local_set(struct dict *table, intptr_t key, unsigned line_number,
 		      struct node *value, unsigned pass) {
 	(void)pass;
-	gl_list_t sym_list = dict_lookup(table, (void *)key);
-	gl_list_node_t old_lnode = NULL;
-	struct symbol_local const *old_sym = NULL;
-	if (!sym_list) {
-		sym_list = gl_list_create_empty(GL_AVLTREE_LIST, sym_local_equals, NULL, (gl_listelement_dispose_fn)symbol_local_free, 0);
-		dict_insert(table, (void *)key, sym_list);
-	} else {
-		struct symbol_local find = { .line_number = line_number };
-		old_lnode = gl_list_search(sym_list, &find);
-		if (old_lnode)
-			old_sym = gl_list_node_value(sym_list, old_lnode);
+	struct symbol_local_list *list = dict_lookup(table, (void *)key);
+	if (!list) {
+		list = xmalloc(sizeof(*list));
+		list->count = list->allocated = 0;
+		list->entries = NULL;
+		dict_insert(table, (void *)key, list);
 	}
 	struct node *newn = eval_node(value);
-	struct symbol_local *new_sym = xmalloc(sizeof(*new_sym));
-	new_sym->line_number = line_number;
-	new_sym->node = newn;
-	if (old_sym) {
+	unsigned i = upper_bound(list, line_number);
+	if (i > 0 && list->entries[i-1].line_number == line_number) {
+		struct symbol_local *old_sym = &list->entries[i-1];
 		if (!node_equal(old_sym->node, newn))
 			error(error_type_inconsistent,
 			      "value of local label '%ld' unstable", key);
+		node_free(old_sym->node);
+		old_sym->node = newn;
+		return;
 	}
-	if (old_lnode) {
-		gl_list_remove_node(sym_list, old_lnode);
+	if (list->count >= list->allocated) {
+		list->allocated = list->allocated ? list->allocated * 2 : 4;
+		list->entries = xrealloc(list->entries, list->allocated * sizeof(*list->entries));
 	}
-	gl_sortedlist_add(sym_list, sym_local_compar, new_sym);
+	memmove(&list->entries[i+1], &list->entries[i], (list->count - i) * sizeof(*list->entries));
+	list->entries[i].line_number = line_number;
+	list->entries[i].node = newn;
+	list->count++;
 }
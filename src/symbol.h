@@ -18,6 +18,7 @@ option) any later version.
 struct dict;
 struct node;
 struct slist;
+struct symbol;
 
 /*
  * When processing conditional assembly pseudo-ops, it is necessary to ignore
@@ -26,6 +27,10 @@ struct slist;
 
 extern _Bool symbol_ignore_undefined;
 
+/*
+ * Symbol names (keys) are atoms - see atom.h.
+ */
+
 /*
  * Set a symbol in the current symbol table.  The value is evaluated to a
  * simple type before setting.  If the value already existed from a previous
@@ -46,7 +51,18 @@ struct node *symbol_try_get(const char *key);
 struct node *symbol_get(const char *key);
 
 /*
- * Return list of all symbol names.  Data of type 'const char *', do not free.
+ * Each symbol name has one slot in the table, which remains valid until
+ * symbol_free_all().  Fetching the slot creates it, undefined, if necessary.
+ * A slot can be held on to and read directly, avoiding the lookup by name.
+ */
+
+struct symbol *symbol_slot(const char *key);
+struct node *symbol_slot_try_get(struct symbol *s);
+struct node *symbol_slot_get(struct symbol *s);
+
+/*
+ * Return list of all defined symbol names.  Data of type 'const char *', do
+ * not free.
  */
 
 struct slist *symbol_get_list(void);
@@ -56,6 +72,10 @@ void symbol_free_all(void);
 struct dict *symbol_local_table_new(void);
 struct node *symbol_local_backref(struct dict *table, intptr_t key, unsigned line_number);
 struct node *symbol_local_fwdref(struct dict *table, intptr_t key, unsigned line_number);
+
+/* As above, but return NULL without raising an error if not found. */
+struct node *symbol_local_try_backref(struct dict *table, intptr_t key, unsigned line_number);
+struct node *symbol_local_try_fwdref(struct dict *table, intptr_t key, unsigned line_number);
 void symbol_local_set(struct dict *table, intptr_t key, unsigned line_number,
 		      struct node *value, unsigned pass);
 
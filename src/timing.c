@@ -0,0 +1,352 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "xalloc.h"
+
+#include "error.h"
+#include "opcode.h"
+#include "program.h"
+#include "section.h"
+#include "slist.h"
+#include "timing.h"
+
+struct timing_instr {
+	int pc;
+	int nbytes;
+	int dp;
+	struct section_span const *span;
+};
+
+struct timing_check {
+	int start;
+	int end;
+	unsigned budget;
+	struct prog *prog;
+	unsigned line_number;
+};
+
+static struct timing_instr *instrs = NULL;
+static unsigned ninstrs = 0;
+static unsigned instrs_allocated = 0;
+
+static struct slist *checks = NULL;
+
+_Bool timing_recording = 0;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void timing_free_all(void) {
+	timing_recording = (checks != NULL);
+	free(instrs);
+	instrs = NULL;
+	ninstrs = instrs_allocated = 0;
+	slist_free_full(checks, (slist_free_func)free);
+	checks = NULL;
+}
+
+void timing_add_instr(int pc, int nbytes, struct section_span const *span, int dp) {
+	if (nbytes <= 0 || !span || !span->data)
+		return;
+	if (ninstrs >= instrs_allocated) {
+		instrs_allocated = instrs_allocated ? instrs_allocated * 2 : 256;
+		instrs = xrealloc(instrs, instrs_allocated * sizeof(*instrs));
+	}
+	struct timing_instr *in = &instrs[ninstrs++];
+	in->pc = pc;
+	in->nbytes = nbytes;
+	in->dp = dp;
+	in->span = span;
+}
+
+void timing_add_check(int start, int end, unsigned budget) {
+	struct timing_check *check = xmalloc(sizeof(*check));
+	struct prog_ctx *ctx = prog_ctx_stack->data;
+	check->start = start;
+	check->end = end;
+	check->budget = budget;
+	check->prog = ctx->prog;
+	check->line_number = ctx->line_number;
+	checks = slist_prepend(checks, check);
+	if (!timing_recording)
+		error(error_type_inconsistent, NULL);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* How control leaves an instruction. */
+
+enum flow {
+	flow_next,    // continues to the next instruction
+	flow_goto,    // always continues at target
+	flow_cond,    // continues at either target or the next instruction
+	flow_call,    // calls target, then continues to the next instruction
+	flow_return,  // leaves the path
+	flow_unknown, // continues somewhere that can't be determined
+};
+
+static enum flow instr_flow(struct timing_instr const *in, uint8_t const *code, int *target) {
+	unsigned page = 0;
+	if (code[0] == 0x10 || code[0] == 0x11)
+		page = *(code++);
+	int next = in->pc + in->nbytes;
+	int rel8 = (int8_t)code[1];
+	int rel16 = (int16_t)((code[1] << 8) | code[2]);
+	int ext = (code[1] << 8) | code[2];
+	int dir = (in->dp < 0) ? -1 : ((in->dp << 8) | code[1]);
+	uint8_t op = code[0];
+
+	if (page == 0x10) {
+		*target = (next + rel16) & 0xffff;
+		if (op >= 0x22 && op <= 0x2f)
+			return flow_cond;
+		return (op == 0x3f) ? flow_unknown : flow_next;
+	}
+	if (page == 0x11)
+		return (op == 0x3f) ? flow_unknown : flow_next;
+
+	switch (op) {
+	case 0x20:
+		*target = (next + rel8) & 0xffff;
+		return flow_goto;
+	case 0x21:
+		return flow_next;
+	case 0x22: case 0x23: case 0x24: case 0x25:
+	case 0x26: case 0x27: case 0x28: case 0x29:
+	case 0x2a: case 0x2b: case 0x2c: case 0x2d:
+	case 0x2e: case 0x2f:
+		*target = (next + rel8) & 0xffff;
+		return flow_cond;
+	case 0x16:
+		*target = (next + rel16) & 0xffff;
+		return flow_goto;
+	case 0x17:
+		*target = (next + rel16) & 0xffff;
+		return flow_call;
+	case 0x8d:
+		*target = (next + rel8) & 0xffff;
+		return flow_call;
+	case 0x0e:
+		*target = dir;
+		return (dir < 0) ? flow_unknown : flow_goto;
+	case 0x7e:
+		*target = ext;
+		return flow_goto;
+	case 0x9d:
+		*target = dir;
+		return (dir < 0) ? flow_unknown : flow_call;
+	case 0xbd:
+		*target = ext;
+		return flow_call;
+	case 0x39: case 0x3b:
+		return flow_return;
+	case 0x35: case 0x37:
+		return (code[1] & 0x80) ? flow_return : flow_next;
+	case 0x1e:
+		if ((code[1] & 0x0f) == 5 || (code[1] >> 4) == 5)
+			return flow_unknown;
+		return flow_next;
+	case 0x1f:
+		return ((code[1] & 0x0f) == 5) ? flow_unknown : flow_next;
+	case 0x3f: case 0x6e: case 0xad:
+		return flow_unknown;
+	default:
+		break;
+	}
+	return flow_next;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/* Costs are found by a depth first search from the start address, each
+ * instruction's best and worst case to the end of the path being memoised.
+ * Subroutines are searched in a separate context, as their paths end only at
+ * a return. */
+
+struct cost {
+	unsigned best;
+	unsigned worst;
+};
+
+enum visit {
+	visit_none,
+	visit_active,
+	visit_done,
+};
+
+struct path_ctx {
+	int end;
+	uint8_t *visit;
+	struct cost *cost;
+};
+
+static int instr_cmp(void const *va, void const *vb) {
+	struct timing_instr const *a = va;
+	struct timing_instr const *b = vb;
+	return (a->pc > b->pc) - (a->pc < b->pc);
+}
+
+static int find_instr(int pc) {
+	unsigned lo = 0, hi = ninstrs;
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (instrs[mid].pc < pc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < ninstrs && instrs[lo].pc == pc)
+		return lo;
+	return -1;
+}
+
+static void add_cost(struct cost *total, struct cost const *c) {
+	total->best += c->best;
+	total->worst += c->worst;
+}
+
+static void merge_cost(struct cost *total, struct cost const *c, _Bool first) {
+	if (first || c->best < total->best)
+		total->best = c->best;
+	if (first || c->worst > total->worst)
+		total->worst = c->worst;
+}
+
+static _Bool path_cost(struct path_ctx *ctx, struct path_ctx *sub, int pc, struct cost *cost) {
+	if (pc == ctx->end) {
+		cost->best = cost->worst = 0;
+		return 1;
+	}
+	int i = find_instr(pc);
+	if (i < 0) {
+		error(error_type_data, "no instruction at $%04X to time", pc & 0xffff);
+		return 0;
+	}
+	if (ctx->visit[i] == visit_done) {
+		*cost = ctx->cost[i];
+		return 1;
+	}
+	if (ctx->visit[i] == visit_active) {
+		error(error_type_data, "can't time loop at $%04X", pc & 0xffff);
+		return 0;
+	}
+	ctx->visit[i] = visit_active;
+
+	struct timing_instr const *in = &instrs[i];
+	uint8_t const *code = in->span->data + (in->pc - in->span->org);
+	int extra;
+	int cycles = opcode_cycles(code, in->nbytes, &extra);
+	if (cycles < 0 || extra < 0) {
+		error(error_type_data, "no fixed cycle count for instruction at $%04X", pc & 0xffff);
+		return 0;
+	}
+
+	int target = -1;
+	int next = in->pc + in->nbytes;
+	struct cost here = { cycles, cycles };
+	struct cost c;
+	switch (instr_flow(in, code, &target)) {
+	case flow_next:
+		if (!path_cost(ctx, sub, next, &c))
+			return 0;
+		add_cost(&here, &c);
+		break;
+	case flow_goto:
+		if (!path_cost(ctx, sub, target, &c))
+			return 0;
+		here.best += extra;
+		here.worst += extra;
+		add_cost(&here, &c);
+		break;
+	case flow_cond:
+		{
+			struct cost taken;
+			if (!path_cost(ctx, sub, next, &c))
+				return 0;
+			if (!path_cost(ctx, sub, target, &taken))
+				return 0;
+			taken.best += extra;
+			taken.worst += extra;
+			merge_cost(&c, &taken, 0);
+			add_cost(&here, &c);
+		}
+		break;
+	case flow_call:
+		if (!path_cost(sub, sub, target, &c))
+			return 0;
+		add_cost(&here, &c);
+		if (!path_cost(ctx, sub, next, &c))
+			return 0;
+		add_cost(&here, &c);
+		break;
+	case flow_return:
+		here.worst += extra;
+		break;
+	default:
+		error(error_type_data, "can't follow jump at $%04X", pc & 0xffff);
+		return 0;
+	}
+
+	ctx->cost[i] = here;
+	ctx->visit[i] = visit_done;
+	*cost = here;
+	return 1;
+}
+
+static void path_ctx_init(struct path_ctx *ctx, int end) {
+	ctx->end = end;
+	ctx->visit = xcalloc(ninstrs + 1, sizeof(*ctx->visit));
+	ctx->cost = xmalloc((ninstrs + 1) * sizeof(*ctx->cost));
+}
+
+static void path_ctx_free(struct path_ctx *ctx) {
+	free(ctx->visit);
+	free(ctx->cost);
+}
+
+static void check_timing(struct timing_check const *check) {
+	struct path_ctx top, sub;
+	path_ctx_init(&sub, -1);
+	if (check->end >= 0)
+		path_ctx_init(&top, check->end);
+
+	struct cost cost;
+	if (path_cost(check->end >= 0 ? &top : &sub, &sub, check->start, &cost)) {
+		if (cost.worst > check->budget) {
+			error(error_type_data, "cycles from $%04X: %u-%u, exceeding budget of %u",
+			      check->start & 0xffff, cost.best, cost.worst, check->budget);
+		}
+	}
+
+	if (check->end >= 0)
+		path_ctx_free(&top);
+	path_ctx_free(&sub);
+}
+
+void timing_check_all(void) {
+	if (!checks)
+		return;
+	qsort(instrs, ninstrs, sizeof(*instrs), instr_cmp);
+	checks = slist_reverse(checks);
+	for (struct slist *l = checks; l; l = l->next) {
+		struct timing_check const *check = l->data;
+		struct prog_ctx *ctx = prog_ctx_new(check->prog);
+		ctx->line_number = check->line_number;
+		check_timing(check);
+		prog_ctx_free(ctx);
+	}
+	checks = slist_reverse(checks);
+}
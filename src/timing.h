@@ -0,0 +1,50 @@
+/*
+
+asm6809, a Motorola 6809 cross assembler
+Copyright 2013-2018 Ciaran Anscomb
+
+This program is free software: you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 3 of the License, or (at your
+option) any later version.
+
+*/
+
+#ifndef ASM6809_TIMING_H_
+#define ASM6809_TIMING_H_
+
+/*
+ * Static analysis of instruction timing.
+ *
+ * Once a check has been seen, every instruction assembled in later passes is
+ * noted with timing_add_instr().  The CYCLES_MAX pseudo-op adds a check with
+ * timing_add_check(), recording its place in the source for error reporting.
+ * If instructions weren't being noted, another pass is requested.
+ *
+ * Once the last pass is complete, timing_check_all() follows every path from
+ * each check's start address, through branches and subroutine calls, until a
+ * return instruction or the check's end address.  Best and worst case cycle
+ * counts are computed for the paths, which must be free of loops, and an
+ * error raised if the worst case exceeds the budget.
+ */
+
+struct section_span;
+
+/* Set for a pass if instructions are to be noted. */
+extern _Bool timing_recording;
+
+/* Free all instructions and checks noted in the previous pass, and set
+ * timing_recording if there were any checks. */
+void timing_free_all(void);
+
+/* Note an instruction assembled at pc, its code found in span.  dp is the
+ * direct page assumed at the time, or negative if none. */
+void timing_add_instr(int pc, int nbytes, struct section_span const *span, int dp);
+
+/* Check that paths from start take at most budget cycles.  Paths end at a
+ * return instruction, or on reaching end (if not negative). */
+void timing_add_check(int start, int end, unsigned budget);
+
+void timing_check_all(void);
+
+#endif
@@ -0,0 +1,21 @@
+	; With --relax-branches, plain and long branches take the short form
+	; where the target is in range, otherwise the long form
+
+	org $4000
+near	bra near
+	bne near
+	bsr near
+	lbra near
+	lbeq near
+	lbsr near
+	bra far
+	bcc far
+	bsr far
+	lbra fwd
+	lbmi fwd
+	lbsr fwd
+fwd	nop
+	rmb 200
+far	brn near
+	lbrn near
+	rts
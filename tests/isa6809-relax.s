@@ -0,0 +1,31 @@
+; test relaxing branches
+
+l0	jbra	l0	; short
+	jbsr	l1	; long, forward reference
+	jbrn	l0
+	jbhi	l0
+	jbls	l0
+	jbhs	l0
+	jbcc	l0	; test both forms
+	jblo	l0
+	jbcs	l0	; test both forms
+	jbne	l2
+	jbeq	l2
+	jbvc	l2
+	jbvs	l2
+	jbpl	l2
+	jbmi	l2
+	jbge	l2
+	jblt	l2
+	jbgt	l2
+	jble	l2
+	jbeq	>l2	; forced long
+
+	rmb	100
+l2	rmb	200
+
+	jbra	l2	; long
+	jbsr	l0	; long
+	jbne	<l1	; forced short
+
+l1
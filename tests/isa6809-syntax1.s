@@ -0,0 +1,6 @@
+	; Syntax errors, for checking the order errors are reported in
+
+	lda #1
+	ldb #)
+	nop
+	ldx #(2
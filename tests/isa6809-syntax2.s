@@ -0,0 +1,6 @@
+	; More syntax errors, in a later file
+
+	nop
+	ldd #)
+	nop
+	ldy #(3
@@ -0,0 +1,28 @@
+	org $4000
+start	ldx #$0400
+	lda #$20
+1	sta ,x+
+	cmpx #$0600
+	bne 1B
+	pshs a,b,x,y
+	puls a,b,x,y,pc
+loop	lbne loop
+	lbra loop
+	ldd [$1000]
+	ldd [,x]
+	lda 5,x
+	lda 100,x
+	lda 1000,x
+	lda -1,s
+	ldd d,u
+	leax ,x++
+	jsr [a,y]
+	rti
+	sync
+	cwai #$ef
+	mul
+	fcb 1,2,3
+	swi2
+	ldy >$1234
+	lds <$12
+	cmpu 1,s
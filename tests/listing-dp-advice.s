@@ -0,0 +1,32 @@
+	; Accesses spread over two pages, with a SETDP already in place
+
+	org $4000
+	setdp $20
+
+init	clr $2000
+	clr $2001
+	ldd #$1234
+	std $2002
+
+update	inc $2000
+	lda $2001
+	adda $3000
+	sta $3000
+	ldx $3002
+	leax 1,x
+	stx $3002
+	stx $3004
+	lda $3006
+	sta $3007
+	lda <$10
+	ldb >$3000
+	rts
+
+	; a second section, only using page $30
+	section "other"
+	org $5000
+poll	lda $3010
+	bpl poll
+	ldb $3011
+	stb $3012
+	rts
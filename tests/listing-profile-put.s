@@ -0,0 +1,13 @@
+; test profiling position-independent code put away from its org
+
+	org	$4000
+	put	$2000
+start	ldx	#$0400
+	ldb	#3
+loop	bsr	plot
+	decb
+	bne	loop
+	rts
+
+plot	stb	,x+
+	rts
@@ -0,0 +1,24 @@
+; test profiling with a scripted input
+
+PIA	equ	$ff00
+
+	org	$4000
+start	ldx	#$0400
+	clrb
+loop	lda	PIA		; wait for ready
+	bita	#1
+	beq	loop
+	bsr	plot
+	incb
+	cmpb	#10
+	bne	loop
+	rts
+
+plot	stb	,x+
+	pshs	b
+	ldb	#4
+1	decb
+	bne	1B
+	puls	b,pc
+
+	end	start
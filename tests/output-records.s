@@ -0,0 +1,14 @@
+	; Data split over several SREC or Intel hex records
+
+	org $4000
+start	fcc "The quick brown fox jumps over the lazy dog. 0123456789"
+	fcc "Pack my box with five dozen liquor jugs. ABCDEFGHIJKLMN"
+	fcc "How vexingly quick daft zebras jump! abcdefghijklmnopqr"
+	fcc "Sphinx of black quartz, judge my vow. !#$%&'()*+-./:<=>"
+	fcc "The five boxing wizards jump quickly. ?@[]^_`{|}~ 98765"
+	fcb 1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16
+
+	org $6000
+	fdb start
+
+	end start
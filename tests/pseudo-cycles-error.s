@@ -0,0 +1,27 @@
+	; CYCLES_MAX budgets that can't be met or checked
+
+	org $4000
+
+	; exceeded: worst case is 24 cycles
+	cycles_max start,20
+	; a loop can't be bounded
+	cycles_max wait,100
+	; nor can an indirect jump
+	cycles_max dispatch,100
+
+start	lda #1
+	beq 1f
+	bsr sub
+1	rts
+
+sub	ldb #2
+	rts
+
+wait	lda $ff00
+	bpl wait
+	rts
+
+dispatch	ldx #table
+	jmp [a,x]
+
+table	fdb start,sub
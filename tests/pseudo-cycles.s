@@ -0,0 +1,21 @@
+	; CYCLES_MAX budgets that are met
+
+	org $4000
+
+	; worst case through the branch and subroutine is 24 cycles
+	cycles_max start,24
+	; stop at a label rather than a return
+	cycles_max delay,4,delay_end
+
+start	lda #1
+	beq 1f
+	bsr sub
+1	rts
+
+sub	ldb #2
+	rts
+
+delay	nop
+	nop
+delay_end
+	rts
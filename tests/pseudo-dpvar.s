@@ -0,0 +1,17 @@
+; test allocation of direct page variables
+
+	setdp	$00
+	dparea	$0010,4
+	org	$4000
+start	lda	count
+	ldb	count
+	sta	flag
+	ldx	ptr
+	stx	ptr
+	ldx	#big
+	lda	big,x
+	jmp	start
+count	dpvar	1
+flag	dpvar	1
+ptr	dpvar	2
+big	dpvar	8
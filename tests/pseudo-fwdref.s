@@ -0,0 +1,46 @@
+	; Forward references needing several passes to settle.  Lines whose
+	; dependencies are unchanged are replayed in later passes, and must
+	; give the same result as evaluating them again.
+
+	org $0000
+	setdp dpage
+
+	; direct or extended depending on values defined later
+start	lda v0
+	ldb v1
+	std v2
+	ldx #table
+	leay table,pcr
+	lbra skip
+
+	; each value depends on the next, defined in reverse order
+v0	equ v1-1
+v1	equ v2-1
+v2	equ v3-1
+v3	equ v4-1
+v4	equ dpage*256+$10
+
+	; data whose size depends on later values
+	rmb pad
+	fdb end,table,v4
+	fcb v0,v1,v2,v3
+
+table	fcb 1,2,3,4
+	fdb start,skip,end
+
+skip	lda v3
+	jsr far
+	bra 1f
+	nop
+1	rts
+
+	; padding sized from a value defined after it's used
+pad	equ (v4&$ff)/4
+
+	org $0100
+far	ldu #end
+	leau end-far,u
+	rts
+
+dpage	equ end/256
+end	equ $1200
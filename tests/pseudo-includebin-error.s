@@ -0,0 +1,7 @@
+	; INCLUDEBIN offset and length must lie within the file
+
+	org $4000
+	includebin "pseudo-includebin.bin",9
+	includebin "pseudo-includebin.bin",4,5
+	includebin "pseudo-includebin.bin",-1
+	includebin "pseudo-includebin.bin",0,-1
@@ -0,0 +1,10 @@
+	; INCLUDEBIN with optional offset and length
+
+	org $4000
+	includebin "pseudo-includebin.bin"
+	includebin "pseudo-includebin.bin",6
+	includebin "pseudo-includebin.bin",2,3
+	; nothing to include at the end of the file
+	includebin "pseudo-includebin.bin",8
+	includebin "pseudo-includebin.bin",4,0
+	fcb $ff
@@ -0,0 +1,19 @@
+	; Forward references whose size doesn't depend on their value.  With
+	; --one-pass, these are patched at the end of the first pass, and no
+	; other pass is needed.
+
+	org $4000
+start	jsr later
+	ldx #later
+	ldd table+2
+	lbra later
+	bra 1f
+	nop
+1	fdb later,table,end-start
+	fcb count
+
+later	ldb #count
+	rts
+table	fcb 1,2,3,4
+count	equ 4
+end
@@ -0,0 +1,40 @@
+; test peephole optimisation
+
+	org	$4000
+	optimize on
+
+start	lda	#0		; CLRA, carry overwritten by ADDA
+	adda	#1
+	ldb	#0		; kept, carry read by ROLB
+	rolb
+
+	sta	$ff20
+	lda	$ff20		; kept, may be a hardware register
+	tfr	x,y
+	tfr	y,x		; removed
+
+	optimize loads
+	sta	$1234
+	lda	$1234		; removed
+	sta	3,x
+	lda	3,x		; removed
+	sta	,x+
+	lda	,x+		; kept, different address
+	optimize on
+
+l0	lda	$1234		; kept, labelled
+	lbra	start		; BRA
+	jmp	start		; BRA
+	jsr	start		; BSR
+	lbeq	far		; kept, out of range
+	jmp	>start		; kept, forced extended
+
+	optimize off
+	lda	#0		; kept, optimisation off
+	clrb
+
+	optimize on
+	rmb	200
+far	lda	#0		; CLRA
+	clrb
+	rts
@@ -0,0 +1,12 @@
+	; Overlapping data is reported, and the data emitted later wins
+
+	org $4000
+	fcb 1,2,3,4
+
+	; overlaps $4002-$4003
+	put $4002
+	fcb $aa,$bb,$cc
+
+	; overlaps $4000 from below
+	put $3ffe
+	fcb $11,$22,$33
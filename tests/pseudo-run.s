@@ -0,0 +1,52 @@
+; test running code at assembly time
+
+; generator routines, run by the assembler but also part of the output
+
+	org	$4000
+squares	ldx	#table
+	clrb
+1	pshs	b
+	lda	,s
+	mul
+	std	,x++
+	puls	b
+	incb
+	cmpb	#8
+	blo	1B
+	rts
+
+crc16	ldx	#text
+	ldu	#$ffff
+2	lda	,x+
+	beq	4F
+	pshs	a
+	tfr	u,d
+	eora	,s+
+	ldy	#8
+3	lslb
+	rola
+	bcc	5F
+	eora	#$10
+	eorb	#$21
+5	leay	-1,y
+	bne	3B
+	tfr	d,u
+	bra	2B
+4	stu	result
+	rts
+
+text	fcc	"123456789",0
+
+; results
+
+	run	squares,$8000
+	org	$5000
+	includemem table,16
+count	peek	table+15
+
+	run	crc16,$8000
+crc	peekw	result
+	fdb	crc,count
+
+result	rmb	2
+table	rmb	16
@@ -0,0 +1,34 @@
+#!/bin/sh
+
+fail=0
+tests="pseudo-cond pseudo-section isa6809-indexed isa6309-indexed"
+dir=cache-test.d
+
+rm -rf ${dir}
+mkdir ${dir} || exit 1
+
+for t in ${tests}; do
+	isa=
+	case ${t} in isa6309-*) isa=-3 ;; esac
+	# the first run fills the cache, the second must hit it
+	../src/asm6809${EXEEXT} ${isa} -S --cache-dir=${dir} -l ${t}-cache.lis -o ${t}-cache.out ${t}.s
+	cmp ${t}-cache.out ${t}.cmp || fail=1
+	ls ${dir}/*.parse >/dev/null 2>&1 || fail=1
+	../src/asm6809${EXEEXT} ${isa} -S --cache-dir=${dir} -l ${t}-cache2.lis -o ${t}-cache2.out ${t}.s
+	cmp ${t}-cache2.out ${t}.cmp || fail=1
+	cmp ${t}-cache2.lis ${t}-cache.lis || fail=1
+done
+
+# damaged entries are ignored
+for f in ${dir}/*.parse; do
+	printf 'A6809PC1' > ${f}
+done
+for t in ${tests}; do
+	isa=
+	case ${t} in isa6309-*) isa=-3 ;; esac
+	../src/asm6809${EXEEXT} ${isa} -S --cache-dir=${dir} -o ${t}-cache3.out ${t}.s
+	cmp ${t}-cache3.out ${t}.cmp || fail=1
+done
+
+rm -rf ${dir}
+exit $fail
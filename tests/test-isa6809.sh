@@ -1,11 +1,30 @@
 #!/bin/sh
 
 fail=0
-tests="isa6809-direct isa6809-extended isa6809-immediate isa6809-indexed isa6809-inherent isa6809-relative"
+tests="isa6809-direct isa6809-extended isa6809-immediate isa6809-indexed isa6809-inherent isa6809-relative isa6809-relax"
 
 for t in ${tests}; do
 	../src/asm6809${EXEEXT} -S -l ${t}.lis -o ${t}.out ${t}.s
 	cmp ${t}.out ${t}.cmp || fail=1
 done
 
+# all branches relaxed
+t=isa6809-relax-branches
+../src/asm6809${EXEEXT} --relax-branches -S -l ${t}.lis -o ${t}.out ${t}.s
+cmp ${t}.out ${t}.cmp || fail=1
+
+# several files parsed concurrently assemble as if parsed in turn
+files="isa6809-direct.s isa6809-extended.s isa6809-immediate.s isa6809-indexed.s isa6809-inherent.s"
+../src/asm6809${EXEEXT} -S -o isa6809-files.out ${files}
+../src/asm6809${EXEEXT} -S -j2 -o isa6809-files-j.out ${files}
+cmp isa6809-files-j.out isa6809-files.out || fail=1
+
+# errors found while parsing concurrently are reported in file order
+files="isa6809-direct.s isa6809-syntax1.s isa6809-extended.s isa6809-syntax2.s"
+../src/asm6809${EXEEXT} -S -o isa6809-syntax.out ${files} 2>isa6809-syntax-error.out && fail=1
+../src/asm6809${EXEEXT} -S -j4 -o isa6809-syntax.out ${files} 2>isa6809-syntax-error-j.out && fail=1
+cmp isa6809-syntax-error-j.out isa6809-syntax-error.out || fail=1
+head -n 1 isa6809-syntax-error.out | grep -q syntax1 || fail=1
+tail -n 1 isa6809-syntax-error.out | grep -q syntax2 || fail=1
+
 exit $fail
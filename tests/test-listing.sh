@@ -0,0 +1,26 @@
+#!/bin/sh
+
+fail=0
+tests="listing-cycles"
+
+for t in ${tests}; do
+	../src/asm6809${EXEEXT} --cycles -l ${t}.out ${t}.s
+	cmp ${t}.out ${t}.cmp || fail=1
+done
+
+# SETDP advice, with accesses over two pages
+t=listing-dp-advice
+../src/asm6809${EXEEXT} -B -o ${t}-bin.out --dp-advice=${t}.out ${t}.s
+cmp ${t}.out ${t}.cmp || fail=1
+
+# profile with scripted input, including an annotated listing
+t=listing-profile
+../src/asm6809${EXEEXT} --profile-run=${t}.out --profile-script=${t}.script ${t}.s
+cmp ${t}.out ${t}.cmp || fail=1
+
+# profile code put away from its org, attributed by put address
+t=listing-profile-put
+../src/asm6809${EXEEXT} --profile-run=${t}.out --profile-start='$2000' ${t}.s
+cmp ${t}.out ${t}.cmp || fail=1
+
+exit $fail
@@ -0,0 +1,40 @@
+#!/bin/sh
+
+fail=0
+
+# SREC and Intel hex records at the default length, a shorter length, and a
+# length too long for SREC (which is limited to 252 data bytes)
+t=output-records
+../src/asm6809${EXEEXT} -S -o ${t}-srec.out ${t}.s
+cmp ${t}-srec.out ${t}-srec.cmp || fail=1
+../src/asm6809${EXEEXT} -H -o ${t}-hex.out ${t}.s
+cmp ${t}-hex.out ${t}-hex.cmp || fail=1
+for n in 16 255; do
+	../src/asm6809${EXEEXT} -S --record-length=${n} -o ${t}-srec${n}.out ${t}.s
+	cmp ${t}-srec${n}.out ${t}-srec${n}.cmp || fail=1
+	../src/asm6809${EXEEXT} -H --record-length=${n} -o ${t}-hex${n}.out ${t}.s
+	cmp ${t}-hex${n}.out ${t}-hex${n}.cmp || fail=1
+done
+
+# record lengths out of range are rejected
+rm -f output-record-length-error.out
+for n in 0 -1 256; do
+	../src/asm6809${EXEEXT} -S --record-length=${n} -o ${t}-bad.out ${t}.s 2>>output-record-length-error.out && fail=1
+done
+cmp output-record-length-error.out output-record-length-error.cmp || fail=1
+
+# --emit writes several formats from one run, each as if written alone
+../src/asm6809${EXEEXT} -B -o ${t}-bin.out ${t}.s
+../src/asm6809${EXEEXT} -S -o ${t}-emit-srec.out --emit=bin=${t}-emit-bin.out --emit=hex=${t}-emit-hex.out ${t}.s
+cmp ${t}-emit-bin.out ${t}-bin.out || fail=1
+cmp ${t}-emit-srec.out ${t}-srec.cmp || fail=1
+cmp ${t}-emit-hex.out ${t}-hex.cmp || fail=1
+
+# malformed --emit arguments and unknown formats are rejected
+rm -f output-emit-error.out
+for e in bin hex= =${t}-bad.out zzz=${t}-bad.out; do
+	../src/asm6809${EXEEXT} -S -o ${t}-bad.out --emit=${e} ${t}.s 2>>output-emit-error.out && fail=1
+done
+cmp output-emit-error.out output-emit-error.cmp || fail=1
+
+exit $fail
@@ -1,11 +1,37 @@
 #!/bin/sh
 
 fail=0
-tests="pseudo-cond pseudo-org-put-setdp pseudo-section"
+tests="pseudo-cond pseudo-cycles pseudo-dpvar pseudo-fwdref pseudo-includebin pseudo-onepass pseudo-optimize pseudo-org-put-setdp pseudo-run pseudo-section"
 
 for t in ${tests}; do
 	../src/asm6809${EXEEXT} -S -l ${t}.lis -o ${t}.out ${t}.s
 	cmp ${t}.out ${t}.cmp || fail=1
+	# single-pass mode must produce identical output
+	../src/asm6809${EXEEXT} -S --one-pass -o ${t}-1.out ${t}.s
+	cmp ${t}-1.out ${t}.cmp || fail=1
 done
 
+# patching forward references leaves no need for a second pass
+t=pseudo-onepass
+rm -f ${t}-P1.out
+../src/asm6809${EXEEXT} -S -P 1 --one-pass -o ${t}-P1.out ${t}.s
+cmp ${t}-P1.out ${t}.cmp || fail=1
+../src/asm6809${EXEEXT} -S -P 1 -o ${t}-P1.out ${t}.s 2>/dev/null && fail=1
+
+# errors must be reported identically in either mode
+errtests="pseudo-cycles-error pseudo-includebin-error"
+
+for t in ${errtests}; do
+	../src/asm6809${EXEEXT} -S -o ${t}-bin.out ${t}.s 2>${t}.out && fail=1
+	cmp ${t}.out ${t}.cmp || fail=1
+	../src/asm6809${EXEEXT} -S --one-pass -o ${t}-bin.out ${t}.s 2>${t}-1.out && fail=1
+	cmp ${t}-1.out ${t}.cmp || fail=1
+done
+
+# overlapping data is reported, but still output
+t=pseudo-overlap
+../src/asm6809${EXEEXT} -S -o ${t}.out ${t}.s 2>${t}-error.out && fail=1
+cmp ${t}.out ${t}.cmp || fail=1
+cmp ${t}-error.out ${t}-error.cmp || fail=1
+
 exit $fail